@@ -478,6 +478,24 @@ bool Actor::searchTarget(TargetSearchType_t searchType /*= TARGETSEARCH_DEFAULT*
   return false;
 }
 
+void Actor::getPathToFollowCreature()
+{
+  if(followCreature && g_config.getNumber(ConfigManager::CHASE_FLOW_FIELD)){
+    FindPathParams fpp;
+    getPathSearchParams(followCreature, fpp);
+
+    // Monsters closing in on the same target share one search
+    if(g_game.getMap()->getChasePath(this, followCreature, listWalkDir, fpp)){
+      hasFollowPath = true;
+      startAutoWalk(listWalkDir);
+      onFollowCreatureComplete(followCreature);
+      return;
+    }
+  }
+
+  Creature::getPathToFollowCreature();
+}
+
 void Actor::onFollowCreatureComplete(const Creature* creature)
 {
   if(creature){
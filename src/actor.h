@@ -109,6 +109,7 @@ public:
 
   virtual void onWalk();
   virtual bool getNextStep(Direction& dir, uint32_t& flags);
+  virtual void getPathToFollowCreature();
   virtual void onFollowCreatureComplete(const Creature* creature);
 
   virtual void onThink(uint32_t interval);
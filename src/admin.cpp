@@ -43,7 +43,7 @@ extern BanManager g_bans;
 AdminProtocolConfig* g_adminConfig = NULL;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t ProtocolAdmin::protocolAdminCount = 0;
+boost::atomic<uint32_t> ProtocolAdmin::protocolAdminCount(0);
 #endif
 
 ProtocolAdmin::ProtocolAdmin(Connection_ptr connection) :
@@ -181,7 +181,7 @@ public:
   static const char* protocol_name() {return "admin protocol";}
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-  static uint32_t protocolAdminCount;
+  static boost::atomic<uint32_t> protocolAdminCount;
 #endif
 
   ProtocolAdmin(Connection_ptr connection);
@@ -28,72 +28,212 @@
 
 extern ConfigManager g_config;
 
-bool BanManager::clearTemporaryBans() const
+BanManager::BanManager()
+{
+  IpBanNode root = {{0, 0}, 0};
+  ipBanTrie.push_back(root);
+}
+
+bool BanManager::clearTemporaryBans()
 {
   DatabaseDriver* db = DatabaseDriver::instance();
   DBQuery query;
-  return db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0");
+  if(!db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0")){
+    return false;
+  }
+  return loadIpBans();
+}
+
+IpShard& BanManager::getShard(uint32_t clientip)
+{
+  // Neighbouring addresses usually connect together, spread them
+  return ipShards[(clientip * 2654435761U) >> 26 & (BAN_SHARD_COUNT - 1)];
+}
+
+void BanManager::pruneConnections(IpShard& shard, uint64_t currentTime)
+{
+  // Entries with a full bucket and no block carry no state
+  IpConnectMap::iterator it = shard.ipConnectMap.begin();
+  while(it != shard.ipConnectMap.end()){
+    if(it->second.blockTime <= currentTime &&
+      currentTime - it->second.lastRefill >= 1000 * CONNECT_BURST / CONNECT_RATE_PER_SECOND)
+    {
+      shard.ipConnectMap.erase(it++);
+    }
+    else{
+      ++it;
+    }
+  }
 }
 
 bool BanManager::acceptConnection(uint32_t clientip)
 {
   if(clientip == 0) return false;
-  banLock.lock();
+
+  IpShard& shard = getShard(clientip);
+  boost::mutex::scoped_lock lockClass(shard.lock);
 
   uint64_t currentTime = OTSYS_TIME();
-  IpConnectMap::iterator it = ipConnectMap.find(clientip);
-  if(it == ipConnectMap.end()){
+  IpConnectMap::iterator it = shard.ipConnectMap.find(clientip);
+  if(it == shard.ipConnectMap.end()){
+    if(++shard.inserts >= 1024){
+      shard.inserts = 0;
+      pruneConnections(shard, currentTime);
+    }
+
     ConnectBlock cb;
-    cb.startTime = currentTime;
+    cb.lastRefill = currentTime;
     cb.blockTime = 0;
-    cb.count = 1;
+    cb.tokens = (CONNECT_BURST - 1) * 1000;
 
-    ipConnectMap[clientip] = cb;
-    banLock.unlock();
+    shard.ipConnectMap[clientip] = cb;
     return true;
   }
 
-  it->second.count++;
-  if(it->second.blockTime > currentTime){
-    banLock.unlock();
+  ConnectBlock& cb = it->second;
+  if(cb.blockTime > currentTime){
     return false;
   }
 
-  if(currentTime - it->second.startTime > 1000){
-    uint32_t connectionPerSec = it->second.count;
-    it->second.startTime = currentTime;
-    it->second.count = 0;
-    it->second.blockTime = 0;
+  uint64_t refill = (currentTime - cb.lastRefill) * CONNECT_RATE_PER_SECOND;
+  cb.tokens = (uint32_t)std::min<uint64_t>(CONNECT_BURST * 1000, cb.tokens + refill);
+  cb.lastRefill = currentTime;
 
-    if(connectionPerSec > 10){
-      it->second.blockTime = currentTime + 10000;
-      banLock.unlock();
-      return false;
-    }
+  if(cb.tokens < 1000){
+    cb.blockTime = currentTime + CONNECT_BLOCK_TIME;
+    cb.tokens = CONNECT_BURST * 1000;
+    return false;
   }
 
-  banLock.unlock();
+  cb.tokens -= 1000;
   return true;
 }
 
 bool BanManager::isIpDisabled(uint32_t clientip)
 {
   if(g_config.getNumber(ConfigManager::LOGIN_TRIES) == 0 || clientip == 0) return false;
-  banLock.lock();
+
+  IpShard& shard = getShard(clientip);
+  boost::mutex::scoped_lock lockClass(shard.lock);
 
   time_t currentTime = (OTSYS_TIME() / 1000);
-  IpLoginMap::iterator it = ipLoginMap.find(clientip);
-  if(it != ipLoginMap.end()){
+  IpLoginMap::iterator it = shard.ipLoginMap.find(clientip);
+  if(it != shard.ipLoginMap.end()){
     uint32_t loginTimeout = (uint32_t)g_config.getNumber(ConfigManager::LOGIN_TIMEOUT) / 1000;
     if( (it->second.numberOfLogins >= (uint32_t)g_config.getNumber(ConfigManager::LOGIN_TRIES)) &&
         ((uint32_t)currentTime < (uint32_t)it->second.lastLoginTime + loginTimeout) )
     {
-      banLock.unlock();
       return true;
     }
   }
 
-  banLock.unlock();
+  return false;
+}
+
+bool BanManager::loadIpBans()
+{
+  DatabaseDriver* db = DatabaseDriver::instance();
+
+  DBQuery query;
+  query <<
+    "SELECT `ip`, `mask`, `expires` "
+    "FROM `ip_bans` "
+    "INNER JOIN `bans` ON `bans`.`id` = `ip_bans`.`ban_id` "
+    "WHERE `active` = 1 AND (`expires` >= " << (OTSYS_TIME() / 1000) << " OR `expires` <= 0)";
+
+  DBResult_ptr result = db->storeQuery(query.str());
+  if(!result){
+    //no rows and a failed query look the same. If the database answers a
+    //query that always returns a row there are simply no bans in effect,
+    //all of them expired or lifted, and the loaded ones are cleared
+    bool databaseAnswers = (bool)db->storeQuery("SELECT COUNT(*) AS `count` FROM `ip_bans`");
+    if(!databaseAnswers){
+      return false;
+    }
+  }
+
+  // Built aside, the loaded bans stay in place if anything goes wrong
+  std::vector<IpBanNode> trie;
+  std::vector<IpMaskBan> maskBans;
+
+  IpBanNode root = {{0, 0}, 0};
+  trie.push_back(root);
+
+  if(result){
+    const uint32_t ipColumn = result->getColumnIndex("ip");
+    const uint32_t maskColumn = result->getColumnIndex("mask");
+    const uint32_t expiresColumn = result->getColumnIndex("expires");
+    for(; result; result = result->advance()){
+      insertIpBan(trie, maskBans, (uint32_t)result->getDataLong(ipColumn), (uint32_t)result->getDataLong(maskColumn), result->getDataLong(expiresColumn));
+    }
+  }
+
+  boost::unique_lock<boost::shared_mutex> lockClass(ipBanLock);
+  ipBanTrie.swap(trie);
+  ipMaskBans.swap(maskBans);
+  return true;
+}
+
+void BanManager::insertIpBan(std::vector<IpBanNode>& trie, std::vector<IpMaskBan>& maskBans,
+  uint32_t ip, uint32_t mask, int64_t expires)
+{
+  uint64_t until = (expires <= 0 ? IPBAN_PERMANENT : (uint64_t)expires);
+
+  // A prefix mask has all its set bits on top
+  uint32_t inverted = ~mask;
+  if((inverted & (inverted + 1)) != 0){
+    IpMaskBan ban;
+    ban.ip = ip;
+    ban.mask = mask;
+    ban.until = until;
+    maskBans.push_back(ban);
+    return;
+  }
+
+  uint32_t node = 0;
+  for(uint32_t bit = 31; mask & (1U << bit); --bit){
+    uint32_t side = (ip >> bit) & 1;
+    if(trie[node].child[side] == 0){
+      IpBanNode child = {{0, 0}, 0};
+      trie.push_back(child);
+      trie[node].child[side] = trie.size() - 1;
+    }
+    node = trie[node].child[side];
+
+    if(bit == 0){
+      break;
+    }
+  }
+
+  trie[node].until = std::max(trie[node].until, until);
+}
+
+bool BanManager::isIpBanishedMemory(uint32_t clientip) const
+{
+  uint64_t currentTime = OTSYS_TIME() / 1000;
+  boost::shared_lock<boost::shared_mutex> lockClass(ipBanLock);
+
+  uint32_t node = 0;
+  for(int32_t bit = 31; ; --bit){
+    if(ipBanTrie[node].until >= currentTime){
+      return true;
+    }
+
+    if(bit < 0){
+      break;
+    }
+
+    node = ipBanTrie[node].child[(clientip >> bit) & 1];
+    if(node == 0){
+      break;
+    }
+  }
+
+  for(std::vector<IpMaskBan>::const_iterator it = ipMaskBans.begin(); it != ipMaskBans.end(); ++it){
+    if((clientip & it->mask) == (it->ip & it->mask) && it->until >= currentTime){
+      return true;
+    }
+  }
   return false;
 }
 
@@ -102,7 +242,17 @@ bool BanManager::isIpBanished(uint32_t clientip, uint32_t mask /*= 0xFFFFFFFF*/)
   if(clientip == 0){
     return false;
   }
-  
+
+  // Login checks use the in memory bans, partial masks are an admin
+  // operation and still ask the database
+  if(mask == 0xFFFFFFFF){
+    return isIpBanishedMemory(clientip);
+  }
+  return isIpBanishedDatabase(clientip, mask);
+}
+
+bool BanManager::isIpBanishedDatabase(uint32_t clientip, uint32_t mask) const
+{
   DatabaseDriver* db = DatabaseDriver::instance();
 
   DBQuery query;
@@ -177,17 +327,17 @@ void BanManager::addLoginAttempt(uint32_t clientip, bool isSuccess)
     return;
   }
   
-  banLock.lock();
+  IpShard& shard = getShard(clientip);
+  boost::mutex::scoped_lock lockClass(shard.lock);
 
   time_t currentTime = (OTSYS_TIME() / 1000);
-  IpLoginMap::iterator it = ipLoginMap.find(clientip);
-  if(it == ipLoginMap.end()){
+  IpLoginMap::iterator it = shard.ipLoginMap.find(clientip);
+  if(it == shard.ipLoginMap.end()){
     LoginBlock lb;
     lb.lastLoginTime = 0;
     lb.numberOfLogins = 0;
 
-    ipLoginMap[clientip] = lb;
-    it = ipLoginMap.find(clientip);
+    it = shard.ipLoginMap.insert(std::make_pair(clientip, lb)).first;
   }
 
   if(it->second.numberOfLogins >= (uint32_t)g_config.getNumber(ConfigManager::LOGIN_TRIES)){
@@ -202,11 +352,10 @@ void BanManager::addLoginAttempt(uint32_t clientip, bool isSuccess)
   }
 
   it->second.lastLoginTime = currentTime;
-  banLock.unlock();
 }
 
 bool BanManager::addIpBan(uint32_t ip, uint32_t mask, int32_t time,
-uint32_t adminid, std::string comment) const
+uint32_t adminid, std::string comment)
 {
   if(ip == 0 || mask == 0){
     return false;
@@ -241,7 +390,9 @@ uint32_t adminid, std::string comment) const
   if(!stmt.execute()){
     return false;
   }
-  
+
+  boost::unique_lock<boost::shared_mutex> lockClass(ipBanLock);
+  insertIpBan(ipBanTrie, ipMaskBans, ip, mask, time);
   return true;
 }
 
@@ -361,9 +512,9 @@ std::string statement, uint32_t reason, ViolationAction action) const
   return false;
 }
 
-bool BanManager::removeIpBans(uint32_t ip, uint32_t mask) const
+bool BanManager::removeIpBans(uint32_t ip, uint32_t mask)
 {
-  if(!isIpBanished(ip, mask)){
+  if(!isIpBanishedDatabase(ip, mask)){
     return false;
   }
   
@@ -385,7 +536,7 @@ bool BanManager::removeIpBans(uint32_t ip, uint32_t mask) const
     }
   }
 
-  return true;
+  return loadIpBans();
 }
 
 bool BanManager::removePlayerBans(uint32_t guid) const
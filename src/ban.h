@@ -21,7 +21,8 @@
 #ifndef __OTSERV_BAN_H__
 #define __OTSERV_BAN_H__
 
-#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <stdint.h>
 #include "enums.h"
 
@@ -52,21 +53,59 @@ struct LoginBlock {
   uint32_t numberOfLogins;
 };
 
+// Token bucket, tokens are counted in 1/1000 of a connection
 struct ConnectBlock {
-  uint64_t startTime;
+  uint64_t lastRefill;
   uint64_t blockTime;
-  uint32_t count;
+  uint32_t tokens;
 };
 
 typedef std::map<uint32_t, LoginBlock > IpLoginMap;
 typedef std::map<uint32_t, ConnectBlock > IpConnectMap;
 
+#define CONNECT_RATE_PER_SECOND 10
+#define CONNECT_BURST 10
+#define CONNECT_BLOCK_TIME 10000
+
+// Per IP state is split over shards with their own lock, so connections
+// from different addresses do not wait for each other
+#define BAN_SHARD_COUNT 64
+
+struct IpShard {
+  IpShard() : inserts(0) {}
+
+  boost::mutex lock;
+  IpLoginMap ipLoginMap;
+  IpConnectMap ipConnectMap;
+  uint32_t inserts;
+};
+
+// Binary trie over the prefix bits of active IP bans, a node is banned
+// while `until` (seconds, IPBAN_PERMANENT for no expiry) is in the future
+#define IPBAN_PERMANENT 0xFFFFFFFFFFFFFFFFULL
+
+struct IpBanNode {
+  uint32_t child[2];
+  uint64_t until;
+};
+
+// Bans whose mask is not a prefix, checked one by one
+struct IpMaskBan {
+  uint32_t ip;
+  uint32_t mask;
+  uint64_t until;
+};
+
 class BanManager {
 public:
-    BanManager() {}
+  BanManager();
   ~BanManager() {}
 
-    bool clearTemporaryBans() const;
+  bool clearTemporaryBans();
+
+  // In memory copy of the active IP bans, used by isIpBanished
+  bool loadIpBans();
+
   bool acceptConnection(uint32_t clientip);
 
   bool isIpDisabled(uint32_t clientip);
@@ -76,7 +115,7 @@ public:
   bool isAccountBanished(uint32_t accountId) const;
 
   void addLoginAttempt(uint32_t clientip, bool isSuccess);
-  bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment) const;
+  bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment);
   bool addPlayerBan(uint32_t playerId, int32_t time, uint32_t adminid, std::string comment,
     std::string statement, uint32_t reason, ViolationAction action) const;
   bool addPlayerBan(const std::string& name, int32_t time, uint32_t adminid, std::string comment,
@@ -88,7 +127,7 @@ public:
   bool addAccountNotation(uint32_t account, uint32_t adminid, std::string comment,
     std::string statement, uint32_t reason, ViolationAction action) const;
 
-  bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF) const;
+  bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF);
   bool removePlayerBans(uint32_t guid) const;
   bool removePlayerBans(const std::string& name) const;
   bool removeAccountBans(uint32_t accno) const;
@@ -97,10 +136,19 @@ public:
   uint32_t getNotationsCount(uint32_t account) const;
   std::vector<Ban> getBans(BanType_t type);
 protected:
-  mutable boost::recursive_mutex banLock;
+  IpShard& getShard(uint32_t clientip);
+  void pruneConnections(IpShard& shard, uint64_t currentTime);
 
-  IpLoginMap ipLoginMap;
-  IpConnectMap ipConnectMap;
+  static void insertIpBan(std::vector<IpBanNode>& trie, std::vector<IpMaskBan>& maskBans,
+    uint32_t ip, uint32_t mask, int64_t expires);
+  bool isIpBanishedMemory(uint32_t clientip) const;
+  bool isIpBanishedDatabase(uint32_t clientip, uint32_t mask) const;
+
+  IpShard ipShards[BAN_SHARD_COUNT];
+
+  mutable boost::shared_mutex ipBanLock;
+  std::vector<IpBanNode> ipBanTrie;
+  std::vector<IpMaskBan> ipMaskBans;
 };
 
 #endif
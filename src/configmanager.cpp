@@ -99,6 +99,11 @@ bool ConfigManager::loadFile(const std::string& _filename)
     m_confString[SQL_DB] = getGlobalString(L, "database_schema");
     m_confString[SQL_TYPE] = getGlobalString(L, "database_type", "sqlite");
     m_confInteger[SQL_PORT] = getGlobalNumber(L, "database_port");
+    m_confInteger[SQL_POOL_SIZE] = getGlobalNumber(L, "database_pool_size", 4);
+    m_confInteger[NETWORK_THREADS] = getGlobalNumber(L, "network_threads", 1);
+    m_confString[OUTPUT_FLUSH_POLICY] = getGlobalString(L, "output_flush_policy", "threshold");
+    m_confInteger[OUTPUT_FLUSH_SIZE] = getGlobalNumber(L, "output_flush_size", 1024);
+    m_confInteger[OUTPUT_FLUSH_DELAY] = getGlobalNumber(L, "output_flush_delay", 10);
   }
 
   m_confString[LOGIN_MSG] = getGlobalString(L, "loginmsg", "Welcome.");
@@ -186,6 +191,10 @@ bool ConfigManager::loadFile(const std::string& _filename)
 
   m_confInteger[PASSWORD_TYPE] = PASSWORD_TYPE_PLAIN;
   m_confInteger[STATUSQUERY_TIMEOUT] = getGlobalNumber(L, "status_information_timeout", 30 * 1000);
+  m_confInteger[PATHFINDING_MAX_NODES] = getGlobalNumber(L, "pathfinding_max_nodes", 512);
+  m_confInteger[CHASE_FLOW_FIELD] = getGlobalBoolean(L, "chase_flow_field", false);
+  m_confInteger[PLAYER_SAVE_QUEUE_SIZE] = getGlobalNumber(L, "player_save_queue_size", 500);
+  m_confInteger[SQL_PING_INTERVAL] = getGlobalNumber(L, "database_ping_interval", 60);
 
   m_isLoaded = true;
   return true;
@@ -55,6 +55,7 @@ public:
     SQL_DB,
     SQL_TYPE,
     MAP_STORAGE_TYPE,
+    OUTPUT_FLUSH_POLICY,
     LAST_STRING_CONFIG /* this must be the last one */
   };
 
@@ -139,6 +140,14 @@ public:
     RATES_FOR_PLAYER_KILLING,
     RATE_EXPERIENCE_PVP,
     ADDONS_ONLY_FOR_PREMIUM,
+    NETWORK_THREADS,
+    OUTPUT_FLUSH_SIZE,
+    OUTPUT_FLUSH_DELAY,
+    PATHFINDING_MAX_NODES,
+    CHASE_FLOW_FIELD,
+    PLAYER_SAVE_QUEUE_SIZE,
+    SQL_POOL_SIZE,
+    SQL_PING_INTERVAL,
     LAST_INTEGER_CONFIG /* this must be the last one */
   };
 
@@ -33,7 +33,30 @@
 bool Connection::m_logError = true;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t Connection::connectionCount = 0;
+boost::atomic<uint32_t> Connection::connectionCount(0);
+boost::atomic<uint64_t> Connection::writeCount(0);
+boost::atomic<uint64_t> Connection::writtenBytes(0);
+boost::atomic<uint64_t> Connection::writtenMessages(0);
+
+void Connection::getWriteStats(double& writesPerSecond, double& bytesPerWrite)
+{
+  static boost::mutex statsLock;
+  static int64_t lastTime = OTSYS_TIME();
+  static uint64_t lastWrites = 0;
+  static uint64_t lastBytes = 0;
+
+  boost::lock_guard<boost::mutex> lockClass(statsLock);
+  int64_t now = OTSYS_TIME();
+  uint64_t writes = writeCount;
+  uint64_t bytes = writtenBytes;
+
+  writesPerSecond = (now > lastTime ? (writes - lastWrites) * 1000. / (now - lastTime) : 0.);
+  bytesPerWrite = (writes > lastWrites ? double(bytes - lastBytes) / (writes - lastWrites) : 0.);
+
+  lastTime = now;
+  lastWrites = writes;
+  lastBytes = bytes;
+}
 #endif
 
 ConnectionManager* ConnectionManager::getInstance()
@@ -189,6 +212,9 @@ void Connection::closeSocket()
 
   m_connectionLock.lock();
 
+  // Messages still waiting for a write will never be sent
+  m_writeQueue.clear();
+
   if(m_socket->is_open()){
     #ifdef __DEBUG_NET_DETAIL__
     std::cout << "Closing socket" << std::endl;
@@ -432,34 +458,55 @@ bool Connection::send(OutputMessage_ptr msg)
     return false;
   }
 
-  if(m_pendingWrite == 0){
-    msg->getProtocol()->onSendMessage(msg);
+  msg->getProtocol()->onSendMessage(msg);
 
-    TRACK_MESSAGE(msg);
+  TRACK_MESSAGE(msg);
 
+  if(m_pendingWrite == 0){
     #ifdef __DEBUG_NET_DETAIL__
     std::cout << "Connection::send " << msg->getMessageLength() << std::endl;
     #endif
 
-    internalSend(msg);
+    m_writingMessages.push_back(msg);
+    internalSend();
   }
   else{
     #ifdef __DEBUG_NET_DETAIL__
     std::cout << "Connection::send Adding to queue " << msg->getMessageLength() << std::endl;
     #endif
 
-    TRACK_MESSAGE(msg);
-    OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-    outputPool->addToAutoSend(msg);
+    // Goes out with the next write, together with everything else queued until then
+    m_writeQueue.push_back(msg);
   }
 
   m_connectionLock.unlock();
   return true;
 }
 
-void Connection::internalSend(OutputMessage_ptr msg)
+bool Connection::isWriting()
 {
-  TRACK_MESSAGE(msg);
+  boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+  return m_pendingWrite > 0;
+}
+
+void Connection::internalSend()
+{
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.reserve(m_writingMessages.size());
+
+  for(OutputMessageQueue::iterator it = m_writingMessages.begin(); it != m_writingMessages.end(); ++it){
+    TRACK_MESSAGE(*it);
+    buffers.push_back(boost::asio::buffer((*it)->getOutputBuffer(), (*it)->getMessageLength()));
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    writtenBytes += (*it)->getMessageLength();
+#endif
+  }
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++writeCount;
+  writtenMessages += m_writingMessages.size();
+#endif
 
   try{
     ++m_pendingWrite;
@@ -467,9 +514,9 @@ void Connection::internalSend(OutputMessage_ptr msg)
     m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
       boost::asio::placeholders::error));
 
-    boost::asio::async_write(getHandle(),
-      boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()),
-      boost::bind(&Connection::onWriteOperation, shared_from_this(), msg, boost::asio::placeholders::error));
+    // The messages are kept alive by m_writingMessages until onWriteOperation
+    boost::asio::async_write(getHandle(), buffers,
+      boost::bind(&Connection::onWriteOperation, shared_from_this(), boost::asio::placeholders::error));
   }
   catch(boost::system::system_error& e){
     if(m_logError){
@@ -503,7 +550,7 @@ int32_t Connection::unRef()
   return --m_refCount;
 }
 
-void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error)
+void Connection::onWriteOperation(const boost::system::error_code& error)
 {
   #ifdef __DEBUG_NET_DETAIL__
   std::cout << "onWriteOperation" << std::endl;
@@ -512,14 +559,14 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
   m_connectionLock.lock();
   m_writeTimer.cancel();
 
-  TRACK_MESSAGE(msg);
-  msg.reset();
+  m_writingMessages.clear();
 
   if(error){
     handleWriteError(error);
   }
 
   if(m_connectionState != CONNECTION_STATE_OPEN || m_writeError){
+    m_writeQueue.clear();
     closeSocket();
     closeConnection();
     m_connectionLock.unlock();
@@ -527,6 +574,13 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
   }
 
   --m_pendingWrite;
+
+  if(!m_writeQueue.empty()){
+    // Send everything that queued up meanwhile in one go
+    m_writingMessages.swap(m_writeQueue);
+    internalSend();
+  }
+
   m_connectionLock.unlock();
 }
 
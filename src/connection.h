@@ -26,6 +26,8 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/atomic.hpp>
+#include <vector>
 #include "networkmessage.h"
 
 class OutputMessage;
@@ -73,7 +75,15 @@ public:
   ~Connection();
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-  static uint32_t connectionCount;
+  static boost::atomic<uint32_t> connectionCount;
+
+  // Every write is one scatter-gather send of all queued messages
+  static boost::atomic<uint64_t> writeCount;
+  static boost::atomic<uint64_t> writtenBytes;
+  static boost::atomic<uint64_t> writtenMessages;
+
+  // Writes per second and average bytes per write since the previous call
+  static void getWriteStats(double& writesPerSecond, double& bytesPerWrite);
 #endif
 
   enum { write_timeout = 30 };
@@ -94,6 +104,8 @@ public:
   void acceptConnection();
 
   bool send(OutputMessage_ptr msg);
+  // A write is in flight, messages sent now wait for it to complete
+  bool isWriting();
 
   uint32_t getIP() const;
 
@@ -104,7 +116,7 @@ private:
   void parseHeader(const boost::system::error_code& error);
   void parsePacket(const boost::system::error_code& error);
 
-  void onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error);
+  void onWriteOperation(const boost::system::error_code& error);
 
   void onStopOperation();
   void handleReadError(const boost::system::error_code& error);
@@ -120,7 +132,7 @@ private:
   void onReadTimeout();
   void onWriteTimeout();
 
-  void internalSend(OutputMessage_ptr msg);
+  void internalSend();
 
   NetworkMessage m_msg;
   boost::asio::ip::tcp::socket* m_socket;
@@ -132,6 +144,12 @@ private:
   bool m_writeError;
   bool m_readError;
 
+  typedef std::vector<OutputMessage_ptr> OutputMessageQueue;
+  // Messages of the write in progress
+  OutputMessageQueue m_writingMessages;
+  // Messages that will go out together once that write completes
+  OutputMessageQueue m_writeQueue;
+
   int32_t m_pendingWrite;
   int32_t m_pendingRead;
   ConnectionState_t m_connectionState;
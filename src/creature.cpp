@@ -38,11 +38,17 @@ AutoID::list_type AutoID::list;
 extern Game g_game;
 extern ConfigManager g_config;
 
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+uint64_t Creature::mapCacheRebuilds = 0;
+uint64_t Creature::mapCacheIncrementals = 0;
+#endif
+
 Creature::Creature() :
   isInternalRemoved(false)
 {
   id = 0;
   _tile = NULL;
+  spectatorEpoch = 0;
   direction  = NORTH;
   master = NULL;
   lootDrop = true;
@@ -454,7 +460,13 @@ uint64_t Creature::getLostExperience() const
 
 void Creature::updateMapCache()
 {
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++mapCacheRebuilds;
+#endif
+
   Tile* tile;
+  bool blocked;
+  Map* map = g_game.getMap();
   const Position& myPos = getPosition();
   Position pos(0, 0, myPos.z);
 
@@ -462,8 +474,9 @@ void Creature::updateMapCache()
     for(int32_t x = -((mapWalkWidth - 1) / 2); x <= ((mapWalkWidth - 1) / 2); ++x){
       pos.x = myPos.x + x;
       pos.y = myPos.y + y;
-      tile = g_game.getParentTile(pos.x, pos.y, myPos.z);
-      updateTileCache(tile, pos);
+      //statically blocked tiles are cached as unwalkable without asking the tile
+      tile = map->getWalkTile(pos, blocked);
+      updateTileCache(blocked ? NULL : tile, pos);
     }
   }
 }
@@ -485,8 +498,9 @@ void Creature::updateTileCache(const Tile* tile, int32_t dx, int32_t dy)
   if((std::abs(dx) <= (mapWalkWidth - 1) / 2) &&
     (std::abs(dy) <= (mapWalkHeight - 1) / 2)){
 
-    int32_t x = (mapWalkWidth - 1) / 2 + dx;
-    int32_t y = (mapWalkHeight - 1) / 2 + dy;
+    const Position& myPos = getPosition();
+    int32_t x = getMapCacheIndex(myPos.x + dx, mapWalkWidth);
+    int32_t y = getMapCacheIndex(myPos.y + dy, mapWalkHeight);
 
     localMapCache[y][x] = (tile && tile->__queryAdd(0, this, 1,
       FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE) == RET_NOERROR);
@@ -530,8 +544,8 @@ int32_t Creature::getWalkCache(const Position& pos) const
   if((std::abs(dx) <= (mapWalkWidth - 1) / 2) &&
     (std::abs(dy) <= (mapWalkHeight - 1) / 2)){
 
-    int32_t x = (mapWalkWidth - 1) / 2 + dx;
-    int32_t y = (mapWalkHeight - 1) / 2 + dy;
+    int32_t x = getMapCacheIndex(pos.x, mapWalkWidth);
+    int32_t y = getMapCacheIndex(pos.y, mapWalkHeight);
 
 #ifdef __DEBUG__
     //testing
@@ -704,85 +718,40 @@ void Creature::onCreatureMove(const Creature* creature, const Tile* newTile, con
 
     //update map cache
     if(isMapLoaded){
-      if(teleport || oldPos.z != newPos.z){
+      if(teleport || oldPos.z != newPos.z ||
+        std::abs(newPos.x - oldPos.x) > 1 || std::abs(newPos.y - oldPos.y) > 1)
+      {
         updateMapCache();
       }
       else{
-        Tile* tile;
-        const Position& myPos = getPosition();
-        Position pos;
-
-        if(oldPos.y > newPos.y){ // north
-          //shift y south
-          for(int32_t y = mapWalkHeight - 1 - 1; y >= 0; --y){
-            memcpy(localMapCache[y + 1], localMapCache[y], sizeof(localMapCache[y]));
-          }
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+        ++mapCacheIncrementals;
+#endif
 
-          //update 0
-          for(int32_t x = -((mapWalkWidth - 1) / 2); x <= ((mapWalkWidth - 1) / 2); ++x){
-            tile = g_game.getParentTile(myPos.x + x, myPos.y - ((mapWalkHeight - 1) / 2), myPos.z);
-            updateTileCache(tile, x, -((mapWalkHeight - 1) / 2));
-          }
-        }
-        else if(oldPos.y < newPos.y){ // south
-          //shift y north
-          for(int32_t y = 0; y <= mapWalkHeight - 1 - 1; ++y){
-            memcpy(localMapCache[y], localMapCache[y + 1], sizeof(localMapCache[y]));
-          }
+        //the cells of the row/column that left the window are reused for
+        //the one that came into view, everything else stays where it is
+        Tile* tile;
+        bool blocked;
+        Map* map = g_game.getMap();
+        Position pos(0, 0, newPos.z);
 
-          //update mapWalkHeight - 1
+        if(oldPos.y != newPos.y){
+          int32_t dy = (newPos.y < oldPos.y ? -((mapWalkHeight - 1) / 2) : (mapWalkHeight - 1) / 2);
+          pos.y = newPos.y + dy;
           for(int32_t x = -((mapWalkWidth - 1) / 2); x <= ((mapWalkWidth - 1) / 2); ++x){
-            tile = g_game.getParentTile(myPos.x + x, myPos.y + ((mapWalkHeight - 1) / 2), myPos.z);
-            updateTileCache(tile, x, (mapWalkHeight - 1) / 2);
-          }
-        }
-
-        if(oldPos.x < newPos.x){ // east
-          //shift y west
-          int32_t starty = 0;
-          int32_t endy = mapWalkHeight - 1;
-          int32_t dy = (oldPos.y - newPos.y);
-          if(dy < 0){
-            endy = endy + dy;
-          }
-          else if(dy > 0){
-            starty = starty + dy;
-          }
-
-          for(int32_t y = starty; y <= endy; ++y){
-            for(int32_t x = 0; x <= mapWalkWidth - 1 - 1; ++x){
-              localMapCache[y][x] = localMapCache[y][x + 1];
-            }
-          }
-
-          //update mapWalkWidth - 1
-          for(int32_t y = -((mapWalkHeight - 1) / 2); y <= ((mapWalkHeight - 1) / 2); ++y){
-            tile = g_game.getParentTile(myPos.x + ((mapWalkWidth - 1) / 2), myPos.y + y, myPos.z);
-            updateTileCache(tile, (mapWalkWidth - 1) / 2, y);
+            pos.x = newPos.x + x;
+            tile = map->getWalkTile(pos, blocked);
+            updateTileCache(blocked ? NULL : tile, x, dy);
           }
         }
-        else if(oldPos.x > newPos.x){ // west
-          //shift y east
-          int32_t starty = 0;
-          int32_t endy = mapWalkHeight - 1;
-          int32_t dy = (oldPos.y - newPos.y);
-          if(dy < 0){
-            endy = endy + dy;
-          }
-          else if(dy > 0){
-            starty = starty + dy;
-          }
-
-          for(int32_t y = starty; y <= endy; ++y){
-            for(int32_t x = mapWalkWidth - 1 - 1; x >= 0; --x){
-              localMapCache[y][x + 1] = localMapCache[y][x];
-            }
-          }
 
-          //update 0
+        if(oldPos.x != newPos.x){
+          int32_t dx = (newPos.x < oldPos.x ? -((mapWalkWidth - 1) / 2) : (mapWalkWidth - 1) / 2);
+          pos.x = newPos.x + dx;
           for(int32_t y = -((mapWalkHeight - 1) / 2); y <= ((mapWalkHeight - 1) / 2); ++y){
-            tile = g_game.getParentTile(myPos.x - ((mapWalkWidth - 1) / 2), myPos.y + y, myPos.z);
-            updateTileCache(tile, -((mapWalkWidth - 1) / 2), y);
+            pos.y = newPos.y + y;
+            tile = map->getWalkTile(pos, blocked);
+            updateTileCache(blocked ? NULL : tile, dx, y);
           }
         }
 
@@ -2138,7 +2107,13 @@ void Creature::clearListeners() {
 
 void Creature::setCustomValue(const std::string& key, const std::string& value)
 {
-  storageMap[key] = value;
+  std::pair<StorageMap::iterator, bool> ret = storageMap.insert(std::make_pair(key, value));
+  if(ret.second || ret.first->second != value){
+    ret.first->second = value;
+    if(getPlayer()){
+      dirtyStorageKeys.insert(key);
+    }
+  }
 }
 
 void Creature::setCustomValue(const std::string& key, int32_t value)
@@ -2154,6 +2129,9 @@ bool Creature::eraseCustomValue(const std::string& key)
   it = storageMap.find(key);
   if(it != storageMap.end()){
     storageMap.erase(it);
+    if(getPlayer()){
+      dirtyStorageKeys.insert(key);
+    }
     return true;
   }
   return false;
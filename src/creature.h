@@ -23,6 +23,7 @@
 
 #include <list>
 #include <map>
+#include <set>
 #include "templates.h"
 #include "thing.h"
 #include "condition_attributes.h"
@@ -33,6 +34,7 @@
 
 typedef std::list<Condition*> ConditionList;
 typedef std::map<std::string, std::string> StorageMap;
+typedef std::set<std::string> StorageKeySet;
 
 struct FindPathParams{
   bool fullPathSearch;
@@ -121,6 +123,12 @@ protected:
 public:
   virtual ~Creature();
 
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  // Walk cache window rebuilds versus one-step ring buffer updates
+  static uint64_t mapCacheRebuilds;
+  static uint64_t mapCacheIncrementals;
+#endif
+
   virtual Creature* getCreature();
   virtual const Creature* getCreature() const;
   virtual Player* getPlayer();
@@ -128,7 +136,7 @@ public:
   virtual Actor* getActor();
   virtual const Actor* getActor() const;
 
-  void getPathToFollowCreature();
+  virtual void getPathToFollowCreature();
 
   virtual const std::string& getName() const = 0;
   virtual const std::string& getNameDescription() const = 0;
@@ -358,12 +366,20 @@ public:
 protected:
   static const int32_t mapWalkWidth = Map_maxViewportX * 2 + 1;
   static const int32_t mapWalkHeight = Map_maxViewportY * 2 + 1;
+  // Ring buffer indexed by absolute coordinates modulo the window size, so a
+  // one-step move only recomputes the row/column that came into view
   bool localMapCache[mapWalkHeight][mapWalkWidth];
+  static int32_t getMapCacheIndex(int32_t coord, int32_t size){
+    int32_t index = coord % size;
+    return (index < 0 ? index + size : index);
+  }
 
   virtual bool useCacheMap() const;
 
   Tile* _tile;
   uint32_t id;
+  // Last spectator query this creature was collected by, see Map::getSpectatorsInternal
+  uint32_t spectatorEpoch;
   bool isInternalRemoved;
   bool isMapLoaded;
   bool isUpdatingPath;
@@ -374,6 +390,8 @@ protected:
 
   Script::ListenerList registered_listeners;
   StorageMap storageMap;
+  // Keys set or erased since the storage was last saved, only players are saved
+  StorageKeySet dirtyStorageKeys;
 
   int32_t health, healthMax;
   int32_t mana, manaMax;
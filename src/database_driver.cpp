@@ -35,32 +35,153 @@
 #endif
 
 #include "configmanager.h"
+#include "otsystem.h"
 extern ConfigManager g_config;
 
-boost::recursive_mutex DBQuery::database_lock;
-
-DatabaseDriver* DatabaseDriver::_instance = NULL;
+boost::mutex DatabaseDriver::_poolLock;
+boost::condition_variable DatabaseDriver::_poolSignal;
+std::vector<DatabaseDriver*> DatabaseDriver::_idleConnections;
+uint32_t DatabaseDriver::_connectionCount = 0;
+// Defined after the pool, it gives back the connection of an exiting thread while the pool still exists
+boost::thread_specific_ptr<DatabaseDriver> DatabaseDriver::_threadConnection(&DatabaseDriver::returnConnection);
 
 DatabaseDriver* DatabaseDriver::instance(){
-  if(!_instance){
+  DatabaseDriver* db = _threadConnection.get();
+  if(!db){
+    if(!(db = borrowConnection()))
+      return NULL;
+
+    _threadConnection.reset(db);
+  }
+
+  db->checkConnection();
+  return db;
+}
+
+DatabaseDriver* DatabaseDriver::borrowConnection()
+{
+  uint32_t poolSize = (uint32_t)std::max<int64_t>(1, g_config.getNumber(ConfigManager::SQL_POOL_SIZE));
+
+  boost::unique_lock<boost::mutex> poolLockUnique(_poolLock);
+  if(_idleConnections.empty() && _connectionCount >= poolSize){
+    //connections are given back after each operation, one is free soon
+    boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(DB_POOL_WAIT_TIME);
+    while(_idleConnections.empty()){
+      if(!_poolSignal.timed_wait(poolLockUnique, timeout))
+        break;
+    }
+  }
+
+  if(!_idleConnections.empty()){
+    DatabaseDriver* db = _idleConnections.back();
+    _idleConnections.pop_back();
+    return db;
+  }
+
+  if(_connectionCount >= poolSize){
+    std::cout << "Warning: All " << poolSize << " database connections are in use, opening another one." << std::endl;
+  }
+
+  ++_connectionCount;
+  poolLockUnique.unlock();
+
+  DatabaseDriver* db = createConnection();
+  if(!db){
+    poolLockUnique.lock();
+    --_connectionCount;
+    return NULL;
+  }
+
+  db->m_lastCheck = OTSYS_TIME();
+  return db;
+}
+
+DatabaseDriver* DatabaseDriver::createConnection()
+{
 #ifdef __USE_MYSQL__
-    if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
-      _instance = new DatabaseMySQL;
+  if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
+    return new DatabaseMySQL;
 #endif
 #ifdef __USE_ODBC__
-    if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
-      _instance = new DatabaseODBC;
+  if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
+    return new DatabaseODBC;
 #endif
 #ifdef __USE_SQLITE__
-    if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
-      _instance = new DatabaseSQLite;
+  if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
+    return new DatabaseSQLite;
 #endif
 #ifdef __USE_PGSQL__
-    if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
-      _instance = new DatabasePgSQL;
+  if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
+    return new DatabasePgSQL;
 #endif
+  return NULL;
+}
+
+void DatabaseDriver::returnConnection(DatabaseDriver* db)
+{
+  uint32_t poolSize = (uint32_t)std::max<int64_t>(1, g_config.getNumber(ConfigManager::SQL_POOL_SIZE));
+
+  boost::unique_lock<boost::mutex> poolLockUnique(_poolLock);
+  if(_connectionCount > poolSize){
+    //opened while the pool was exhausted
+    --_connectionCount;
+    poolLockUnique.unlock();
+    delete db;
+    return;
+  }
+
+  _idleConnections.push_back(db);
+  poolLockUnique.unlock();
+
+  _poolSignal.notify_one();
+}
+
+void DatabaseDriver::use()
+{
+  ++m_useCount;
+}
+
+void DatabaseDriver::release()
+{
+  if(--m_useCount == 0 && _threadConnection.get() == this){
+    _threadConnection.release();
+    returnConnection(this);
+  }
+}
+
+DBResult_ptr DatabaseDriver::wrapResult(DBResult* res)
+{
+  use();
+  return DBResult_ptr(res, boost::bind(&DatabaseDriver::releaseResult, this, _1));
+}
+
+void DatabaseDriver::releaseResult(DBResult* res)
+{
+  freeResult(res);
+  release();
+}
+
+void DatabaseDriver::checkConnection()
+{
+  if(m_useCount > 0)
+    return;
+
+  //a lost connection is retried every second at most
+  int64_t now = OTSYS_TIME();
+  int64_t interval = (m_connected ? g_config.getNumber(ConfigManager::SQL_PING_INTERVAL) * 1000 : 1000);
+  if(now - m_lastCheck < interval)
+    return;
+
+  bool wasConnected = m_connected;
+  m_lastCheck = now;
+  if(ping()){
+    if(!wasConnected){
+      std::cout << "Notice: Database connection restored." << std::endl;
+    }
+  }
+  else if(wasConnected){
+    std::cout << "Error: Database connection lost, retrying." << std::endl;
   }
-  return _instance;
 }
 
 bool DatabaseDriver::executeQuery(DBQuery &query)
@@ -83,11 +204,46 @@ DBResult_ptr DatabaseDriver::storeQuery(DBQuery &query)
   return storeQuery(query.str());
 }
 
+DBResult_ptr DatabaseDriver::streamQuery(const std::string &query)
+{
+  return internalStreamQuery(query);
+}
+
+DBResult_ptr DatabaseDriver::streamQuery(DBQuery &query)
+{
+  return streamQuery(query.str());
+}
+
 void DatabaseDriver::freeResult(DBResult *res)
 {
   throw std::runtime_error("No database driver loaded, yet a DBResult was freed.");
 }
 
+DBStatement_ptr DatabaseDriver::prepare(const std::string &query)
+{
+  StatementCache::iterator it = m_statements.find(query);
+  if(it != m_statements.end()){
+    //only the cache holds it, nobody is using it
+    if(it->second.use_count() == 1){
+      it->second->clearBindings();
+      return it->second;
+    }
+
+    return createStatement(query);
+  }
+
+  DBStatement_ptr statement = createStatement(query);
+  if(m_statements.size() < DB_STATEMENT_CACHE_SIZE){
+    m_statements[query] = statement;
+  }
+  return statement;
+}
+
+DBStatement_ptr DatabaseDriver::createStatement(const std::string &query)
+{
+  return DBStatement_ptr(new DBStatement(this, query));
+}
+
 DBResult_ptr DatabaseDriver::verifyResult(DBResult_ptr result)
 {
   if(!result->advance()){
@@ -98,16 +254,156 @@ DBResult_ptr DatabaseDriver::verifyResult(DBResult_ptr result)
   }
 }
 
+// DBResult
+
+uint32_t DBResult::getColumnIndex(const std::string &s) const
+{
+  listNames_t::const_iterator it = m_listNames.find(s);
+  if(it == m_listNames.end()){
+    return DB_COLUMN_INVALID;
+  }
+  return it->second;
+}
+
+uint32_t DBResult::findColumn(const std::string &s, const char* function) const
+{
+  uint32_t column = getColumnIndex(s);
+  if(column == DB_COLUMN_INVALID){
+    std::cout << "Error during " << function << "(" << s << ")." << std::endl;
+  }
+  return column;
+}
+
+void DBResult::addColumn(const std::string &s)
+{
+  m_listNames[s] = m_columnCount++;
+}
+
+// DBStatement
+
+DBStatement::DBStatement(DatabaseDriver* db, const std::string &query)
+{
+  m_db = db;
+  m_query = query;
+}
+
+DBStatement::Param& DBStatement::getParam(uint32_t index)
+{
+  if(index >= m_params.size()){
+    m_params.resize(index + 1);
+  }
+  return m_params[index];
+}
+
+void DBStatement::bindNull(uint32_t index)
+{
+  Param& param = getParam(index);
+  param.type = PARAM_NULL;
+  param.stringValue.clear();
+}
+
+void DBStatement::bindInt(uint32_t index, int64_t value)
+{
+  Param& param = getParam(index);
+  param.type = PARAM_INT;
+  param.intValue = value;
+  param.stringValue.clear();
+}
+
+void DBStatement::bindString(uint32_t index, const std::string &value)
+{
+  Param& param = getParam(index);
+  param.type = PARAM_STRING;
+  param.stringValue = value;
+}
+
+void DBStatement::bindBlob(uint32_t index, const char* value, uint32_t length)
+{
+  Param& param = getParam(index);
+  param.type = PARAM_BLOB;
+  param.stringValue.assign(value, length);
+}
+
+void DBStatement::clearBindings()
+{
+  m_params.clear();
+}
+
+std::string DBStatement::buildQuery() const
+{
+  std::ostringstream query;
+
+  bool inString = false;
+  uint32_t index = 0;
+  for(uint32_t a = 0; a < m_query.length(); a++){
+    char ch = m_query[a];
+
+    if(ch == '\''){
+      inString = !inString;
+    }
+    else if(ch == '?' && !inString){
+      const Param& param = (index < m_params.size() ? m_params[index] : Param());
+      ++index;
+
+      switch(param.type){
+        case PARAM_INT:
+          query << param.intValue;
+          break;
+        case PARAM_STRING:
+          query << m_db->escapeString(param.stringValue);
+          break;
+        case PARAM_BLOB:
+          query << m_db->escapeBlob(param.stringValue.data(), (uint32_t)param.stringValue.size());
+          break;
+        default:
+          query << "NULL";
+          break;
+      }
+      continue;
+    }
+
+    query << ch;
+  }
+
+  return query.str();
+}
+
+bool DBStatement::execute()
+{
+  return m_db->executeQuery(buildQuery());
+}
+
+DBResult_ptr DBStatement::query()
+{
+  return m_db->storeQuery(buildQuery());
+}
+
+DBResult_ptr DBStatement::attachResult(DBResult_ptr result)
+{
+  result->m_statement = shared_from_this();
+  if(!result->advance()){
+    return DBResult_ptr();
+  }
+  return result;
+}
+
 // DBQuery
 
 DBQuery::DBQuery()
 {
-  database_lock.lock();
+  m_database = DatabaseDriver::instance();
+  if(m_database){
+    m_database->m_lock.lock();
+    m_database->use();
+  }
 }
 
 DBQuery::~DBQuery()
 {
-  database_lock.unlock();
+  if(m_database){
+    m_database->m_lock.unlock();
+    m_database->release();
+  }
 }
 
 // DBInsert
@@ -22,16 +22,31 @@
 #define __OTSERV_DATABASE_DRIVER_H__
 
 #include <iosfwd>
+#include <map>
+#include <vector>
+#include <unordered_map>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
 #include "definitions.h"
 
 class DatabaseDriver;
 class DBResult;
 class DBQuery;
+class DBStatement;
 
 typedef boost::shared_ptr<DBResult> DBResult_ptr;
+typedef boost::shared_ptr<DBStatement> DBStatement_ptr;
+
+// Statements kept prepared per connection
+#define DB_STATEMENT_CACHE_SIZE 128
+// Milliseconds to wait for a connection before opening one above database_pool_size
+#define DB_POOL_WAIT_TIME 2000
+// Column index of fields a result doesn't have
+#define DB_COLUMN_INVALID 0xFFFFFFFF
 
 enum DBParam_t{
   DBPARAM_MULTIINSERT = 1
@@ -41,11 +56,11 @@ class DatabaseDriver
 {
 public:
   /**
-  * Singleton implementation.
+  * Connection of the calling thread.
   *
-  * Returns instance of database handler. Don't create database (or drivers) instances in your code - instead of it use Database::instance(). This method stores static instance of connection class internaly to make sure exacly one instance of connection is created for entire system.
+  * Returns the database handler of the current thread. Don't create database (or drivers) instances in your code - instead of it use Database::instance(). The connection is borrowed from a pool of database_pool_size connections and stays with the thread while a DBQuery, transaction or result uses it, then it is given back. If all of them are taken the call waits for one for a moment, then opens another.
   *
-  * @return database connection handler singleton
+  * @return database connection handler of the thread
   */
   static DatabaseDriver* instance();
 
@@ -113,6 +128,18 @@ public:
   DBResult_ptr storeQuery(const std::string &query);
   DBResult_ptr storeQuery(DBQuery &query);
 
+  /**
+  * Queries database without buffering the whole result.
+  *
+  * Rows are fetched while the result is read. No other query may run on the
+  * connection until the result is released, so don't query from the loop.
+  *
+  * @param std::string query
+  * @return results object (null on error)
+  */
+  DBResult_ptr streamQuery(const std::string &query);
+  DBResult_ptr streamQuery(DBQuery &query);
+
   /**
   * Escapes string for query.
   *
@@ -133,6 +160,18 @@ public:
   */
   virtual std::string escapeBlob(const char* s, uint32_t length) = 0;
 
+  /**
+  * Prepares statement.
+  *
+  * Parameters are written as ? in the query and bound by their index, starting at 0.
+  * Statements are cached per connection and handed out again once nobody, including
+  * a result read from it, holds on to them anymore. Hold a DBQuery while using it.
+  *
+  * @param std::string query with ? placeholders
+  * @return statement handle
+  */
+  DBStatement_ptr prepare(const std::string &query);
+
   /**
   * Resource freeing.
   * Used as argument to shared_ptr, you need not call this directly
@@ -147,46 +186,104 @@ protected:
    */
   virtual bool internalQuery(const std::string &query) = 0;
   virtual DBResult_ptr internalSelectQuery(const std::string &query) = 0;
+  virtual DBResult_ptr internalStreamQuery(const std::string &query) {return internalSelectQuery(query);}
+
+  /**
+   * Creates a statement for the driver, the default one substitutes the
+   * escaped parameters into the query text
+   */
+  virtual DBStatement_ptr createStatement(const std::string &query);
+
+  /**
+   * Checks the connection is alive, reconnecting it if the driver can.
+   * Only called while nothing uses the connection.
+   *
+   * @return whether the connection works
+   */
+  virtual bool ping() {return m_connected;}
 
-  DatabaseDriver() : m_connected(false) {};
+  DatabaseDriver() : m_connected(false), m_useCount(0), m_lastCheck(0) {};
   virtual ~DatabaseDriver() {};
 
   DBResult_ptr verifyResult(DBResult_ptr result);
 
   bool m_connected;
 
+  typedef std::unordered_map<std::string, DBStatement_ptr> StatementCache;
+  StatementCache m_statements;
+
+  // Results keep the connection with the thread until they are freed
+  DBResult_ptr wrapResult(DBResult* res);
+
 private:
-  static DatabaseDriver* _instance;
+  static DatabaseDriver* createConnection();
+  static DatabaseDriver* borrowConnection();
+  static void returnConnection(DatabaseDriver* db);
+  // Pings the connection if it is down or wasn't checked for a while
+  void checkConnection();
+
+  // The thread gives the connection back when nothing uses it anymore
+  void use();
+  void release();
+  void releaseResult(DBResult* res);
+
+  // Locked by DBQuery, only the thread owning the connection should use it
+  boost::recursive_mutex m_lock;
+  // DBQuery objects, transactions and results in use, the connection isn't pinged while in use
+  uint32_t m_useCount;
+  int64_t m_lastCheck;
+
+  static boost::thread_specific_ptr<DatabaseDriver> _threadConnection;
+  static boost::mutex _poolLock;
+  static boost::condition_variable _poolSignal;
+  static std::vector<DatabaseDriver*> _idleConnections;
+  static uint32_t _connectionCount;
+
+  friend class DBQuery;
 };
 
 class DBResult : public boost::enable_shared_from_this<DBResult>
 {
 public:
+  /** Get the index of a field, to read it from every row without looking up its name again
+  *\return The index of the field, DB_COLUMN_INVALID if the result has no such field
+  *\param s The name of the field
+  */
+  uint32_t getColumnIndex(const std::string &s) const;
+
   /** Get the Integer value of a field in database
   *\return The Integer value of the selected field and row
   *\param s The name of the field
   */
-  virtual int32_t getDataInt(const std::string &s) { return 0; }
+  int32_t getDataInt(const std::string &s) { return getDataInt(findColumn(s, "getDataInt")); }
   /** Get the Unsigned Integer value of a field in database
   *\return The Integer value of the selected field and row
   *\param s The name of the field
   */
-  virtual uint32_t getDataUInt(const std::string &s) { return 0; }
+  uint32_t getDataUInt(const std::string &s) { return getDataUInt(findColumn(s, "getDataUInt")); }
   /** Get the Long value of a field in database
   *\return The Long value of the selected field and row
   *\param s The name of the field
   */
-  virtual int64_t getDataLong(const std::string &s) { return 0; }
+  int64_t getDataLong(const std::string &s) { return getDataLong(findColumn(s, "getDataLong")); }
   /** Get the String of a field in database
   *\return The String of the selected field and row
   *\param s The name of the field
   */
-  virtual std::string getDataString(const std::string &s) { return "''"; }
+  std::string getDataString(const std::string &s) { return getDataString(findColumn(s, "getDataString")); }
   /** Get the blob of a field in database
   *\return a PropStream that is initiated with the blob data field, if not exist it returns NULL.
   *\param s The name of the field
   */
-  virtual const char* getDataStream(const std::string &s, unsigned long &size) { return 0; }
+  const char* getDataStream(const std::string &s, unsigned long &size) { return getDataStream(findColumn(s, "getDataStream"), size); }
+
+  /** Getters by column index (see getColumnIndex), they return 0 or an empty value for invalid columns */
+  virtual int32_t getDataInt(uint32_t column) { return 0; }
+  virtual uint32_t getDataUInt(uint32_t column) { return 0; }
+  virtual int64_t getDataLong(uint32_t column) { return 0; }
+  virtual std::string getDataString(uint32_t column) { return ""; }
+  /** The blob points into the result, it is valid until the result advances */
+  virtual const char* getDataStream(uint32_t column, unsigned long &size) { size = 0; return NULL; }
 
   /**
   * Moves to next result in set.
@@ -202,14 +299,90 @@ public:
   virtual bool empty() {return true;}
 
 protected:
-  DBResult() {};
+  DBResult() : m_columnCount(0) {};
   virtual ~DBResult() {};
+
+  // Columns are numbered in the order they are added, from 0
+  void addColumn(const std::string &s);
+  // Looks up a field, reporting it if the result has no such field
+  uint32_t findColumn(const std::string &s, const char* function) const;
+
+  typedef std::map<const std::string, uint32_t> listNames_t;
+  listNames_t m_listNames;
+  uint32_t m_columnCount;
+
+  // Statement the result is read from, it is not reused while the result lives
+  DBStatement_ptr m_statement;
+
+  friend class DBStatement;
+};
+
+/**
+ * Prepared statement.
+ *
+ * Bind the parameters, then run it with execute() or query(). Bindings stay
+ * set between runs until they are replaced or cleared.
+ */
+class DBStatement : public boost::enable_shared_from_this<DBStatement>
+{
+public:
+  DBStatement(DatabaseDriver* db, const std::string &query);
+  virtual ~DBStatement() {};
+
+  void bindNull(uint32_t index);
+  void bindInt(uint32_t index, int64_t value);
+  void bindString(uint32_t index, const std::string &value);
+  void bindBlob(uint32_t index, const char* value, uint32_t length);
+  void clearBindings();
+
+  /**
+  * Executes statement which doesn't generate results (INSERT, UPDATE, DELETE...).
+  *
+  * @return true on success, false on error
+  */
+  virtual bool execute();
+
+  /**
+  * Executes statement which generates results.
+  *
+  * @return results object positioned on the first row (null on error or no rows)
+  */
+  virtual DBResult_ptr query();
+
+  const std::string& getQuery() const {return m_query;}
+
+protected:
+  enum ParamType{
+    PARAM_NULL,
+    PARAM_INT,
+    PARAM_STRING,
+    PARAM_BLOB
+  };
+
+  struct Param{
+    Param() : type(PARAM_NULL), intValue(0) {}
+
+    ParamType type;
+    int64_t intValue;
+    std::string stringValue;
+  };
+
+  Param& getParam(uint32_t index);
+  // The query with the escaped parameters in place of the placeholders
+  std::string buildQuery() const;
+  // Keeps this statement busy while the result is alive
+  DBResult_ptr attachResult(DBResult_ptr result);
+
+  DatabaseDriver* m_db;
+  std::string m_query;
+  std::vector<Param> m_params;
 };
 
 /**
  * Thread locking hack.
  *
- * By using this class for your queries you lock and unlock database for threads.
+ * By using this class for your queries you lock and unlock the connection of the thread.
+ * It isn't pinged or reconnected while locked.
 */
 class DBQuery : public std::ostringstream
 {
@@ -222,7 +395,7 @@ public:
   void reset() {str("");}
 
 protected:
-  static boost::recursive_mutex database_lock;
+  DatabaseDriver* m_database;
 };
 
 /**
@@ -293,12 +466,15 @@ public:
   {
     if(m_state == STATE_START){
       m_database->rollback();
+      m_database->release();
     }
   }
 
   bool begin()
   {
+    //the connection is kept as it is until the transaction ends
     m_state = STATE_START;
+    m_database->use();
     return m_database->beginTransaction();
   }
 
@@ -306,7 +482,9 @@ public:
   {
     if(m_state == STATE_START){
       m_state = STEATE_COMMIT;
-      return m_database->commit();
+      bool ret = m_database->commit();
+      m_database->release();
+      return ret;
     }
     else{
       return false;
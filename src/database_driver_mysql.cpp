@@ -64,11 +64,9 @@ DatabaseMySQL::DatabaseMySQL()
   m_connected = true;
 
   if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary"){
-    DBQuery query;
-    query << "SHOW variables LIKE 'max_allowed_packet';";
-
+    //no DBQuery, it would ask the pool for a connection while this one is created
     DBResult_ptr result;
-    if((result = storeQuery(query.str()))){
+    if((result = storeQuery("SHOW variables LIKE 'max_allowed_packet';"))){
       int32_t max_query = result->getDataInt("Value");
 
       if(max_query < 16777216){
@@ -85,6 +83,24 @@ DatabaseMySQL::~DatabaseMySQL()
   mysql_close(&m_handle);
 }
 
+bool DatabaseMySQL::ping()
+{
+  //reconnects by itself if the connection was lost
+  unsigned long threadId = mysql_thread_id(&m_handle);
+  if(mysql_ping(&m_handle) != 0){
+    m_connected = false;
+    return false;
+  }
+
+  //a new session, the statements prepared on the old one are gone
+  if(mysql_thread_id(&m_handle) != threadId){
+    m_statements.clear();
+  }
+
+  m_connected = true;
+  return true;
+}
+
 bool DatabaseMySQL::getParam(DBParam_t param)
 {
   switch(param){
@@ -169,6 +185,16 @@ bool DatabaseMySQL::internalQuery(const std::string &query)
 }
 
 DBResult_ptr DatabaseMySQL::internalSelectQuery(const std::string &query)
+{
+  return selectQuery(query, false);
+}
+
+DBResult_ptr DatabaseMySQL::internalStreamQuery(const std::string &query)
+{
+  return selectQuery(query, true);
+}
+
+DBResult_ptr DatabaseMySQL::selectQuery(const std::string &query, bool stream)
 {
   if(!m_connected)
     return DBResult_ptr();
@@ -190,11 +216,11 @@ DBResult_ptr DatabaseMySQL::internalSelectQuery(const std::string &query)
 
   // we should call that every time as someone would call executeQuery('SELECT...')
   // as it is described in MySQL manual: "it doesn't hurt" :P
-  MYSQL_RES* m_res = mysql_store_result(&m_handle);
+  MYSQL_RES* m_res = stream ? mysql_use_result(&m_handle) : mysql_store_result(&m_handle);
 
   // error occured
   if(!m_res){
-    std::cout << "mysql_store_result(): " << query.substr(0, 256) << ": MYSQL ERROR: " << mysql_error(&m_handle) << std::endl;
+    std::cout << (stream ? "mysql_use_result(): " : "mysql_store_result(): ") << query.substr(0, 256) << ": MYSQL ERROR: " << mysql_error(&m_handle) << std::endl;
     int error = mysql_errno(&m_handle);
 
     if(error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR){
@@ -205,7 +231,7 @@ DBResult_ptr DatabaseMySQL::internalSelectQuery(const std::string &query)
   }
 
   // retriving results of query
-  DBResult_ptr res(new MySQLResult(m_res), boost::bind(&DatabaseDriver::freeResult, this, _1));
+  DBResult_ptr res = wrapResult(new MySQLResult(m_res));
   return verifyResult(res);
 }
 
@@ -239,98 +265,198 @@ std::string DatabaseMySQL::escapeBlob(const char* s, uint32_t length)
 
 void DatabaseMySQL::freeResult(DBResult* res)
 {
-  delete (MySQLResult*)res;
+  if(MySQLStatementResult* statementResult = dynamic_cast<MySQLStatementResult*>(res))
+    delete statementResult;
+  else
+    delete (MySQLResult*)res;
 }
 
-/** MySQLResult definitions */
+DBStatement_ptr DatabaseMySQL::createStatement(const std::string &query)
+{
+  return DBStatement_ptr(new MySQLStatement(this, query));
+}
 
-int32_t MySQLResult::getDataInt(const std::string &s)
+/** MySQLStatement definitions */
+
+MySQLStatement::MySQLStatement(DatabaseMySQL* db, const std::string &query) :
+  DBStatement(db, query)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    if(m_row[it->second] == NULL){
-      return 0;
-    }
-    else{
-      return atoi(m_row[it->second]);
-    }
-  }
+  m_mysql = db;
+  m_handle = NULL;
+}
+
+MySQLStatement::~MySQLStatement()
+{
+  close();
+}
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
+void MySQLStatement::close()
+{
+  if(m_handle){
+    mysql_stmt_close(m_handle);
+    m_handle = NULL;
+  }
 }
 
-uint32_t MySQLResult::getDataUInt(const std::string &s)
+bool MySQLStatement::run()
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    if(m_row[it->second] == NULL){
-      return 0;
+  if(!m_mysql->m_connected)
+    return false;
+
+  #ifdef __DEBUG_SQL__
+  std::cout << "MYSQL STATEMENT: " << m_query << std::endl;
+  #endif
+
+  if(!m_handle){
+    m_handle = mysql_stmt_init(&m_mysql->m_handle);
+    if(!m_handle){
+      std::cout << "mysql_stmt_init(): MYSQL ERROR: " << mysql_error(&m_mysql->m_handle) << std::endl;
+      return false;
     }
-    else{
-      std::istringstream os(m_row[it->second]);
-      uint32_t res;
-      os >> res;
-      return res;
+
+    if(mysql_stmt_prepare(m_handle, m_query.c_str(), m_query.length()) != 0){
+      std::cout << "mysql_stmt_prepare(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+      close();
+      return false;
     }
   }
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
-}
+  if(mysql_stmt_param_count(m_handle) != m_params.size()){
+    std::cout << "mysql_stmt_bind_param(): " << m_query.substr(0, 256) << ": " << m_params.size() << " parameters bound, "
+      << mysql_stmt_param_count(m_handle) << " expected." << std::endl;
+    return false;
+  }
 
-int64_t MySQLResult::getDataLong(const std::string &s)
-{
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end()){
-    if(m_row[it->second] == NULL){
-      return 0;
+  std::vector<MYSQL_BIND> binds(m_params.size());
+  if(!binds.empty()){
+    memset(&binds[0], 0, sizeof(MYSQL_BIND) * binds.size());
+  }
+
+  for(uint32_t i = 0; i < m_params.size(); ++i){
+    Param& param = m_params[i];
+    switch(param.type){
+      case PARAM_INT:
+        binds[i].buffer_type = MYSQL_TYPE_LONGLONG;
+        binds[i].buffer = &param.intValue;
+        break;
+      case PARAM_STRING:
+        binds[i].buffer_type = MYSQL_TYPE_STRING;
+        binds[i].buffer = (void*)param.stringValue.data();
+        binds[i].buffer_length = param.stringValue.size();
+        break;
+      case PARAM_BLOB:
+        binds[i].buffer_type = MYSQL_TYPE_BLOB;
+        binds[i].buffer = (void*)param.stringValue.data();
+        binds[i].buffer_length = param.stringValue.size();
+        break;
+      default:
+        binds[i].buffer_type = MYSQL_TYPE_NULL;
+        break;
     }
-    else{
-      return atoll(m_row[it->second]);
+  }
+
+  if((!binds.empty() && mysql_stmt_bind_param(m_handle, &binds[0]) != 0) || mysql_stmt_execute(m_handle) != 0){
+    std::cout << "mysql_stmt_execute(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+    int error = mysql_stmt_errno(m_handle);
+
+    if(error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR){
+      m_mysql->m_connected = false;
     }
+
+    //statements don't survive a reconnect, prepare it again next time
+    close();
+    return false;
   }
 
-  std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-  return 0; // Failed
+  return true;
+}
+
+bool MySQLStatement::execute()
+{
+  if(!run())
+    return false;
+
+  mysql_stmt_free_result(m_handle);
+  return true;
 }
 
-std::string MySQLResult::getDataString(const std::string &s)
+DBResult_ptr MySQLStatement::query()
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    if(m_row[it->second] == NULL)
-      return std::string("");
-    else
-      return std::string(m_row[it->second]);
+  if(!run())
+    return DBResult_ptr();
+
+  MYSQL_RES* metadata = mysql_stmt_result_metadata(m_handle);
+  if(!metadata){
+    std::cout << "mysql_stmt_result_metadata(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+    return DBResult_ptr();
+  }
+
+  //buffer the whole result so the column sizes are known
+  my_bool updateMaxLength = 1;
+  mysql_stmt_attr_set(m_handle, STMT_ATTR_UPDATE_MAX_LENGTH, &updateMaxLength);
+  if(mysql_stmt_store_result(m_handle) != 0){
+    std::cout << "mysql_stmt_store_result(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+    mysql_free_result(metadata);
+    return DBResult_ptr();
   }
 
-  std::cout << "Error during getDataString(" << s << ")." << std::endl;
-  return std::string(""); // Failed
+  DBResult_ptr results = m_mysql->wrapResult(new MySQLStatementResult(m_handle, metadata));
+  return attachResult(results);
 }
 
-const char* MySQLResult::getDataStream(const std::string &s, unsigned long &size)
+/** MySQLResult definitions */
+
+int32_t MySQLResult::getDataInt(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    if(m_row[it->second] == NULL){
-      size = 0;
-      return NULL;
-    }
-    else{
-      size = mysql_fetch_lengths(m_handle)[it->second];
-      return m_row[it->second];
-    }
+  if(column >= m_columnCount || m_row[column] == NULL)
+    return 0;
+
+  return atoi(m_row[column]);
+}
+
+uint32_t MySQLResult::getDataUInt(uint32_t column)
+{
+  if(column >= m_columnCount || m_row[column] == NULL)
+    return 0;
+
+  return (uint32_t)strtoul(m_row[column], NULL, 10);
+}
+
+int64_t MySQLResult::getDataLong(uint32_t column)
+{
+  if(column >= m_columnCount || m_row[column] == NULL)
+    return 0;
+
+  return atoll(m_row[column]);
+}
+
+std::string MySQLResult::getDataString(uint32_t column)
+{
+  if(column >= m_columnCount || m_row[column] == NULL)
+    return std::string("");
+
+  return std::string(m_row[column]);
+}
+
+const char* MySQLResult::getDataStream(uint32_t column, unsigned long &size)
+{
+  if(column >= m_columnCount || m_row[column] == NULL){
+    size = 0;
+    return NULL;
+  }
+
+  if(!m_lengths){
+    m_lengths = mysql_fetch_lengths(m_handle);
   }
 
-  std::cout << "Error during getDataStream(" << s << ")." << std::endl;
-  size = 0;
-  return NULL;
+  size = m_lengths[column];
+  return m_row[column];
 }
 
 DBResult_ptr MySQLResult::advance()
 {
   m_row = mysql_fetch_row(m_handle);
+  m_lengths = NULL;
   return m_row != NULL ? shared_from_this() : DBResult_ptr();
 }
 
@@ -342,13 +468,12 @@ bool MySQLResult::empty()
 MySQLResult::MySQLResult(MYSQL_RES* res)
 {
   m_handle = res;
-  m_listNames.clear();
+  m_row = NULL;
+  m_lengths = NULL;
 
   MYSQL_FIELD* field;
-  int32_t i = 0;
   while((field = mysql_fetch_field(m_handle))){
-    m_listNames[field->name] = i;
-    i++;
+    addColumn(field->name);
   }
 }
 
@@ -357,4 +482,114 @@ MySQLResult::~MySQLResult()
   mysql_free_result(m_handle);
 }
 
+/** MySQLStatementResult definitions */
+
+MySQLStatementResult::MySQLStatementResult(MYSQL_STMT* stmt, MYSQL_RES* metadata)
+{
+  m_stmt = stmt;
+  m_metadata = metadata;
+  m_rowAvailable = false;
+
+  uint32_t fields = mysql_num_fields(m_metadata);
+  MYSQL_FIELD* field = mysql_fetch_fields(m_metadata);
+
+  m_binds.resize(fields);
+  m_buffers.resize(fields);
+  m_lengths.resize(fields, 0);
+  m_nulls = new my_bool[fields];
+
+  if(fields > 0){
+    memset(&m_binds[0], 0, sizeof(MYSQL_BIND) * fields);
+  }
+
+  for(uint32_t i = 0; i < fields; ++i){
+    addColumn(field[i].name);
+
+    //numbers are converted to text, which can take more than their binary size
+    unsigned long size = field[i].max_length;
+    bool blob = (field[i].type == MYSQL_TYPE_BLOB || field[i].type == MYSQL_TYPE_TINY_BLOB ||
+      field[i].type == MYSQL_TYPE_MEDIUM_BLOB || field[i].type == MYSQL_TYPE_LONG_BLOB);
+    if(!blob){
+      size = std::max<unsigned long>(size, std::max<unsigned long>(field[i].length, 64));
+    }
+
+    m_buffers[i].resize(size + 1);
+    m_nulls[i] = 0;
+
+    m_binds[i].buffer_type = (blob ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING);
+    m_binds[i].buffer = &m_buffers[i][0];
+    m_binds[i].buffer_length = size;
+    m_binds[i].length = &m_lengths[i];
+    m_binds[i].is_null = &m_nulls[i];
+  }
+
+  if(fields > 0){
+    mysql_stmt_bind_result(m_stmt, &m_binds[0]);
+  }
+}
+
+MySQLStatementResult::~MySQLStatementResult()
+{
+  mysql_stmt_free_result(m_stmt);
+  mysql_free_result(m_metadata);
+  delete[] m_nulls;
+}
+
+const char* MySQLStatementResult::getValue(uint32_t column, unsigned long &size)
+{
+  if(column >= m_columnCount || m_nulls[column]){
+    size = 0;
+    return NULL;
+  }
+
+  size = std::min<unsigned long>(m_lengths[column], m_buffers[column].size() - 1);
+  m_buffers[column][size] = '\0';
+  return &m_buffers[column][0];
+}
+
+int32_t MySQLStatementResult::getDataInt(uint32_t column)
+{
+  unsigned long size;
+  const char* value = getValue(column, size);
+  return value ? atoi(value) : 0;
+}
+
+uint32_t MySQLStatementResult::getDataUInt(uint32_t column)
+{
+  unsigned long size;
+  const char* value = getValue(column, size);
+  return value ? (uint32_t)strtoul(value, NULL, 10) : 0;
+}
+
+int64_t MySQLStatementResult::getDataLong(uint32_t column)
+{
+  unsigned long size;
+  const char* value = getValue(column, size);
+  return value ? atoll(value) : 0;
+}
+
+std::string MySQLStatementResult::getDataString(uint32_t column)
+{
+  unsigned long size;
+  const char* value = getValue(column, size);
+  return value ? std::string(value, size) : std::string("");
+}
+
+const char* MySQLStatementResult::getDataStream(uint32_t column, unsigned long &size)
+{
+  return getValue(column, size);
+}
+
+DBResult_ptr MySQLStatementResult::advance()
+{
+  int ret = mysql_stmt_fetch(m_stmt);
+  m_rowAvailable = (ret == 0 || ret == MYSQL_DATA_TRUNCATED);
+  return m_rowAvailable ? shared_from_this() : DBResult_ptr();
+}
+
+bool MySQLStatementResult::empty()
+{
+  return !m_rowAvailable;
+}
+
 #endif
@@ -53,9 +53,35 @@ public:
 protected:
   virtual bool internalQuery(const std::string &query);
   virtual DBResult_ptr internalSelectQuery(const std::string &query);
+  virtual DBResult_ptr internalStreamQuery(const std::string &query);
   virtual void freeResult(DBResult *res);
+  virtual DBStatement_ptr createStatement(const std::string &query);
+  virtual bool ping();
+
+  // Runs a query, buffering its rows or fetching them while they're read
+  DBResult_ptr selectQuery(const std::string &query, bool stream);
 
   MYSQL m_handle;
+
+  friend class MySQLStatement;
+};
+
+class MySQLStatement : public DBStatement
+{
+public:
+  MySQLStatement(DatabaseMySQL* db, const std::string &query);
+  virtual ~MySQLStatement();
+
+  virtual bool execute();
+  virtual DBResult_ptr query();
+
+protected:
+  // Prepares the statement if needed and runs it with the current parameters
+  bool run();
+  void close();
+
+  DatabaseMySQL* m_mysql;
+  MYSQL_STMT* m_handle;
 };
 
 class MySQLResult : public DBResult
@@ -63,11 +89,17 @@ class MySQLResult : public DBResult
   friend class DatabaseMySQL;
 
 public:
-  virtual int32_t getDataInt(const std::string &s);
-  virtual uint32_t getDataUInt(const std::string &s);
-  virtual int64_t getDataLong(const std::string &s);
-  virtual std::string getDataString(const std::string &s);
-  virtual const char* getDataStream(const std::string &s, unsigned long &size);
+  using DBResult::getDataInt;
+  using DBResult::getDataUInt;
+  using DBResult::getDataLong;
+  using DBResult::getDataString;
+  using DBResult::getDataStream;
+
+  virtual int32_t getDataInt(uint32_t column);
+  virtual uint32_t getDataUInt(uint32_t column);
+  virtual int64_t getDataLong(uint32_t column);
+  virtual std::string getDataString(uint32_t column);
+  virtual const char* getDataStream(uint32_t column, unsigned long &size);
 
   virtual DBResult_ptr advance();
   virtual bool empty();
@@ -76,11 +108,49 @@ protected:
   MySQLResult(MYSQL_RES* res);
   virtual ~MySQLResult();
 
-  typedef std::map<const std::string, uint32_t> listNames_t;
-  listNames_t m_listNames;
-
   MYSQL_RES* m_handle;
   MYSQL_ROW m_row;
+  // Lengths of the current row, fetched when a blob is first read
+  unsigned long* m_lengths;
+};
+
+// Rows of a prepared statement, every column is fetched as text like
+// mysql_fetch_row does so the getters behave the same as MySQLResult
+class MySQLStatementResult : public DBResult
+{
+  friend class DatabaseMySQL;
+  friend class MySQLStatement;
+
+public:
+  using DBResult::getDataInt;
+  using DBResult::getDataUInt;
+  using DBResult::getDataLong;
+  using DBResult::getDataString;
+  using DBResult::getDataStream;
+
+  virtual int32_t getDataInt(uint32_t column);
+  virtual uint32_t getDataUInt(uint32_t column);
+  virtual int64_t getDataLong(uint32_t column);
+  virtual std::string getDataString(uint32_t column);
+  virtual const char* getDataStream(uint32_t column, unsigned long &size);
+
+  virtual DBResult_ptr advance();
+  virtual bool empty();
+
+protected:
+  MySQLStatementResult(MYSQL_STMT* stmt, MYSQL_RES* metadata);
+  virtual ~MySQLStatementResult();
+
+  // Value of a column of the current row, NULL for SQL NULL
+  const char* getValue(uint32_t column, unsigned long &size);
+
+  MYSQL_STMT* m_stmt;
+  MYSQL_RES* m_metadata;
+  std::vector<MYSQL_BIND> m_binds;
+  std::vector< std::vector<char> > m_buffers;
+  std::vector<unsigned long> m_lengths;
+  my_bool* m_nulls;
+  bool m_rowAvailable;
 };
 
 #endif
@@ -198,7 +198,7 @@ DBResult_ptr DatabaseODBC::internalSelectQuery(const std::string &query)
     return DBResult_ptr();
   }
 
-  DBResult_ptr results(new ODBCResult(stmt), boost::bind(&DatabaseDriver::freeResult, this, _1));
+  DBResult_ptr results = wrapResult(new ODBCResult(stmt));
   return verifyResult(results);
 }
 
@@ -275,99 +275,114 @@ void DatabaseODBC::freeResult(DBResult* res)
 
 /** ODBCResult definitions */
 
-int32_t ODBCResult::getDataInt(const std::string &s)
+int32_t ODBCResult::getDataInt(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
+  if(column < m_columnCount){
     int32_t value;
-    SQLRETURN ret = SQLGetData(m_handle, it->second, SQL_C_SLONG, &value, 0, NULL);
+    SQLLEN length;
+    SQLRETURN ret = SQLGetData(m_handle, column + 1, SQL_C_SLONG, &value, 0, &length);
 
-    if( RETURN_SUCCESS(ret) )
+    if( RETURN_SUCCESS(ret) && length != SQL_NULL_DATA )
       return value;
-    else
-      std::cout << "Error during getDataInt(" << s << ")." << std::endl;
   }
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
+  return 0;
 }
 
-uint32_t ODBCResult::getDataUInt(const std::string &s)
+uint32_t ODBCResult::getDataUInt(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
+  if(column < m_columnCount){
     uint32_t value;
-    SQLRETURN ret = SQLGetData(m_handle, it->second, SQL_C_ULONG, &value, 0, NULL);
+    SQLLEN length;
+    SQLRETURN ret = SQLGetData(m_handle, column + 1, SQL_C_ULONG, &value, 0, &length);
 
-    if( RETURN_SUCCESS(ret) )
+    if( RETURN_SUCCESS(ret) && length != SQL_NULL_DATA )
       return value;
-    else
-      std::cout << "Error during getDataInt(" << s << ")." << std::endl;
   }
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
+  return 0;
 }
 
-int64_t ODBCResult::getDataLong(const std::string &s)
+int64_t ODBCResult::getDataLong(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-  {
+  if(column < m_columnCount){
     int64_t value;
-    SQLRETURN ret = SQLGetData(m_handle, it->second, SQL_C_SBIGINT, &value, 0, NULL);
+    SQLLEN length;
+    SQLRETURN ret = SQLGetData(m_handle, column + 1, SQL_C_SBIGINT, &value, 0, &length);
 
-    if( RETURN_SUCCESS(ret) )
+    if( RETURN_SUCCESS(ret) && length != SQL_NULL_DATA )
       return value;
-    else
-      std::cout << "Error during getDataLong(" << s << ")." << std::endl;
   }
 
-  std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-  return 0; // Failed
+  return 0;
 }
 
-std::string ODBCResult::getDataString(const std::string &s)
+std::string ODBCResult::getDataString(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-  {
-    char* value = new char[1024];
-    SQLRETURN ret = SQLGetData(m_handle, it->second, SQL_C_CHAR, value, 1024, NULL);
-
-    if( RETURN_SUCCESS(ret) ){
-      std::string buff = std::string(value);
-      return buff;
-    }
-    else{
-      std::cout << "Error during getDataString(" << s << ")." << std::endl;
-    }
+  std::vector<char> value;
+  if(!getData(column, SQL_C_CHAR, value) || value.empty())
+    return std::string("");
+
+  return std::string(&value[0], value.size());
+}
+
+const char* ODBCResult::getDataStream(uint32_t column, unsigned long &size)
+{
+  if(column >= m_columnCount){
+    size = 0;
+    return NULL;
+  }
+
+  Blob& blob = m_blobs[column];
+  if(!blob.read){
+    blob.read = true;
+    blob.null = !getData(column, SQL_C_BINARY, blob.data);
+  }
+
+  if(blob.null || blob.data.empty()){
+    size = 0;
+    return NULL;
   }
 
-  std::cout << "Error during getDataString(" << s << ")." << std::endl;
-  return std::string(""); // Failed
+  size = blob.data.size();
+  return &blob.data[0];
 }
 
-const char* ODBCResult::getDataStream(const std::string &s, unsigned long &size)
+bool ODBCResult::getData(uint32_t column, SQLSMALLINT type, std::vector<char>& data)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-  {
-    char* value = new char[1024];
-    SQLRETURN ret = SQLGetData(m_handle, it->second, SQL_C_BINARY, value, 1024, (SQLLEN*)&size);
+  data.clear();
+  if(column >= m_columnCount)
+    return false;
 
-    if( RETURN_SUCCESS(ret) )
-      return value;
-    else
-      std::cout << "Error during getDataStream(" << s << ")." << std::endl;
+  //long values come in parts, text parts end with a terminator
+  const SQLLEN terminator = (type == SQL_C_CHAR ? 1 : 0);
+  char chunk[4096];
+  SQLLEN length;
+  SQLRETURN ret = SQLGetData(m_handle, column + 1, type, chunk, sizeof(chunk), &length);
+  while( RETURN_SUCCESS(ret) ){
+    if(length == SQL_NULL_DATA)
+      return false;
+
+    SQLLEN read = sizeof(chunk) - terminator;
+    if(length != SQL_NO_TOTAL && length < read)
+      read = length;
+
+    data.insert(data.end(), chunk, chunk + read);
+    if(ret == SQL_SUCCESS)
+      return true;
+
+    ret = SQLGetData(m_handle, column + 1, type, chunk, sizeof(chunk), &length);
   }
 
-  std::cout << "Error during getDataStream(" << s << ")." << std::endl;
-  return 0; // Failed
+  return ret == SQL_NO_DATA;
 }
 
 DBResult_ptr ODBCResult::advance()
 {
+  for(std::vector<Blob>::iterator it = m_blobs.begin(); it != m_blobs.end(); ++it){
+    it->read = false;
+  }
+
   SQLRETURN ret = SQLFetch(m_handle);
   m_rowAvailable = RETURN_SUCCESS(ret);
   return m_rowAvailable ? shared_from_this() : DBResult_ptr();
@@ -387,10 +402,12 @@ ODBCResult::ODBCResult(SQLHSTMT stmt)
   SQLNumResultCols(m_handle, &numCols);
 
   for(int32_t i = 1; i <= numCols; i++){
-    char* name = new char[129];
+    char name[129];
     SQLDescribeCol(m_handle, i, (SQLCHAR*)name, 129, NULL, NULL, NULL, NULL, NULL);
-    m_listNames[name] = i;
+    addColumn(name);
   }
+
+  m_blobs.resize(numCols);
 }
 
 ODBCResult::~ODBCResult()
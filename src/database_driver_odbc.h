@@ -82,11 +82,17 @@ class ODBCResult : public DBResult
   friend class DatabaseODBC;
 
 public:
-  virtual int32_t getDataInt(const std::string &s);
-  virtual uint32_t getDataUInt(const std::string &s);
-  virtual int64_t getDataLong(const std::string &s);
-  virtual std::string getDataString(const std::string &s);
-  virtual const char* getDataStream(const std::string &s, unsigned long &size);
+  using DBResult::getDataInt;
+  using DBResult::getDataUInt;
+  using DBResult::getDataLong;
+  using DBResult::getDataString;
+  using DBResult::getDataStream;
+
+  virtual int32_t getDataInt(uint32_t column);
+  virtual uint32_t getDataUInt(uint32_t column);
+  virtual int64_t getDataLong(uint32_t column);
+  virtual std::string getDataString(uint32_t column);
+  virtual const char* getDataStream(uint32_t column, unsigned long &size);
 
   virtual DBResult_ptr advance();
   virtual bool empty();
@@ -95,9 +101,20 @@ protected:
   ODBCResult(SQLHSTMT stmt);
   virtual ~ODBCResult();
 
-  typedef std::map<const std::string, uint32_t> listNames_t;
-  listNames_t m_listNames;
+  // Reads a whole value of the current row, false if it is NULL
+  bool getData(uint32_t column, SQLSMALLINT type, std::vector<char>& data);
+
+  struct Blob{
+    Blob() : read(false), null(false) {}
+
+    bool read;
+    bool null;
+    std::vector<char> data;
+  };
+
   bool m_rowAvailable;
+  // Blobs of the current row read by getDataStream
+  std::vector<Blob> m_blobs;
 
   SQLHSTMT m_handle;
 };
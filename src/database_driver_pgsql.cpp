@@ -35,6 +35,7 @@ DatabasePgSQL::DatabasePgSQL()
   std::stringstream dns;
   dns << "host='" << g_config.getString(ConfigManager::SQL_HOST) << "' dbname='" << g_config.getString(ConfigManager::SQL_DB) << "' user='" << g_config.getString(ConfigManager::SQL_USER) << "' password='" << g_config.getString(ConfigManager::SQL_PASS) << "' port='" << g_config.getNumber(ConfigManager::SQL_PORT) << "'";
 
+  m_lastStatementId = 0;
   m_handle = PQconnectdb(dns.str().c_str());
   m_connected = PQstatus(m_handle) == CONNECTION_OK;
 
@@ -47,6 +48,24 @@ DatabasePgSQL::~DatabasePgSQL()
   PQfinish(m_handle);
 }
 
+bool DatabasePgSQL::ping()
+{
+  if(PQstatus(m_handle) == CONNECTION_OK){
+    PGresult* res = PQexec(m_handle, "SELECT 1");
+    m_connected = (PQresultStatus(res) == PGRES_TUPLES_OK);
+    PQclear(res);
+
+    if(m_connected)
+      return true;
+  }
+
+  //a new session, the statements prepared on the old one are gone
+  PQreset(m_handle);
+  m_statements.clear();
+  m_connected = (PQstatus(m_handle) == CONNECTION_OK);
+  return m_connected;
+}
+
 bool DatabasePgSQL::getParam(DBParam_t param)
 {
   switch(param){
@@ -90,6 +109,7 @@ bool DatabasePgSQL::internalQuery(const std::string &query)
   if(stat != PGRES_COMMAND_OK && stat != PGRES_TUPLES_OK){
     std::cout << "PQexec(): " << query << ": " << PQresultErrorMessage(res) << std::endl;
     PQclear(res);
+    m_connected = (PQstatus(m_handle) == CONNECTION_OK);
     return false;
   }
 
@@ -114,11 +134,12 @@ DBResult_ptr DatabasePgSQL::internalSelectQuery(const std::string &query)
   if(stat != PGRES_COMMAND_OK && stat != PGRES_TUPLES_OK){
     std::cout << "PQexec(): " << query << ": " << PQresultErrorMessage(res) << std::endl;
     PQclear(res);
+    m_connected = (PQstatus(m_handle) == CONNECTION_OK);
     return DBResult_ptr();
   }
 
   // everything went fine
-  DBResult_ptr results(new PgSQLResult(res), boost::bind(&DatabaseDriver::freeResult, this, _1));
+  DBResult_ptr results = wrapResult(new PgSQLResult(res));
   return verifyResult(results);
 }
 
@@ -137,7 +158,7 @@ uint64_t DatabasePgSQL::getLastInsertedRowID()
   }
 
   // everything went fine
-  uint64_t id = ATOI64( PQgetvalue(res, 0, PQfnumber(res, "last" )));
+  uint64_t id = atoll( PQgetvalue(res, 0, PQfnumber(res, "last" )));
   PQclear(res);
   return id;
 }
@@ -207,43 +228,197 @@ void DatabasePgSQL::freeResult(DBResult* res)
   delete (PgSQLResult*)res;
 }
 
-/** PgSQLResult definitions */
+DBStatement_ptr DatabasePgSQL::createStatement(const std::string &query)
+{
+  return DBStatement_ptr(new PgSQLStatement(this, query));
+}
+
+/** PgSQLStatement definitions */
 
-int32_t PgSQLResult::getDataInt(const std::string &s)
+PgSQLStatement::PgSQLStatement(DatabasePgSQL* db, const std::string &query) :
+  DBStatement(db, query)
 {
-  return atoi( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
+  m_pgsql = db;
+  m_prepared = false;
+
+  std::stringstream name;
+  name << "ots_stmt_" << ++m_pgsql->m_lastStatementId;
+  m_name = name.str();
 }
 
-int32_t PgSQLResult::getDataInt(const std::string &s)
+PgSQLStatement::~PgSQLStatement()
 {
-  std::istringstream os(PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
-  uint32_t res;
-  os >> res;
+  if(m_prepared && m_pgsql->m_connected){
+    PQclear(PQexec(m_pgsql->m_handle, ("DEALLOCATE " + m_name).c_str()));
+  }
+}
+
+PGresult* PgSQLStatement::run()
+{
+  if(!m_pgsql->m_connected)
+    return NULL;
+
+  #ifdef __DEBUG_SQL__
+  std::cout << "PGSQL STATEMENT: " << m_query << std::endl;
+  #endif
+
+  if(!m_prepared){
+    //placeholders are numbered as $1, $2... by PostgreSQL
+    std::string parsed = m_pgsql->_parse(m_query);
+    std::stringstream query;
+    bool inString = false;
+    uint32_t index = 0;
+    for(uint32_t a = 0; a < parsed.length(); a++){
+      if(parsed[a] == '\''){
+        inString = !inString;
+      }
+      else if(parsed[a] == '?' && !inString){
+        query << "$" << ++index;
+        continue;
+      }
+
+      query << parsed[a];
+    }
+
+    PGresult* res = PQprepare(m_pgsql->m_handle, m_name.c_str(), query.str().c_str(), 0, NULL);
+    if(PQresultStatus(res) != PGRES_COMMAND_OK){
+      std::cout << "PQprepare(): " << m_query << ": " << PQresultErrorMessage(res) << std::endl;
+      PQclear(res);
+      return NULL;
+    }
+
+    PQclear(res);
+    m_prepared = true;
+  }
+
+  std::vector<std::string> values(m_params.size());
+  std::vector<const char*> pointers(m_params.size(), (const char*)NULL);
+  std::vector<int> lengths(m_params.size(), 0);
+  std::vector<int> formats(m_params.size(), 0);
+  for(uint32_t i = 0; i < m_params.size(); ++i){
+    const Param& param = m_params[i];
+    switch(param.type){
+      case PARAM_INT:
+      {
+        std::stringstream value;
+        value << param.intValue;
+        values[i] = value.str();
+        pointers[i] = values[i].c_str();
+        break;
+      }
+      case PARAM_STRING:
+        pointers[i] = param.stringValue.c_str();
+        break;
+      case PARAM_BLOB:
+        //sent as binary, no escaping needed
+        pointers[i] = param.stringValue.data();
+        lengths[i] = param.stringValue.size();
+        formats[i] = 1;
+        break;
+      default:
+        break;
+    }
+  }
+
+  PGresult* res = PQexecPrepared(m_pgsql->m_handle, m_name.c_str(), m_params.size(),
+    pointers.empty() ? NULL : &pointers[0], lengths.empty() ? NULL : &lengths[0],
+    formats.empty() ? NULL : &formats[0], 0);
+  ExecStatusType stat = PQresultStatus(res);
+
+  if(stat != PGRES_COMMAND_OK && stat != PGRES_TUPLES_OK){
+    std::cout << "PQexecPrepared(): " << m_query << ": " << PQresultErrorMessage(res) << std::endl;
+    PQclear(res);
+    m_pgsql->m_connected = (PQstatus(m_pgsql->m_handle) == CONNECTION_OK);
+    return NULL;
+  }
+
   return res;
 }
 
-int64_t PgSQLResult::getDataLong(const std::string &s)
+bool PgSQLStatement::execute()
+{
+  PGresult* res = run();
+  if(!res)
+    return false;
+
+  PQclear(res);
+  return true;
+}
+
+DBResult_ptr PgSQLStatement::query()
+{
+  PGresult* res = run();
+  if(!res)
+    return DBResult_ptr();
+
+  DBResult_ptr results = m_pgsql->wrapResult(new PgSQLResult(res));
+  return attachResult(results);
+}
+
+/** PgSQLResult definitions */
+
+int32_t PgSQLResult::getDataInt(uint32_t column)
+{
+  if(column >= m_columnCount || PQgetisnull(m_handle, m_cursor, column))
+    return 0;
+
+  return atoi(PQgetvalue(m_handle, m_cursor, column));
+}
+
+uint32_t PgSQLResult::getDataUInt(uint32_t column)
+{
+  if(column >= m_columnCount || PQgetisnull(m_handle, m_cursor, column))
+    return 0;
+
+  return (uint32_t)strtoul(PQgetvalue(m_handle, m_cursor, column), NULL, 10);
+}
+
+int64_t PgSQLResult::getDataLong(uint32_t column)
 {
-  return ATOI64( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
+  if(column >= m_columnCount || PQgetisnull(m_handle, m_cursor, column))
+    return 0;
+
+  return atoll(PQgetvalue(m_handle, m_cursor, column));
 }
 
-std::string PgSQLResult::getDataString(const std::string &s)
+std::string PgSQLResult::getDataString(uint32_t column)
 {
-  return std::string( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
+  if(column >= m_columnCount)
+    return std::string("");
+
+  return std::string(PQgetvalue(m_handle, m_cursor, column), PQgetlength(m_handle, m_cursor, column));
 }
 
-const char* PgSQLResult::getDataStream(const std::string &s, unsigned long &size)
+const char* PgSQLResult::getDataStream(uint32_t column, unsigned long &size)
 {
-  std::string buf = PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) );
-  unsigned char* temp = PQunescapeBytea( (const unsigned char*)buf.c_str(), (size_t*)&size);
-  char* value = new char[buf.size()];
-  strcpy(value, (char*)temp);
-  PQfreemem(temp);
-  return value;
+  if(column >= m_columnCount || PQgetisnull(m_handle, m_cursor, column)){
+    size = 0;
+    return NULL;
+  }
+
+  //bytea comes escaped in text results, it is decoded once per row
+  Blob& blob = m_blobs[column];
+  if(!blob.data){
+    blob.data = PQunescapeBytea((const unsigned char*)PQgetvalue(m_handle, m_cursor, column), &blob.size);
+  }
+
+  size = blob.size;
+  return (const char*)blob.data;
+}
+
+void PgSQLResult::freeBlobs()
+{
+  for(std::vector<Blob>::iterator it = m_blobs.begin(); it != m_blobs.end(); ++it){
+    if(it->data){
+      PQfreemem(it->data);
+      it->data = NULL;
+    }
+  }
 }
 
 DBResult_ptr PgSQLResult::advance()
 {
+  freeBlobs();
   if(m_cursor >= m_rows)
     return DBResult_ptr();
 
@@ -261,10 +436,18 @@ PgSQLResult::PgSQLResult(PGresult* results)
   m_handle = results;
   m_cursor = -1;
   m_rows = PQntuples(m_handle) - 1;
+
+  int32_t fields = PQnfields(m_handle);
+  for(int32_t i = 0; i < fields; i++){
+    addColumn(PQfname(m_handle, i));
+  }
+
+  m_blobs.resize(fields);
 }
 
 PgSQLResult::~PgSQLResult()
 {
+  freeBlobs();
   PQclear(m_handle);
 }
 
@@ -50,22 +50,53 @@ protected:
   virtual bool internalQuery(const std::string &query);
   virtual DBResult_ptr internalSelectQuery(const std::string &query);
   virtual void freeResult(DBResult *res);
+  virtual DBStatement_ptr createStatement(const std::string &query);
+  virtual bool ping();
 
   std::string _parse(const std::string &s);
 
   PGconn* m_handle;
+  // Names the server side statements of this connection
+  uint32_t m_lastStatementId;
+
+  friend class PgSQLStatement;
+};
+
+class PgSQLStatement : public DBStatement
+{
+public:
+  PgSQLStatement(DatabasePgSQL* db, const std::string &query);
+  virtual ~PgSQLStatement();
+
+  virtual bool execute();
+  virtual DBResult_ptr query();
+
+protected:
+  // Prepares the statement if needed and runs it with the current parameters
+  PGresult* run();
+
+  DatabasePgSQL* m_pgsql;
+  std::string m_name;
+  bool m_prepared;
 };
 
 class PgSQLResult : public DBResult
 {
   friend class DatabasePgSQL;
+  friend class PgSQLStatement;
 
 public:
-  virtual int32_t getDataInt(const std::string &s);
-  virtual uint32_t getDataUInt(const std::string &s);
-  virtual int64_t getDataLong(const std::string &s);
-  virtual std::string getDataString(const std::string &s);
-  virtual const char* getDataStream(const std::string &s, unsigned long &size);
+  using DBResult::getDataInt;
+  using DBResult::getDataUInt;
+  using DBResult::getDataLong;
+  using DBResult::getDataString;
+  using DBResult::getDataStream;
+
+  virtual int32_t getDataInt(uint32_t column);
+  virtual uint32_t getDataUInt(uint32_t column);
+  virtual int64_t getDataLong(uint32_t column);
+  virtual std::string getDataString(uint32_t column);
+  virtual const char* getDataStream(uint32_t column, unsigned long &size);
 
   virtual DBResult_ptr advance();
   virtual bool empty();
@@ -74,8 +105,19 @@ protected:
   PgSQLResult(PGresult* results);
   virtual ~PgSQLResult();
 
+  void freeBlobs();
+
+  struct Blob{
+    Blob() : data(NULL), size(0) {}
+
+    unsigned char* data;
+    size_t size;
+  };
+
   int32_t m_rows, m_cursor;
   PGresult* m_handle;
+  // Blobs of the current row decoded by getDataStream
+  std::vector<Blob> m_blobs;
 };
 
 #endif
@@ -59,6 +59,8 @@ DatabaseSQLite::DatabaseSQLite()
     sqlite3_close(m_handle);
   }
   else{
+    //the connections of other threads may hold the file locked for a while
+    sqlite3_busy_timeout(m_handle, 10000);
     m_connected = true;
   }
 }
@@ -176,7 +178,7 @@ DBResult_ptr DatabaseSQLite::internalSelectQuery(const std::string &query)
     return DBResult_ptr();
   }
 
-  DBResult_ptr results(new SQLiteResult(stmt), boost::bind(&DatabaseDriver::freeResult, this, _1));
+  DBResult_ptr results = wrapResult(new SQLiteResult(stmt));
   return verifyResult(results);
 }
 
@@ -223,67 +225,164 @@ void DatabaseSQLite::freeResult(DBResult* res)
   delete (SQLiteResult*)res;
 }
 
+DBStatement_ptr DatabaseSQLite::createStatement(const std::string &query)
+{
+  return DBStatement_ptr(new SQLiteStatement(this, query));
+}
+
+/** SQLiteStatement definitions */
+
+SQLiteStatement::SQLiteStatement(DatabaseSQLite* db, const std::string &query) :
+  DBStatement(db, query)
+{
+  m_sqlite = db;
+  m_handle = NULL;
+
+  boost::recursive_mutex::scoped_lock lockClass(m_sqlite->sqliteLock);
+  if(!m_sqlite->m_connected)
+    return;
+
+  std::string buf = m_sqlite->_parse(query);
+  if(OTS_SQLITE3_PREPARE(m_sqlite->m_handle, buf.c_str(), buf.length(), &m_handle, NULL) != SQLITE_OK){
+    std::cout << "OTS_SQLITE3_PREPARE(): SQLITE ERROR: " << sqlite3_errmsg(m_sqlite->m_handle) << " (" << buf << ")" << std::endl;
+    sqlite3_finalize(m_handle);
+    m_handle = NULL;
+  }
+}
+
+SQLiteStatement::~SQLiteStatement()
+{
+  if(m_handle)
+    sqlite3_finalize(m_handle);
+}
+
+bool SQLiteStatement::bindParams()
+{
+  if(!m_handle)
+    return false;
+
+  sqlite3_reset(m_handle);
+  sqlite3_clear_bindings(m_handle);
+
+  for(uint32_t i = 0; i < m_params.size(); ++i){
+    const Param& param = m_params[i];
+
+    int ret;
+    switch(param.type){
+      case PARAM_INT:
+        ret = sqlite3_bind_int64(m_handle, i + 1, param.intValue);
+        break;
+      case PARAM_STRING:
+        ret = sqlite3_bind_text(m_handle, i + 1, param.stringValue.data(), param.stringValue.size(), SQLITE_TRANSIENT);
+        break;
+      case PARAM_BLOB:
+        ret = sqlite3_bind_blob(m_handle, i + 1, param.stringValue.data(), param.stringValue.size(), SQLITE_TRANSIENT);
+        break;
+      default:
+        ret = sqlite3_bind_null(m_handle, i + 1);
+        break;
+    }
+
+    if(ret != SQLITE_OK){
+      std::cout << "sqlite3_bind(): SQLITE ERROR: " << sqlite3_errmsg(m_sqlite->m_handle) << " (" << m_query << ")" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SQLiteStatement::execute()
+{
+  boost::recursive_mutex::scoped_lock lockClass(m_sqlite->sqliteLock);
+
+  #ifdef __DEBUG_SQL__
+  std::cout << "SQLITE STATEMENT: " << m_query << std::endl;
+  #endif
+
+  if(!bindParams())
+    return false;
+
+  int ret = sqlite3_step(m_handle);
+  if(ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW){
+    std::cout << "sqlite3_step(): SQLITE ERROR: " << sqlite3_errmsg(m_sqlite->m_handle) << " (" << m_query << ")" << std::endl;
+    sqlite3_reset(m_handle);
+    return false;
+  }
+
+  sqlite3_reset(m_handle);
+  return true;
+}
+
+DBResult_ptr SQLiteStatement::query()
+{
+  boost::recursive_mutex::scoped_lock lockClass(m_sqlite->sqliteLock);
+
+  #ifdef __DEBUG_SQL__
+  std::cout << "SQLITE STATEMENT: " << m_query << std::endl;
+  #endif
+
+  if(!bindParams())
+    return DBResult_ptr();
+
+  DBResult_ptr results = m_sqlite->wrapResult(new SQLiteResult(m_handle, false));
+  return attachResult(results);
+}
+
 /** SQLiteResult definitions */
 
-int32_t SQLiteResult::getDataInt(const std::string &s)
+int32_t SQLiteResult::getDataInt(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-    return sqlite3_column_int(m_handle, it->second);
+  if(column >= m_columnCount)
+    return 0;
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
+  return sqlite3_column_int(m_handle, column);
 }
 
-uint32_t SQLiteResult::getDataUInt(const std::string &s)
+uint32_t SQLiteResult::getDataUInt(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-    return (uint32_t)sqlite3_column_int64(m_handle, it->second);
+  if(column >= m_columnCount)
+    return 0;
 
-  std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-  return 0; // Failed
+  return (uint32_t)sqlite3_column_int64(m_handle, column);
 }
 
-int64_t SQLiteResult::getDataLong(const std::string &s)
+int64_t SQLiteResult::getDataLong(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() )
-    return sqlite3_column_int64(m_handle, it->second);
+  if(column >= m_columnCount)
+    return 0;
 
-  std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-  return 0; // Failed
+  return sqlite3_column_int64(m_handle, column);
 }
 
-std::string SQLiteResult::getDataString(const std::string &s)
+std::string SQLiteResult::getDataString(uint32_t column)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    std::string value = (const char*)sqlite3_column_text(m_handle, it->second);
-    return value;
-  }
+  if(column >= m_columnCount)
+    return std::string("");
+
+  const char* value = (const char*)sqlite3_column_text(m_handle, column);
+  if(!value)
+    return std::string("");
 
-  std::cout << "Error during getDataString(" << s << ")." << std::endl;
-  return std::string(""); // Failed
+  return std::string(value, sqlite3_column_bytes(m_handle, column));
 }
 
-const char* SQLiteResult::getDataStream(const std::string &s, unsigned long &size)
+const char* SQLiteResult::getDataStream(uint32_t column, unsigned long &size)
 {
-  listNames_t::iterator it = m_listNames.find(s);
-  if(it != m_listNames.end() ){
-    const char* value = (const char*)sqlite3_column_blob(m_handle, it->second);
-    size = sqlite3_column_bytes(m_handle, it->second);
-    return value;
+  if(column >= m_columnCount){
+    size = 0;
+    return NULL;
   }
 
-  std::cout << "Error during getDataStream(" << s << ")." << std::endl;
-  return NULL; // Failed
+  const char* value = (const char*)sqlite3_column_blob(m_handle, column);
+  size = sqlite3_column_bytes(m_handle, column);
+  return value;
 }
 
 DBResult_ptr SQLiteResult::advance()
 {
   // checks if after moving to next step we have a row result
-  bool m_rowAvailable = (sqlite3_step(m_handle) == SQLITE_ROW);
+  m_rowAvailable = (sqlite3_step(m_handle) == SQLITE_ROW);
   return m_rowAvailable ? shared_from_this() : DBResult_ptr();
 }
 
@@ -292,21 +391,24 @@ bool SQLiteResult::empty()
   return !m_rowAvailable;
 }
 
-SQLiteResult::SQLiteResult(sqlite3_stmt* stmt)
+SQLiteResult::SQLiteResult(sqlite3_stmt* stmt, bool ownsHandle /*= true*/)
 {
   m_handle = stmt;
   m_rowAvailable = false;
-  m_listNames.clear();
+  m_ownsHandle = ownsHandle;
 
   int32_t fields = sqlite3_column_count(m_handle);
   for(int32_t i = 0; i < fields; i++){
-    m_listNames[ sqlite3_column_name(m_handle, i) ] = i;
+    addColumn(sqlite3_column_name(m_handle, i));
   }
 }
 
 SQLiteResult::~SQLiteResult()
 {
-  sqlite3_finalize(m_handle);
+  if(m_ownsHandle)
+    sqlite3_finalize(m_handle);
+  else
+    sqlite3_reset(m_handle);
 }
 
 #endif
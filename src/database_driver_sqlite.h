@@ -49,11 +49,31 @@ protected:
   virtual bool internalQuery(const std::string &query);
   virtual DBResult_ptr internalSelectQuery(const std::string &query);
   virtual void freeResult(DBResult *res);
+  virtual DBStatement_ptr createStatement(const std::string &query);
 
   std::string _parse(const std::string &s);
 
   boost::recursive_mutex sqliteLock;
   sqlite3* m_handle;
+
+  friend class SQLiteStatement;
+};
+
+class SQLiteStatement : public DBStatement
+{
+public:
+  SQLiteStatement(DatabaseSQLite* db, const std::string &query);
+  virtual ~SQLiteStatement();
+
+  virtual bool execute();
+  virtual DBResult_ptr query();
+
+protected:
+  // Resets the statement and binds the current parameters
+  bool bindParams();
+
+  DatabaseSQLite* m_sqlite;
+  sqlite3_stmt* m_handle;
 };
 
 class SQLiteResult : public DBResult
@@ -61,24 +81,31 @@ class SQLiteResult : public DBResult
   friend class DatabaseSQLite;
 
 public:
-  virtual int32_t getDataInt(const std::string &s);
-  virtual uint32_t getDataUInt(const std::string &s);
-  virtual int64_t getDataLong(const std::string &s);
-  virtual std::string getDataString(const std::string &s);
-  virtual const char* getDataStream(const std::string &s, unsigned long &size);
+  using DBResult::getDataInt;
+  using DBResult::getDataUInt;
+  using DBResult::getDataLong;
+  using DBResult::getDataString;
+  using DBResult::getDataStream;
+
+  virtual int32_t getDataInt(uint32_t column);
+  virtual uint32_t getDataUInt(uint32_t column);
+  virtual int64_t getDataLong(uint32_t column);
+  virtual std::string getDataString(uint32_t column);
+  virtual const char* getDataStream(uint32_t column, unsigned long &size);
 
   virtual DBResult_ptr advance();
   virtual bool empty();
 
 protected:
-  SQLiteResult(sqlite3_stmt* stmt);
+  SQLiteResult(sqlite3_stmt* stmt, bool ownsHandle = true);
   virtual ~SQLiteResult();
 
-  typedef std::map<const std::string, uint32_t> listNames_t;
-  listNames_t m_listNames;
-
   bool m_rowAvailable;
+  // Results of prepared statements only reset the handle when done
+  bool m_ownsHandle;
   sqlite3_stmt* m_handle;
+
+  friend class SQLiteStatement;
 };
 
 #endif
@@ -0,0 +1,271 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "database_writer.h"
+#include "configmanager.h"
+#include "otsystem.h"
+
+#if defined __EXCEPTION_TRACER__
+#include "exception.h"
+#endif
+
+extern ConfigManager g_config;
+
+DatabaseWriter::DatabaseWriter()
+{
+  m_lastSequence = 0;
+  m_maxPending = 0;
+  m_writtenSaves = 0;
+  m_failedSaves = 0;
+  m_droppedSaves = 0;
+  m_blockedSaves = 0;
+  m_totalLatency = 0;
+  m_maxLatency = 0;
+  m_threadState = STATE_TERMINATED;
+}
+
+void DatabaseWriter::start()
+{
+  assert(m_threadState == STATE_TERMINATED);
+  m_threadState = STATE_RUNNING;
+  m_thread = boost::thread(boost::bind(&DatabaseWriter::writerThread, (void*)this));
+}
+
+void DatabaseWriter::shutdownAndWait()
+{
+  m_saveLock.lock();
+  if(m_threadState != STATE_RUNNING){
+    m_saveLock.unlock();
+    return;
+  }
+
+  m_threadState = STATE_CLOSING;
+  m_saveLock.unlock();
+
+  m_saveSignal.notify_one();
+  m_thread.join();
+}
+
+void DatabaseWriter::writerThread(void* p)
+{
+  DatabaseWriter* writer = (DatabaseWriter*)p;
+  #if defined __EXCEPTION_TRACER__
+  ExceptionHandler writerExceptionHandler;
+  writerExceptionHandler.InstallHandler();
+  #endif
+
+  boost::unique_lock<boost::mutex> saveLockUnique(writer->m_saveLock, boost::defer_lock);
+
+  while(true){
+    saveLockUnique.lock();
+
+    while(writer->m_saves.empty() && writer->m_threadState == STATE_RUNNING){
+      writer->m_saveSignal.wait(saveLockUnique);
+    }
+
+    if(writer->m_saves.empty()){
+      //closing and everything is written
+      writer->m_threadState = STATE_TERMINATED;
+      saveLockUnique.unlock();
+      break;
+    }
+
+    SaveJob* job = writer->m_saves.front();
+    writer->m_saves.pop_front();
+    saveLockUnique.unlock();
+    writer->m_roomSignal.notify_all();
+
+    // Hold the write lock while checking the sequence, a synchronous
+    // save of the same player then either drops this job or runs after it
+    boost::lock_guard<boost::recursive_mutex> lockWrite(writer->m_writeLock);
+
+    saveLockUnique.lock();
+    SequenceMap::iterator it = writer->m_superseded.find(job->data.guid);
+    bool superseded = (it != writer->m_superseded.end() && job->sequence <= it->second);
+    if(superseded){
+      ++writer->m_droppedSaves;
+    }
+    saveLockUnique.unlock();
+
+    bool saved = superseded || writer->savePlayerData(job->data);
+    uint64_t latency = (uint64_t)std::max<int64_t>(0, OTSYS_TIME() - job->queuedTime);
+
+    saveLockUnique.lock();
+    it = writer->m_pending.find(job->data.guid);
+    if(it != writer->m_pending.end() && --it->second == 0){
+      writer->m_pending.erase(it);
+      writer->m_superseded.erase(job->data.guid);
+    }
+
+    if(!superseded){
+      if(saved){
+        ++writer->m_writtenSaves;
+        writer->m_totalLatency += latency;
+        writer->m_maxLatency = std::max(writer->m_maxLatency, latency);
+      }
+      else{
+        ++writer->m_failedSaves;
+      }
+    }
+    saveLockUnique.unlock();
+
+    if(!saved){
+      std::cout << "Error: Could not save player " << job->data.name << "." << std::endl;
+    }
+
+    delete job;
+  }
+
+#if defined __EXCEPTION_TRACER__
+  writerExceptionHandler.RemoveHandler();
+#endif
+}
+
+void DatabaseWriter::addSave(const PlayerSaveData& data)
+{
+  SaveJob* job = new SaveJob;
+  job->data = data;
+  job->queuedTime = OTSYS_TIME();
+
+  uint32_t maxQueue = (uint32_t)std::max<int64_t>(1, g_config.getNumber(ConfigManager::PLAYER_SAVE_QUEUE_SIZE));
+
+  boost::unique_lock<boost::mutex> saveLockUnique(m_saveLock);
+  if(m_threadState != STATE_RUNNING){
+    //nobody is left to write it, save it right here
+    saveLockUnique.unlock();
+
+    supersedeSaves(data.guid);
+    if(!savePlayerData(data)){
+      std::cout << "Error: Could not save player " << data.name << "." << std::endl;
+    }
+
+    delete job;
+    return;
+  }
+
+  if(m_saves.size() >= maxQueue){
+    //the database can't keep up, hold the game back until it does
+    ++m_blockedSaves;
+    while(m_saves.size() >= maxQueue && m_threadState == STATE_RUNNING){
+      m_roomSignal.wait(saveLockUnique);
+    }
+  }
+
+  job->sequence = ++m_lastSequence;
+  ++m_pending[data.guid];
+  m_saves.push_back(job);
+  m_maxPending = std::max(m_maxPending, (uint32_t)m_saves.size());
+  saveLockUnique.unlock();
+
+  m_saveSignal.notify_one();
+}
+
+bool DatabaseWriter::savePlayerData(const PlayerSaveData& data)
+{
+  //the writer thread may be writing an older snapshot on its connection
+  boost::lock_guard<boost::recursive_mutex> lockWrite(m_writeLock);
+  if(!writePlayerData(data)){
+    //the changes of this snapshot are lost, write everything next time
+    markFullSave(data.guid);
+    return false;
+  }
+
+  return true;
+}
+
+bool DatabaseWriter::supersedeSaves(uint32_t guid)
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  if(m_pending.find(guid) == m_pending.end()){
+    return false;
+  }
+
+  m_superseded[guid] = m_lastSequence;
+  return true;
+}
+
+void DatabaseWriter::markFullSave(uint32_t guid)
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  m_fullSaves.insert(guid);
+}
+
+bool DatabaseWriter::takeFullSave(uint32_t guid)
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_fullSaves.erase(guid) != 0;
+}
+
+bool DatabaseWriter::prepareSave(uint32_t guid, bool synchronous)
+{
+  //anything still queued for this player is older than this snapshot, as
+  //the changes it carries are then never written this one has to be full
+  bool superseded = synchronous && supersedeSaves(guid);
+  return takeFullSave(guid) || superseded;
+}
+
+uint32_t DatabaseWriter::getPendingSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return (uint32_t)m_saves.size();
+}
+
+uint32_t DatabaseWriter::getMaxPendingSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_maxPending;
+}
+
+uint64_t DatabaseWriter::getWrittenSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_writtenSaves;
+}
+
+uint64_t DatabaseWriter::getFailedSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_failedSaves;
+}
+
+uint64_t DatabaseWriter::getDroppedSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_droppedSaves;
+}
+
+uint64_t DatabaseWriter::getBlockedSaves()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_blockedSaves;
+}
+
+uint64_t DatabaseWriter::getAverageLatency()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_writtenSaves == 0 ? 0 : m_totalLatency / m_writtenSaves;
+}
+
+uint64_t DatabaseWriter::getMaxLatency()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_saveLock);
+  return m_maxLatency;
+}
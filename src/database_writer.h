@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Thread writing queued player saves to the database
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_DATABASE_WRITER_H__
+#define __OTSERV_DATABASE_WRITER_H__
+
+#include <boost/thread.hpp>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include "player_save.h"
+
+// Player snapshots are written in order by a single thread on its own
+// connection. The write lock orders them with synchronous saves.
+class DatabaseWriter{
+public:
+  DatabaseWriter();
+  ~DatabaseWriter() {}
+
+  /**
+  * Queue a player snapshot. Waits for the writer while the queue holds
+  * more than player_save_queue_size snapshots, so the caller must not
+  * hold a DBQuery.
+  */
+  void addSave(const PlayerSaveData& data);
+
+  /**
+  * Write a snapshot right away, used by this thread and synchronous saves.
+  * After a failure the next snapshot of the player is a full one.
+  */
+  bool savePlayerData(const PlayerSaveData& data);
+
+  /**
+  * Drop the snapshots of a player still in the queue, called before the
+  * player is saved synchronously so an older snapshot can't overwrite it.
+  * \return true if a snapshot of the player was pending
+  */
+  bool supersedeSaves(uint32_t guid);
+
+  // Players whose last save failed, their next snapshot has to be a full one
+  void markFullSave(uint32_t guid);
+  bool takeFullSave(uint32_t guid);
+
+  /**
+  * Called before a snapshot of a player is taken, a synchronous save
+  * supersedes the snapshots still queued first.
+  * \return true if the snapshot has to be a full one
+  */
+  bool prepareSave(uint32_t guid, bool synchronous);
+
+  // Held while a player is written, by this thread and synchronous saves
+  boost::recursive_mutex& getWriteLock() {return m_writeLock;}
+
+  void start();
+  // Writes whatever is still queued before the thread exits
+  void shutdownAndWait();
+
+  // Statistics
+  uint32_t getPendingSaves();
+  uint32_t getMaxPendingSaves();
+  uint64_t getWrittenSaves();
+  uint64_t getFailedSaves();
+  uint64_t getDroppedSaves();
+  uint64_t getBlockedSaves();
+  // Time from queueing to commit, in milliseconds
+  uint64_t getAverageLatency();
+  uint64_t getMaxLatency();
+
+  enum WriterState{
+    STATE_RUNNING,
+    STATE_CLOSING,
+    STATE_TERMINATED
+  };
+
+protected:
+  static void writerThread(void* p);
+
+  struct SaveJob{
+    PlayerSaveData data;
+    uint64_t sequence;
+    int64_t queuedTime;
+  };
+
+  boost::thread m_thread;
+  boost::mutex m_saveLock;
+  boost::recursive_mutex m_writeLock;
+  // Signaled when a save is queued and when the queue has room again
+  boost::condition_variable m_saveSignal;
+  boost::condition_variable m_roomSignal;
+
+  std::deque<SaveJob*> m_saves;
+  // Snapshots per player that are queued or being written
+  typedef std::unordered_map<uint32_t, uint64_t> SequenceMap;
+  SequenceMap m_pending;
+  // Snapshots up to this sequence were superseded by a synchronous save
+  SequenceMap m_superseded;
+  uint64_t m_lastSequence;
+  std::unordered_set<uint32_t> m_fullSaves;
+
+  uint32_t m_maxPending;
+  uint64_t m_writtenSaves;
+  uint64_t m_failedSaves;
+  uint64_t m_droppedSaves;
+  uint64_t m_blockedSaves;
+  uint64_t m_totalLatency;
+  uint64_t m_maxLatency;
+  WriterState m_threadState;
+};
+
+extern DatabaseWriter g_databaseWriter;
+
+#endif
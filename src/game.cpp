@@ -28,6 +28,7 @@
 #include "tile.h"
 #include "combat.h"
 #include "ioplayer.h"
+#include "database_writer.h"
 #include "ioaccount.h"
 #include "chat.h"
 #include "server.h"
@@ -100,6 +101,9 @@ void Game::start(ServiceManager* servicer)
 
   waitingScriptEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_SCRIPT_CLEANUP_INTERVAL,
     boost::bind(&Game::scriptCleanup, this)));
+
+  g_scheduler.addEvent(createSchedulerTask(EVENT_IPBAN_REFRESH_INTERVAL,
+    boost::bind(&Game::refreshIpBans, this)));
 }
 
 Game::~Game()
@@ -196,9 +200,14 @@ bool Game::saveServer(ServerSaveType saveType)
     ++it)
   {
     it->second->loginPosition = it->second->getPosition();
-    IOPlayer::instance()->savePlayer(it->second, saveType == SERVER_SAVE_SHALLOW);
+    IOPlayer::instance()->savePlayerAsync(it->second, saveType == SERVER_SAVE_SHALLOW);
   }
 
+  std::cout << "Notice: " << g_databaseWriter.getPendingSaves() << " player saves queued, "
+    << g_databaseWriter.getWrittenSaves() << " written (average " << g_databaseWriter.getAverageLatency()
+    << "ms, max " << g_databaseWriter.getMaxLatency() << "ms), "
+    << g_databaseWriter.getFailedSaves() << " failed." << std::endl;
+
   if(saveType == SERVER_SAVE_SHALLOW)
     return true;
 
@@ -223,10 +232,14 @@ void Game::loadGameState()
 
   globalStorage.clear();
 
-  for (DBResult_ptr result = db->storeQuery("SELECT `id`, `value` FROM `global_storage`"); result; result = result->advance()) {
-    std::string key = result->getDataString("id");
-    std::string value = result->getDataString("value");
-    globalStorage[key] = value;
+  DBResult_ptr result = db->streamQuery("SELECT `id`, `value` FROM `global_storage`");
+  if(!result)
+    return;
+
+  const uint32_t keyColumn = result->getColumnIndex("id");
+  const uint32_t valueColumn = result->getColumnIndex("value");
+  for (; result; result = result->advance()) {
+    globalStorage[result->getDataString(keyColumn)] = result->getDataString(valueColumn);
   }
 }
 
@@ -1095,9 +1108,9 @@ bool Game::placeCreature(Creature* creature, const Position& pos, bool extendedP
     return false;
   }
 
-  SpectatorVec list;
-  SpectatorVec::iterator it;
-  getSpectators(list, creature->getPosition(), false, true);
+  SpectatorVecPtr spectators = getSharedSpectators(creature->getPosition());
+  const SpectatorVec& list = *spectators;
+  SpectatorVec::const_iterator it;
 
   //send to client
   Player* tmpPlayer = NULL;
@@ -1130,9 +1143,9 @@ bool Game::removeCreature(Creature* creature, bool isLogout /*= true*/)
 
   if (tile)
   {
-    SpectatorVec list;
-    SpectatorVec::iterator it;
-    getSpectators(list, tile->getPosition(), false, true);
+    SpectatorVecPtr spectators = getSharedSpectators(tile->getPosition());
+    const SpectatorVec& list = *spectators;
+    SpectatorVec::const_iterator it;
 
     Player* player = NULL;
     std::vector<uint32_t> oldStackPosVector;
@@ -5052,6 +5065,15 @@ void Game::checkDecay()
   cleanup();
 }
 
+void Game::refreshIpBans()
+{
+  g_scheduler.addEvent(createSchedulerTask(EVENT_IPBAN_REFRESH_INTERVAL,
+    boost::bind(&Game::refreshIpBans, this)));
+
+  //reloaded as a whole, so bans lifted or removed by other programs drop out as well
+  g_bans.loadIpBans();
+}
+
 void Game::checkLight()
 {
   g_scheduler.addEvent(createSchedulerTask(EVENT_LIGHTINTERVAL,
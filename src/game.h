@@ -57,6 +57,7 @@ namespace Script {
 #define EVENT_DECAY_BUCKETS  16
 #define EVENT_SCRIPT_CLEANUP_INTERVAL  90000
 #define EVENT_SCRIPT_TIMER_INTERVAL 20
+#define EVENT_IPBAN_REFRESH_INTERVAL 60000
 
 #define EVENT_CREATURECOUNT 10
 #define EVENT_CREATURE_THINK_INTERVAL 1000
@@ -316,12 +317,28 @@ public:
     return map->getSpectators(centerPos);
   }
 
+  SpectatorVecPtr getSharedSpectators(const Position& centerPos){
+    return map->getSharedSpectators(centerPos);
+  }
+
   void clearSpectatorCache(){
     if(map){
       map->clearSpectatorCache();
     }
   }
 
+  void updateSpectatorCache(Creature* creature, const Tile* tile, bool removed){
+    if(map){
+      map->updateSpectatorCache(creature, tile, removed);
+    }
+  }
+
+  void releaseSpectators(){
+    if(map){
+      map->releaseSpectators();
+    }
+  }
+
   ReturnValue internalMoveCreature(Creature* actor, Creature* creature, Direction direction, uint32_t flags = 0);
   ReturnValue internalMoveCreature(Creature* actor, Creature* creature,
     Cylinder* fromCylinder, Cylinder* toCylinder, uint32_t flags = 0);
@@ -571,6 +588,7 @@ public:
   void checkCreatureAttack(uint32_t creatureId);
   void checkCreatures();
   void checkLight();
+  void refreshIpBans();
   bool kickPlayer(uint32_t playerId);
 
   bool combatBlockHit(CombatType combatType, CombatSource combatSource, Creature* target,
@@ -48,8 +48,9 @@ Account IOAccount::loadAccount(const std::string& accountName, bool preLoad /* =
   DBQuery query;
   DBResult_ptr result;
 
-  query << "SELECT `id`, `name`, `password`, `premend`, `warnings` FROM `accounts` WHERE `name` = " << db->escapeString(accountName);
-  if(!(result = db->storeQuery(query))){
+  DBStatement_ptr stmt = db->prepare("SELECT `id`, `name`, `password`, `premend`, `warnings` FROM `accounts` WHERE `name` = ?");
+  stmt->bindString(0, accountName);
+  if(!(result = stmt->query())){
     return acc;
   }
 
@@ -62,15 +63,15 @@ Account IOAccount::loadAccount(const std::string& accountName, bool preLoad /* =
   if(preLoad)
     return acc;
 
-  query.reset();
-  query << "SELECT " <<
-      "`players`.`name` AS `name`, `worlds`.`name` AS `world`, " <<
-            "`worlds`.`port` AS `port`, `worlds`.`ip` AS `ip`, `worlds`.`id` AS `world_id`" <<
-    "FROM `players` " <<
-    "LEFT JOIN `worlds` ON `worlds`.`id` = `players`.`world_id` " <<
-    "WHERE `account_id` = " << acc.number;
+  stmt = db->prepare("SELECT "
+      "`players`.`name` AS `name`, `worlds`.`name` AS `world`, "
+            "`worlds`.`port` AS `port`, `worlds`.`ip` AS `ip`, `worlds`.`id` AS `world_id`"
+    "FROM `players` "
+    "LEFT JOIN `worlds` ON `worlds`.`id` = `players`.`world_id` "
+    "WHERE `account_id` = ?");
+  stmt->bindInt(0, acc.number);
 
-  for(result = db->storeQuery(query); result; result = result->advance()) {
+  for(result = stmt->query(); result; result = result->advance()) {
     AccountCharacter c;
     c.name = result->getDataString("name");
         c.world_name = result->getDataString("world");
@@ -100,10 +101,11 @@ bool IOAccount::getPassword(const std::string& accountName, const std::string& p
   DBQuery query;
   DBResult_ptr result;
 
-  query << "SELECT `accounts`.`password` AS `password` FROM `accounts`, `players` " <<
-    "WHERE `accounts`.`name` = " << db->escapeString(accountName) << 
-    " AND `accounts`.`id` = `players`.`account_id` AND `players`.`name` = " << db->escapeString(playerName);
-  if((result = db->storeQuery(query.str()))){
+  DBStatement_ptr stmt = db->prepare("SELECT `accounts`.`password` AS `password` FROM `accounts`, `players` "
+    "WHERE `accounts`.`name` = ? AND `accounts`.`id` = `players`.`account_id` AND `players`.`name` = ?");
+  stmt->bindString(0, accountName);
+  stmt->bindString(1, playerName);
+  if((result = stmt->query())){
     password = result->getDataString("password");
     return true;
   }
@@ -419,13 +419,20 @@ bool IOMapSerialize::loadMapBinary(Map* map)
   DBQuery query;
   DBResult_ptr result;
 
-  query << "SELECT * FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
-  for (result = db->storeQuery(query); result; result = result->advance()){
-    int32_t houseid = result->getDataInt("house_id");
+  query << "SELECT `house_id`, `data` FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
+  //depot transfers save players while reading, so the rows can't be streamed
+  result = db->storeQuery(query);
+  if(!result)
+    return true;
+
+  const uint32_t houseIdColumn = result->getColumnIndex("house_id");
+  const uint32_t dataColumn = result->getColumnIndex("data");
+  for (; result; result = result->advance()){
+    int32_t houseid = result->getDataInt(houseIdColumn);
     House* house = Houses::getInstance()->getHouse(houseid);
 
     unsigned long attrSize = 0;
-    const char* attr = result->getDataStream("data", attrSize);
+    const char* attr = result->getDataStream(dataColumn, attrSize);
     PropStream propStream;
     propStream.init(attr, attrSize);
 
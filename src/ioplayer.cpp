@@ -28,6 +28,7 @@
 #include "town.h"
 #include "configmanager.h"
 #include "singleton.h"
+#include "database_writer.h"
 
 extern ConfigManager g_config;
 extern Game g_game;
@@ -44,7 +45,7 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
   DBQuery query;
   DBResult_ptr result;
 
-  query << "SELECT `players`.`id` AS `id`, `players`.`name` AS `name`, `accounts`.`name` AS `accname`, \
+  DBStatement_ptr stmt = db->prepare("SELECT `players`.`id` AS `id`, `players`.`name` AS `name`, `accounts`.`name` AS `accname`, \
     `account_id`, `sex`, `vocation`, `town_id`, `experience`, `level`, `maglevel`, `health`, \
     `groups`.`name` AS `groupname`, `groups`.`flags` AS `groupflags`, `groups`.`access` AS `access`, \
     `groups`.`maxviplist` AS `maxviplist`, `groups`.`maxdepotitems` AS `maxdepotitems`, `groups`.`violation` AS `violationaccess`, \
@@ -55,9 +56,11 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
     FROM `players` \
     LEFT JOIN `accounts` ON `account_id` = `accounts`.`id`\
     LEFT JOIN `groups` ON `groups`.`id` = `players`.`group_id` \
-    WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `players`.`name` = " + db->escapeString(name);
+    WHERE `world_id` = ? AND `players`.`name` = ?");
+  stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+  stmt->bindString(1, name);
 
-  if(!(result = db->storeQuery(query))){
+  if(!(result = stmt->query())){
     return false;
   }
 
@@ -205,13 +208,20 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
   // so we query the skill table
   query.reset();
   query << "SELECT `skill_id`, `value`, `count` FROM `player_skills` WHERE `player_id` = " << player->getGUID();
-  for(result = db->storeQuery(query); result; result = result->advance()){
+  uint32_t skillIdColumn = 0, valueColumn = 0, countColumn = 0;
+  if((result = db->streamQuery(query))){
+    skillIdColumn = result->getColumnIndex("skill_id");
+    valueColumn = result->getColumnIndex("value");
+    countColumn = result->getColumnIndex("count");
+  }
+
+  for(; result; result = result->advance()){
     //now iterate over the skills
     try {
-      SkillType skillid = SkillType::fromInteger(result->getDataInt("skill_id"));
+      SkillType skillid = SkillType::fromInteger(result->getDataInt(skillIdColumn));
 
-      uint32_t skillLevel = result->getDataInt("value");
-      uint32_t skillCount = result->getDataInt("count");
+      uint32_t skillLevel = result->getDataInt(valueColumn);
+      uint32_t skillCount = result->getDataInt(countColumn);
 
       uint32_t nextSkillCount = player->vocation->getReqSkillTries(skillid, skillLevel + 1);
       if(skillCount > nextSkillCount){
@@ -223,7 +233,7 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
       player->skills[skillid.value()][SKILL_TRIES] = skillCount;
       player->skills[skillid.value()][SKILL_PERCENT] = Player::getPercentLevel(skillCount, nextSkillCount);
     } catch(enum_conversion_error&) {
-      std::cout << "Unknown skill ID when loading player " << result->getDataInt("skillid") << std::endl;
+      std::cout << "Unknown skill ID when loading player " << result->getDataInt(skillIdColumn) << std::endl;
     }
   }
 
@@ -300,10 +310,14 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
   //load storage map
   query.str("");
   query << "SELECT `id`, `value` FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-  for(result = db->storeQuery(query); result; result = result->advance()){
-    std::string key = result->getDataString("id");
-    std::string value = result->getDataString("value");
-    player->setCustomValue(key, value);
+  uint32_t keyColumn = 0;
+  if((result = db->streamQuery(query))){
+    keyColumn = result->getColumnIndex("id");
+    valueColumn = result->getColumnIndex("value");
+  }
+
+  for(; result; result = result->advance()){
+    player->setCustomValue(result->getDataString(keyColumn), result->getDataString(valueColumn));
   }
 
   //load vips
@@ -316,6 +330,14 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
       player->addVIP(vip_id, dummy_str, false, true);
   }
 
+  //everything loaded matches the database
+  player->dirtyStorageKeys.clear();
+  player->vipListDirty = false;
+  for(int32_t i = 0; i <= 6; i++){
+    player->savedSkills[i][SKILL_LEVEL] = player->skills[i][SKILL_LEVEL];
+    player->savedSkills[i][SKILL_TRIES] = player->skills[i][SKILL_TRIES];
+  }
+
   player->updateBaseSpeed();
   player->updateInventoryWeight();
   player->updateItemsLight(true);
@@ -392,22 +414,28 @@ bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert
 
 bool IOPlayer::savePlayer(Player* player, bool shallow)
 {
-  player->preSave();
+  PlayerSaveData data;
+  if(!getSaveData(player, data, shallow, g_databaseWriter.prepareSave(player->getGUID(), true))){
+    return false;
+  }
 
-  DatabaseDriver* db = DatabaseDriver::instance();
-  DBQuery query;
-  DBResult_ptr result;
+  return g_databaseWriter.savePlayerData(data);
+}
 
-  //check if the player has to be saved or not
-  query << "SELECT `save` FROM `players` WHERE `id` = " << player->getGUID();
-  if(!(result = db->storeQuery(query))){
+bool IOPlayer::savePlayerAsync(Player* player, bool shallow)
+{
+  PlayerSaveData data;
+  if(!getSaveData(player, data, shallow, g_databaseWriter.prepareSave(player->getGUID(), false))){
     return false;
   }
 
-  const uint32_t save = result->getDataInt("save");
+  g_databaseWriter.addSave(data);
+  return true;
+}
 
-  if(save == 0)
-    return true;
+bool IOPlayer::getSaveData(Player* player, PlayerSaveData& data, bool shallow, bool fullSave)
+{
+  player->preSave();
 
   //serialize conditions
   PropWriteStream propWriteStream;
@@ -424,165 +452,56 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
   uint32_t conditionsSize;
   const char* conditions = propWriteStream.getStream(conditionsSize);
 
-  //First, an UPDATE query to write the player itself
-  query.reset();
-  query << "UPDATE `players` SET `level` = " << player->level
-  << ", `vocation` = " << (int32_t)player->getVocationId()
-  << ", `health` = " << player->health
-  << ", `healthmax` = " << player->healthMax
-  << ", `direction` = " << player->getDirection().value()
-  << ", `experience` = " << player->experience
-  << ", `lookbody` = " << (int32_t)player->defaultOutfit.lookBody
-  << ", `lookfeet` = " << (int32_t)player->defaultOutfit.lookFeet
-  << ", `lookhead` = " << (int32_t)player->defaultOutfit.lookHead
-  << ", `looklegs` = " << (int32_t)player->defaultOutfit.lookLegs
-  << ", `looktype` = " << (int32_t)player->defaultOutfit.lookType
-  << ", `lookaddons` = " << (int32_t)player->defaultOutfit.lookAddons
-  << ", `maglevel` = " << player->magLevel
-  << ", `mana` = " << player->mana
-  << ", `manamax` = " << player->manaMax
-  << ", `manaspent` = " << player->manaSpent
-  << ", `soul` = " << player->soul
-  << ", `town_id` = " << player->town
-  << ", `posx` = " << player->getLoginPosition().x
-  << ", `posy` = " << player->getLoginPosition().y
-  << ", `posz` = " << player->getLoginPosition().z
-  << ", `cap` = " << player->getCapacity()
-  << ", `sex` = " << player->sex.value()
-  << ", `conditions` = " << db->escapeBlob(conditions, conditionsSize)
-  << ", `loss_experience` = " << (int32_t)player->getLossPercent(LOSS_EXPERIENCE)
-  << ", `loss_mana` = " << (int32_t)player->getLossPercent(LOSS_MANASPENT)
-  << ", `loss_skills` = " << (int32_t)player->getLossPercent(LOSS_SKILLTRIES)
-  << ", `loss_items` = " << (int32_t)player->getLossPercent(LOSS_ITEMS)
-  << ", `loss_containers` = " << (int32_t)player->getLossPercent(LOSS_CONTAINERS)
-  << ", `stamina` = " << player->stamina;
+  data.guid = player->getGUID();
+  data.name = player->getName();
+  data.shallow = shallow;
+  data.fullSave = fullSave;
+
+  data.level = player->level;
+  data.vocation = (int32_t)player->getVocationId();
+  data.health = player->health;
+  data.healthMax = player->healthMax;
+  data.direction = player->getDirection().value();
+  data.experience = player->experience;
+  data.lookBody = (int32_t)player->defaultOutfit.lookBody;
+  data.lookFeet = (int32_t)player->defaultOutfit.lookFeet;
+  data.lookHead = (int32_t)player->defaultOutfit.lookHead;
+  data.lookLegs = (int32_t)player->defaultOutfit.lookLegs;
+  data.lookType = (int32_t)player->defaultOutfit.lookType;
+  data.lookAddons = (int32_t)player->defaultOutfit.lookAddons;
+  data.magLevel = player->magLevel;
+  data.mana = player->mana;
+  data.manaMax = player->manaMax;
+  data.manaSpent = player->manaSpent;
+  data.soul = player->soul;
+  data.town = player->town;
+  data.loginPosition = player->getLoginPosition();
+  data.capacity = player->getCapacity();
+  data.sex = player->sex.value();
+  data.conditions.assign(conditions, conditionsSize);
+  data.lossExperience = (int32_t)player->getLossPercent(LOSS_EXPERIENCE);
+  data.lossMana = (int32_t)player->getLossPercent(LOSS_MANASPENT);
+  data.lossSkills = (int32_t)player->getLossPercent(LOSS_SKILLTRIES);
+  data.lossItems = (int32_t)player->getLossPercent(LOSS_ITEMS);
+  data.lossContainers = (int32_t)player->getLossPercent(LOSS_CONTAINERS);
+  data.stamina = player->stamina;
 
 #ifdef __SKULLSYSTEM__
-  query << ", `skull_type` = " << (player->getSkull() == SKULL_RED || player->getSkull() == SKULL_BLACK ? player->getSkull().value() : 0);
-  query << ", `skull_time` = " << player->lastSkullTime;
+  data.skullType = (player->getSkull() == SKULL_RED || player->getSkull() == SKULL_BLACK ? player->getSkull().value() : 0);
+  data.skullTime = player->lastSkullTime;
+#else
+  data.skullType = 0;
+  data.skullTime = 0;
 #endif
 
-  query << " WHERE `id` = " << player->getGUID();
-
-  DBTransaction transaction(db);
-  if(!transaction.begin())
-    return false;
-
-  if(!db->executeQuery(query)){
-    return false;
-  }
-
-  //skills
   for(int32_t i = 0; i <= 6; i++){
-    query.reset();
-    query << "UPDATE `player_skills` SET `value` = " << player->skills[i][SKILL_LEVEL] << ", `count` = " << player->skills[i][SKILL_TRIES] << " WHERE `player_id` = " << player->getGUID() << " AND `skill_id` = " << i;
-
-    if(!db->executeQuery(query)){
-      return false;
-    }
-  }
-
-  if(shallow)
-    return transaction.commit();
-
-  // deletes all player-related stuff
-
-  /*
-  query << "DELETE FROM `player_items` WHERE `player_id` = " << player->getGUID();
-
-  if(!db->executeQuery(query.str())){
-    return false;
-  }
-  query.str("");
-
-  query << "DELETE FROM `player_depotitems` WHERE `player_id` = " << player->getGUID();
-
-  if(!db->executeQuery(query.str())){
-    return false;
-  }
-  query.str("");
-  */
-
-  query.reset();
-  query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-
-  if(!db->executeQuery(query)){
-    return false;
-  }
-
-  query.reset();
-  query << "DELETE FROM `player_viplist` WHERE `player_id` = " << player->getGUID();
-
-  if(!db->executeQuery(query.str())){
-    return false;
-  }
-
-  // Starti inserting
-  DBInsert insert(db);
-
-  /*
-  ItemBlockList itemList;
-  Item* item;
-  for(int32_t slotId = 1; slotId <= 10; ++slotId){
-    if((item = player->inventory[slotId])){
-      itemList.push_back(itemBlock(slotId, item));
-    }
-  }
-
-  //item saving
-  stmt.setQuery("INSERT INTO `player_items` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-  if(!(saveItems(player, itemList, stmt) && stmt.execute())){
-    return false;
-  }
-
-  itemList.clear();
-  for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it){
-    itemList.push_back(itemBlock(it->first, it->second));
-  }
-
-  //save depot items
-  stmt.setQuery("INSERT INTO `player_depotitems` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-  if(!(saveItems(player, itemList, stmt) && stmt.execute())){
-    return false;
-  }
-  */
-
-  insert.setQuery("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES ");
-  for(StorageMap::const_iterator cit = player->getCustomValueIteratorBegin(); cit != player->getCustomValueIteratorEnd();cit++){
-    query.reset();
-    query << player->getGUID() << ", " << db->escapeString(cit->first) << ", " << db->escapeString(cit->second);
-    if(!insert.addRow(query.str())){
-      return false;
-    }
+    data.skills[i][0] = player->skills[i][SKILL_LEVEL];
+    data.skills[i][1] = player->skills[i][SKILL_TRIES];
   }
 
-  if(!insert.execute()){
-    return false;
-  }
-
-  //save vip list
-  if(!player->VIPList.empty()){
-    query.reset();
-    query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << player->getGUID()
-      << ", `id` FROM `players` WHERE `id` IN (";
-    for(VIPListSet::iterator it = player->VIPList.begin(); it != player->VIPList.end(); ){
-      query << (*it);
-      ++it;
-      if(it != player->VIPList.end()){
-        query << ",";
-      }
-      else{
-        query << ")";
-      }
-    }
-
-    if(!db->executeQuery(query)){
-      return false;
-    }
-  }
-
-  //End the transaction
-  return transaction.commit();
+  takePlayerChanges(data, player->savedSkills, player->storageMap, player->dirtyStorageKeys,
+    player->VIPList, player->vipListDirty);
+  return true;
 }
 
 bool IOPlayer::storeNameByGuid(DatabaseDriver &db, uint32_t guid)
@@ -844,9 +763,11 @@ bool IOPlayer::getNameByGuid(uint32_t guid, std::string& name)
   DBQuery query;
   DBResult_ptr result;
 
-  query << "SELECT `name` FROM `players` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `id` = " << guid;
+  DBStatement_ptr stmt = db->prepare("SELECT `name` FROM `players` WHERE `world_id` = ? AND `id` = ?");
+  stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+  stmt->bindInt(1, guid);
 
-  if(!(result = db->storeQuery(query)))
+  if(!(result = stmt->query()))
     return false;
 
   name = result->getDataString("name");
@@ -867,11 +788,13 @@ bool IOPlayer::getGuidByName(uint32_t &guid, std::string& name)
   DBResult_ptr result;
   DBQuery query;
 
-  query <<
+  DBStatement_ptr stmt = db->prepare(
     "SELECT `name`, `id` "
     "FROM `players` "
-    "WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `name` = " << db->escapeString(name);
-  if(!(result = db->storeQuery(query)))
+    "WHERE `world_id` = ? AND `name` = ?");
+  stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+  stmt->bindString(1, name);
+  if(!(result = stmt->query()))
     return false;
 
   name = result->getDataString("name");
@@ -922,11 +845,13 @@ bool IOPlayer::getGuidByNameEx(uint32_t& guid, bool& specialVip, const std::stri
   DBResult_ptr result;
   DBQuery query;
 
-  query <<
+  DBStatement_ptr stmt = db->prepare(
     "SELECT `players`.`name`, `players`.`id`, `groups`.`flags` AS `flags` "
     "FROM `players` LEFT JOIN `groups` ON `groups`.`id` = `players`.`group_id` "
-    "WHERE `players`.`world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `players`.`name`= " << db->escapeString(player_name);
-  if(!(result = db->storeQuery(query.str())))
+    "WHERE `players`.`world_id` = ? AND `players`.`name` = ?");
+  stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+  stmt->bindString(1, player_name);
+  if(!(result = stmt->query()))
     return false;
 
   guid = result->getDataInt("id");
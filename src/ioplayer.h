@@ -29,6 +29,8 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include "database_driver.h"
 #include "const.h"
+#include "position.h"
+#include "player_save.h"
 
 class Item;
 class Player;
@@ -65,6 +67,17 @@ public:
     */
   bool savePlayer(Player* player, bool shallow = false);
 
+  /** Queue a snapshot of the player to the database writer thread
+    * \param player the player to save
+    * \return false if the player could not be serialized
+    */
+  bool savePlayerAsync(Player* player, bool shallow = false);
+
+  /** Copy the state savePlayer writes out of the player and reset its dirty state
+    * \param fullSave copy everything, not just what changed since the last snapshot
+    */
+  bool getSaveData(Player* player, PlayerSaveData& data, bool shallow, bool fullSave);
+
   bool addPlayerDeath(Player* dying_player, const DeathList& dl);
   int32_t getPlayerUnjustKillCount(const Player* player, UnjustKillPeriod_t period);
   bool sendMail(Creature* actor, const std::string name, uint32_t depotId, Item* item);
@@ -26,18 +26,62 @@
 #include "combat.h"
 #include "housetile.h"
 #include "configmanager.h"
+#include <queue>
 
 extern ConfigManager g_config;
 
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+uint64_t Map::chaseFieldHits = 0;
+uint64_t Map::chaseFieldMisses = 0;
+uint64_t Map::staticBlockRejects = 0;
+
+uint64_t Map::spectatorCacheHits = 0;
+uint64_t Map::spectatorCacheMisses = 0;
+uint64_t Map::spectatorCachePatches = 0;
+uint64_t Map::spectatorCacheFlushes = 0;
+uint64_t Map::spectatorCacheEntries = 0;
+
+uint64_t Map::sightCacheHits = 0;
+uint64_t Map::sightCacheMisses = 0;
+
+uint64_t Map::clusterPathSearches = 0;
+uint64_t Map::clusterPathFailures = 0;
+#endif
+
 Map::Map()
 {
   mapWidth = 0;
   mapHeight = 0;
+  pagesWide = 0;
+  pagesHigh = 0;
+  spectatorEpoch = 0;
+
+  sightClock = 1;
+  for(uint32_t i = 0; i < SIGHT_SECTOR_COUNT; ++i){
+    sightSectorClock[i] = 0;
+  }
+  SightCacheEntry empty = {0, 0, false};
+  sightCache.assign(SIGHT_CACHE_SIZE, empty);
+
+  pathClusters = new PathClusterGraph(this);
 }
 
 Map::~Map()
 {
-  //
+  for(ChaseFieldMap::iterator it = chaseFields.begin(); it != chaseFields.end(); ++it){
+    delete it->second;
+  }
+  chaseFields.clear();
+
+  pinnedSpectators.clear();
+  clearSpectatorCache();
+
+  for(std::vector<MapPage*>::iterator it = pages.begin(); it != pages.end(); ++it){
+    delete *it;
+  }
+  pages.clear();
+
+  delete pathClusters;
 }
 
 bool Map::loadMap(const std::string& identifier)
@@ -53,6 +97,8 @@ bool Map::loadMap(const std::string& identifier)
       return false;
     }
 
+    buildPageTable();
+
     if(!loader->loadSpawns(this)){
       std::cout << "WARNING: could not load spawn data." << std::endl;
     }
@@ -107,8 +153,7 @@ Tile* Map::getParentTile(int32_t x, int32_t y, int32_t z)
     return NULL;
   }
 
-  //QTreeLeafNode* leaf = getLeaf(x, y);
-  QTreeLeafNode* leaf = QTreeNode::getLeafStatic(&root, x, y);
+  QTreeLeafNode* leaf = getLeaf(x, y);
   if(leaf){
     Floor* floor = leaf->getFloor(z);
     if(floor){
@@ -161,6 +206,8 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newtile)
     if(eastLeaf){
       leaf->m_leafE = eastLeaf;
     }
+
+    setPageLeaf(x, y, leaf);
   }
 
   Floor* floor = leaf->createFloor(z);
@@ -169,6 +216,8 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newtile)
   if(!floor->tiles[offsetX][offsetY]){
     floor->tiles[offsetX][offsetY] = newtile;
     newtile->qt_node = leaf;
+    updateFloorBits(newtile);
+    sightSectorClock[getSightSector(x, y)] = ++sightClock;
   }
   else{
     std::cout << "Error: Map::setTile() already exists." << std::endl;
@@ -188,13 +237,72 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newtile)
   }
 }
 
+void Map::buildPageTable()
+{
+  if(mapWidth == 0 || mapHeight == 0){
+    //no bounds in the map header, stay on the quad tree
+    return;
+  }
+
+  pagesWide = std::min<uint32_t>((mapWidth + MAP_PAGE_MASK) >> MAP_PAGE_BITS, 0x10000 >> MAP_PAGE_BITS);
+  pagesHigh = std::min<uint32_t>((mapHeight + MAP_PAGE_MASK) >> MAP_PAGE_BITS, 0x10000 >> MAP_PAGE_BITS);
+  pages.assign(pagesWide * pagesHigh, NULL);
+
+  addPageLeaves(&root, 0, 0, 15);
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  uint32_t used = 0;
+  for(std::vector<MapPage*>::iterator it = pages.begin(); it != pages.end(); ++it){
+    if(*it){
+      ++used;
+    }
+  }
+  std::cout << ":: Map page table: " << pagesWide << "x" << pagesHigh << " pages, " << used << " in use" << std::endl;
+#endif
+}
+
+void Map::addPageLeaves(QTreeNode* node, uint32_t x, uint32_t y, uint32_t level)
+{
+  for(uint32_t i = 0; i < 4; ++i){
+    QTreeNode* child = node->m_child[i];
+    if(!child){
+      continue;
+    }
+
+    uint32_t childX = x | ((i & 1) << level);
+    uint32_t childY = y | ((i >> 1) << level);
+    if(child->isLeaf()){
+      setPageLeaf(childX, childY, static_cast<QTreeLeafNode*>(child));
+    }
+    else{
+      addPageLeaves(child, childX, childY, level - 1);
+    }
+  }
+}
+
+void Map::setPageLeaf(uint32_t x, uint32_t y, QTreeLeafNode* leaf)
+{
+  uint32_t pageX = x >> MAP_PAGE_BITS;
+  uint32_t pageY = y >> MAP_PAGE_BITS;
+  if(pageX >= pagesWide || pageY >= pagesHigh){
+    //outside the header bounds, found through the quad tree
+    return;
+  }
+
+  MapPage*& page = pages[pageY * pagesWide + pageX];
+  if(!page){
+    page = new MapPage();
+  }
+  page->leaves[(x & MAP_PAGE_MASK) >> FLOOR_BITS][(y & MAP_PAGE_MASK) >> FLOOR_BITS] = leaf;
+}
+
 void Map::reAssignTile(int32_t x, int32_t y, int32_t z, Tile* newtile)
 {
   if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z  < 0 || z >= MAP_MAX_LAYERS){
     return;
   }
 
-  QTreeLeafNode* leaf = QTreeNode::getLeafStatic(&root, x, y);
+  QTreeLeafNode* leaf = getLeaf(x, y);
   if(leaf){
     Floor* floor = leaf->getFloor(z);
     if(floor){
@@ -316,7 +424,7 @@ bool Map::placeCreature(const Position& centerPos, Creature* creature, bool exte
     Cylinder* toCylinder = tile->__queryDestination(index, creature, &toItem, flags);
     toCylinder->__internalAddThing(creature);
     Tile* toTile = toCylinder->getParentTile();
-    toTile->qt_node->addCreature(creature);
+    toTile->qt_node->addCreature(creature, toTile->getPosition().z);
     return true;
   }
 
@@ -331,7 +439,7 @@ bool Map::removeCreature(Creature* creature)
 {
   Tile* tile = creature->getParentTile();
   if(tile){
-    tile->qt_node->removeCreature(creature);
+    tile->qt_node->removeCreature(creature, tile->getPosition().z);
     tile->__removeThing(NULL, creature, 0);
     return true;
   }
@@ -361,6 +469,15 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
   QTreeLeafNode* leafE;
   QTreeLeafNode* leafS;
 
+  uint32_t epoch = 0;
+  if(checkforduplicate){
+    //everything already in the list counts as seen
+    epoch = ++spectatorEpoch;
+    for(SpectatorVec::iterator it = list.begin(); it != list.end(); ++it){
+      (*it)->spectatorEpoch = epoch;
+    }
+  }
+
   startLeaf = getLeaf(startx1, starty1);
   leafS = startLeaf;
 
@@ -369,18 +486,16 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
     for(int32_t nx = startx1; nx <= endx2; nx += FLOOR_SIZE){
       if(leafE){
 
+        //only the floors in range are looked at
         CreatureVector& node_list = leafE->creature_list;
-        CreatureVector::const_iterator node_iter = node_list.begin();
-        CreatureVector::const_iterator node_end = node_list.end();
+        CreatureVector::const_iterator node_iter = node_list.begin() + leafE->creature_floor[minRangeZ];
+        CreatureVector::const_iterator node_end = node_list.begin() + leafE->creature_floor[maxRangeZ + 1];
         if(node_iter != node_end){
           do{
             Creature* creature = *node_iter;
             const Position& cpos = creature->getPosition();
             int32_t offsetZ = centerPos.z - cpos.z;
 
-            if(cpos.z < minRangeZ || cpos.z > maxRangeZ){
-              continue;
-            }
             if(cpos.y < (centerPos.y + minRangeY + offsetZ) || cpos.y > (centerPos.y + maxRangeY + offsetZ)){
               continue;
             }
@@ -389,7 +504,8 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
             }
 
             if(checkforduplicate){
-              if(std::find(list.begin(), list.end(), creature) == list.end()){
+              if(creature->spectatorEpoch != epoch){
+                creature->spectatorEpoch = epoch;
                 list.push_back(creature);
               }
             }
@@ -421,20 +537,10 @@ void Map::getSpectators(SpectatorVec& list, const Position& centerPos,
   int32_t minRangeY /*= 0*/, int32_t maxRangeY /*= 0*/)
 {
   if(centerPos.z < MAP_MAX_LAYERS){
-    bool foundCache = false;
-    bool cacheResult = false;
     if(minRangeX == 0 && maxRangeX == 0 && minRangeY == 0 && maxRangeY == 0 && multifloor == true && checkforduplicate == false) {
-      SpectatorCache::iterator it = spectatorCache.find(centerPos);
-      if(it != spectatorCache.end()){
-        list = *it->second;
-        foundCache = true;
-      }
-      else{
-        cacheResult = true;
-      }
+      list = *getSharedSpectators(centerPos);
     }
-
-    if(!foundCache){
+    else{
       minRangeX = (minRangeX == 0 ? -Map_maxViewportX : -minRangeX);
       maxRangeX = (maxRangeX == 0 ? Map_maxViewportX : maxRangeX);
       minRangeY = (minRangeY == 0 ? -Map_maxViewportY : -minRangeY);
@@ -474,73 +580,166 @@ void Map::getSpectators(SpectatorVec& list, const Position& centerPos,
         minRangeX, maxRangeX,
         minRangeY, maxRangeY,
         minRangeZ, maxRangeZ);
-
-      if(cacheResult){
-        spectatorCache[centerPos].reset(new SpectatorVec(list));
-      }
     }
   }
 }
 
 const SpectatorVec& Map::getSpectators(const Position& centerPos)
 {
-  if(centerPos.z < MAP_MAX_LAYERS){
-    SpectatorCache::iterator it = spectatorCache.find(centerPos);
-    if(it != spectatorCache.end()){
-      return *it->second;
-    }
-    else{
-      boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-      spectatorCache[centerPos] = p;
-      SpectatorVec& list = *p;
+  static const SpectatorVec emptyList;
+  if(centerPos.z >= MAP_MAX_LAYERS){
+    return emptyList;
+  }
 
-      int32_t minRangeX = -Map_maxViewportX;
-      int32_t maxRangeX = Map_maxViewportX;
-      int32_t minRangeY = -Map_maxViewportY;
-      int32_t maxRangeY = Map_maxViewportY;
+  //keep the vector alive and unpatched until the task is done with it
+  SpectatorVecPtr list = getSharedSpectators(centerPos);
+  pinnedSpectators.push_back(list);
+  return *list;
+}
 
-      int32_t minRangeZ;
-      int32_t maxRangeZ;
+SpectatorVecPtr Map::getSharedSpectators(const Position& centerPos)
+{
+  if(centerPos.z >= MAP_MAX_LAYERS){
+    return SpectatorVecPtr(new SpectatorVec());
+  }
 
-      if(centerPos.z > 7){
-        //underground
+  SpectatorCacheEntry*& entry = spectatorCache[getSpectatorCacheKey(centerPos)];
+  if(entry){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    ++spectatorCacheHits;
+#endif
+    return entry->list;
+  }
 
-        //8->15
-        minRangeZ = std::max(centerPos.z - 2, (int32_t)0);
-        maxRangeZ = std::min(centerPos.z + 2, (int32_t)MAP_MAX_LAYERS - 1);
-      }
-      //above ground
-      else if(centerPos.z == 6){
-        minRangeZ = 0;
-        maxRangeZ = 8;
-      }
-      else if(centerPos.z == 7){
-        minRangeZ = 0;
-        maxRangeZ = 9;
-      }
-      else{
-        minRangeZ = 0;
-        maxRangeZ = 7;
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++spectatorCacheMisses;
+  ++spectatorCacheEntries;
+#endif
+
+  entry = new SpectatorCacheEntry();
+  entry->center = centerPos;
+  entry->list.reset(new SpectatorVec());
+  getSpectatorFloors(centerPos.z, entry->minRangeZ, entry->maxRangeZ);
+
+  getSpectatorsInternal(*entry->list, centerPos, false,
+    -Map_maxViewportX, Map_maxViewportX,
+    -Map_maxViewportY, Map_maxViewportY,
+    entry->minRangeZ, entry->maxRangeZ);
+
+  //register with every leaf the query looked at, same bounds as getSpectatorsInternal
+  int32_t minoffset = centerPos.z - entry->maxRangeZ;
+  int32_t x1 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.x - Map_maxViewportX + minoffset)));
+  int32_t y1 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.y - Map_maxViewportY + minoffset)));
+
+  int32_t maxoffset = centerPos.z - entry->minRangeZ;
+  int32_t x2 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.x + Map_maxViewportX + maxoffset)));
+  int32_t y2 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.y + Map_maxViewportY + maxoffset)));
+
+  for(int32_t ny = y1 - (y1 % FLOOR_SIZE); ny <= y2; ny += FLOOR_SIZE){
+    for(int32_t nx = x1 - (x1 % FLOOR_SIZE); nx <= x2; nx += FLOOR_SIZE){
+      if(QTreeLeafNode* leaf = getLeaf(nx, ny)){
+        leaf->spectator_entries.push_back(entry);
+        entry->leaves.push_back(leaf);
       }
+    }
+  }
 
-      getSpectatorsInternal(list, centerPos, false,
-        minRangeX, maxRangeX,
-        minRangeY, maxRangeY,
-        minRangeZ, maxRangeZ);
+  return entry->list;
+}
 
-      return list;
-    }
+void Map::getSpectatorFloors(int32_t z, int32_t& minRangeZ, int32_t& maxRangeZ)
+{
+  if(z > 7){
+    //underground
+
+    //8->15
+    minRangeZ = std::max(z - 2, (int32_t)0);
+    maxRangeZ = std::min(z + 2, (int32_t)MAP_MAX_LAYERS - 1);
+  }
+  //above ground
+  else if(z == 6){
+    minRangeZ = 0;
+    maxRangeZ = 8;
+  }
+  else if(z == 7){
+    minRangeZ = 0;
+    maxRangeZ = 9;
   }
   else{
-    boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-    SpectatorVec& list = *p;
-    return list;
+    minRangeZ = 0;
+    maxRangeZ = 7;
+  }
+}
+
+bool Map::isSpectatorInRange(const SpectatorCacheEntry* entry, const Position& pos)
+{
+  const Position& centerPos = entry->center;
+  int32_t offsetZ = centerPos.z - pos.z;
+
+  return pos.z >= entry->minRangeZ && pos.z <= entry->maxRangeZ &&
+    pos.y >= centerPos.y - Map_maxViewportY + offsetZ && pos.y <= centerPos.y + Map_maxViewportY + offsetZ &&
+    pos.x >= centerPos.x - Map_maxViewportX + offsetZ && pos.x <= centerPos.x + Map_maxViewportX + offsetZ;
+}
+
+void Map::updateSpectatorCache(Creature* creature, const Tile* tile, bool removed)
+{
+  if(!tile->qt_node){
+    return;
+  }
+
+  const Position& pos = tile->getPosition();
+  std::vector<SpectatorCacheEntry*>& entries = tile->qt_node->spectator_entries;
+  for(std::vector<SpectatorCacheEntry*>::iterator it = entries.begin(); it != entries.end(); ++it){
+    SpectatorCacheEntry* entry = *it;
+    if(!isSpectatorInRange(entry, pos)){
+      continue;
+    }
+
+    //someone still holds the old vector, give the cache its own copy
+    if(!entry->list.unique()){
+      entry->list.reset(new SpectatorVec(*entry->list));
+    }
+
+    SpectatorVec& list = *entry->list;
+    SpectatorVec::iterator cit = std::find(list.begin(), list.end(), creature);
+    if(removed){
+      if(cit != list.end()){
+        list.erase(cit);
+      }
+    }
+    else if(cit == list.end()){
+      list.push_back(creature);
+    }
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    ++spectatorCachePatches;
+#endif
+  }
+}
+
+void Map::releaseSpectators()
+{
+  pinnedSpectators.clear();
+  if(spectatorCache.size() > SPECTATOR_CACHE_MAX_ENTRIES){
+    clearSpectatorCache();
   }
 }
 
 void Map::clearSpectatorCache()
 {
+  for(SpectatorCache::iterator it = spectatorCache.begin(); it != spectatorCache.end(); ++it){
+    SpectatorCacheEntry* entry = it->second;
+    for(std::vector<QTreeLeafNode*>::iterator lit = entry->leaves.begin(); lit != entry->leaves.end(); ++lit){
+      (*lit)->spectator_entries.clear();
+    }
+    delete entry;
+  }
   spectatorCache.clear();
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++spectatorCacheFlushes;
+  spectatorCacheEntries = 0;
+#endif
 }
 
 bool Map::canThrowObjectTo(const Position& fromPos, const Position& toPos, bool checkLineOfSight /*= true*/,
@@ -663,11 +862,8 @@ bool Map::checkSightLine(const Position& fromPos, const Position& toPos) const
       }
       lastrx = rx; lastry = ry; lastrz = rz;
 
-      const Tile* tile = const_cast<Map*>(this)->getParentTile(rx, ry, rz);
-      if(tile){
-        if(tile->blockProjectile()){
-          return false;
-        }
+      if(isProjectileBlocked(rx, ry, rz)){
+        return false;
       }
     }
 
@@ -693,10 +889,51 @@ bool Map::isSightClear(const Position& fromPos, const Position& toPos, bool floo
     return false;
   }
 
+  int32_t dx = toPos.x - fromPos.x;
+  int32_t dy = toPos.y - fromPos.y;
+  if(std::abs(dx) > SIGHT_CACHE_RANGE || std::abs(dy) > SIGHT_CACHE_RANGE ||
+    fromPos.x < 0 || fromPos.y < 0 || fromPos.z < 0 || toPos.z < 0)
+  {
+    return checkSightLine(fromPos, toPos) || checkSightLine(toPos, fromPos);
+  }
+
+  //both rays are cast either way, so (from, to) and (to, from) share an entry
+  const Position& keyPos = (fromPos < toPos ? fromPos : toPos);
+  if(&keyPos != &fromPos){
+    dx = -dx;
+    dy = -dy;
+  }
+  uint64_t key = (uint64_t)(keyPos.x & 0xFFFF) | ((uint64_t)(keyPos.y & 0xFFFF) << 16) |
+    ((uint64_t)(keyPos.z & 0xF) << 32) | ((uint64_t)((fromPos.z + toPos.z - keyPos.z) & 0xF) << 36) |
+    ((uint64_t)(dx + SIGHT_CACHE_RANGE) << 40) | ((uint64_t)(dy + SIGHT_CACHE_RANGE) << 45);
+
+  //the entry is valid when no blocker changed in the sectors the rays cross since it was made
+  uint32_t clock = 0;
+  int32_t minX = std::min(fromPos.x, toPos.x), maxX = std::max(fromPos.x, toPos.x);
+  int32_t minY = std::min(fromPos.y, toPos.y), maxY = std::max(fromPos.y, toPos.y);
+  for(int32_t sy = minY >> SIGHT_SECTOR_BITS; sy <= (maxY >> SIGHT_SECTOR_BITS); ++sy){
+    for(int32_t sx = minX >> SIGHT_SECTOR_BITS; sx <= (maxX >> SIGHT_SECTOR_BITS); ++sx){
+      clock = std::max(clock, sightSectorClock[getSightSector(sx << SIGHT_SECTOR_BITS, sy << SIGHT_SECTOR_BITS)]);
+    }
+  }
+
+  SightCacheEntry& entry = sightCache[(key * 0x9E3779B97F4A7C15ULL) >> 48];
+  if(entry.clock != 0 && entry.key == key && entry.clock >= clock){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    ++sightCacheHits;
+#endif
+    return entry.clear;
+  }
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++sightCacheMisses;
+#endif
+
   // Cast two converging rays and see if either yields a result.
-  return
-    checkSightLine(fromPos, toPos) ||
-    checkSightLine(toPos, fromPos);
+  entry.key = key;
+  entry.clock = sightClock;
+  entry.clear = checkSightLine(fromPos, toPos) || checkSightLine(toPos, fromPos);
+  return entry.clear;
 }
 
 const Tile* Map::canWalkTo(const Creature* creature, const Position& pos)
@@ -708,9 +945,17 @@ const Tile* Map::canWalkTo(const Creature* creature, const Position& pos)
   }
 
   //used for none-cached tiles
-  Tile* tile = getParentTile(pos);
+  bool blocked;
+  Tile* tile = getWalkTile(pos, blocked);
   if(creature->getParentTile() != tile){
-    if(!tile || tile->__queryAdd(0, creature, 1, FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE) != RET_NOERROR){
+    if(blocked){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+      ++staticBlockRejects;
+#endif
+      return NULL;
+    }
+
+    if(tile->__queryAdd(0, creature, 1, FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE) != RET_NOERROR){
       return NULL;
     }
   }
@@ -718,6 +963,94 @@ const Tile* Map::canWalkTo(const Creature* creature, const Position& pos)
   return tile;
 }
 
+Tile* Map::getWalkTile(const Position& pos, bool& blocked)
+{
+  blocked = true;
+  if(pos.x < 0 || pos.x >= 0xFFFF || pos.y < 0 || pos.y >= 0xFFFF || pos.z < 0 || pos.z >= MAP_MAX_LAYERS){
+    return NULL;
+  }
+
+  QTreeLeafNode* leaf = getLeaf(pos.x, pos.y);
+  if(!leaf){
+    return NULL;
+  }
+
+  Floor* floor = leaf->getFloor(pos.z);
+  if(!floor){
+    return NULL;
+  }
+
+  blocked = (floor->blocked & FLOOR_TILE_BIT(pos.x, pos.y)) != 0;
+  return floor->tiles[pos.x & FLOOR_MASK][pos.y & FLOOR_MASK];
+}
+
+bool Map::isStaticBlocked(const Tile* tile)
+{
+  // Everything __queryAdd rejects for any creature under FLAG_PATHFINDING
+  // without looking at creatures, fields or movable items
+  return !tile->ground || tile->floorChange() || tile->positionChange() ||
+    tile->hasFlag(TILEPROP_BLOCKSOLIDNOTMOVEABLE);
+}
+
+void Map::updateFloorBits(const Tile* tile)
+{
+  if(!tile->qt_node){
+    //not placed on the map yet, setTile takes care of it
+    return;
+  }
+
+  const Position& pos = tile->getPosition();
+  Floor* floor = tile->qt_node->getFloor(pos.z);
+  if(!floor || floor->tiles[pos.x & FLOOR_MASK][pos.y & FLOOR_MASK] != tile){
+    return;
+  }
+
+  uint64_t blocked = floor->blocked;
+  if(isStaticBlocked(tile)){
+    floor->blocked |= FLOOR_TILE_BIT(pos.x, pos.y);
+  }
+  else{
+    floor->blocked &= ~FLOOR_TILE_BIT(pos.x, pos.y);
+  }
+
+  if(floor->blocked != blocked){
+    pathClusters->onTileChange(pos);
+  }
+
+  uint64_t projectileBlocked = floor->projectileBlocked;
+  if(tile->blockProjectile()){
+    floor->projectileBlocked |= FLOOR_TILE_BIT(pos.x, pos.y);
+  }
+  else{
+    floor->projectileBlocked &= ~FLOOR_TILE_BIT(pos.x, pos.y);
+  }
+
+  if(floor->projectileBlocked != projectileBlocked){
+    //cached sight lines through this sector are stale now
+    sightSectorClock[getSightSector(pos.x, pos.y)] = ++sightClock;
+  }
+}
+
+bool Map::isProjectileBlocked(int32_t x, int32_t y, int32_t z) const
+{
+  if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z < 0 || z >= MAP_MAX_LAYERS){
+    return false;
+  }
+
+  QTreeLeafNode* leaf = const_cast<Map*>(this)->getLeaf(x, y);
+  if(!leaf){
+    return false;
+  }
+
+  Floor* floor = leaf->getFloor(z);
+  return floor && (floor->projectileBlocked & FLOOR_TILE_BIT(x, y)) != 0;
+}
+
+uint32_t Map::getPathMaxNodes()
+{
+  return (uint32_t)std::max<int64_t>(1, g_config.getNumber(ConfigManager::PATHFINDING_MAX_NODES));
+}
+
 bool Map::getPathTo(const Creature* creature, const Position& destPos,
   std::list<Direction>& listDir, int32_t maxSearchDist /*= -1*/)
 {
@@ -727,23 +1060,76 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 
   listDir.clear();
 
-  Position startPos = destPos;
-  Position endPos = creature->getPosition();
+  const Position& fromPos = creature->getPosition();
+  if(fromPos.z != destPos.z){
+    return false;
+  }
+
+  if(getLocalPath(creature, fromPos, destPos, listDir, maxSearchDist)){
+    return true;
+  }
+
+  //unbounded searches give up early, long ones are routed over the cluster graph
+  if(maxSearchDist == -1 && getClusterPath(creature, fromPos, destPos, listDir)){
+    return true;
+  }
+
+  listDir.clear();
+  return false;
+}
+
+bool Map::getClusterPath(const Creature* creature, const Position& fromPos, const Position& destPos,
+  std::list<Direction>& listDir)
+{
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++clusterPathSearches;
+#endif
 
-  if(startPos.z != endPos.z){
+  std::vector<Position> route;
+  if(!pathClusters->getRoute(fromPos, destPos, route)){
     return false;
   }
 
-  AStarNodes nodes;
-  AStarNode* startNode = nodes.createOpenNode();
+  Position legStart = fromPos;
+  size_t next = 0;
+  while(next < route.size()){
+    //aim for the farthest waypoint a bounded search can still reach
+    size_t leg = next;
+    while(leg + 1 < route.size() &&
+      std::abs((int32_t)route[leg + 1].x - (int32_t)legStart.x) <= PATH_CLUSTER_SIZE &&
+      std::abs((int32_t)route[leg + 1].y - (int32_t)legStart.y) <= PATH_CLUSTER_SIZE){
+      ++leg;
+    }
+
+    if(route[leg] != legStart &&
+      !getLocalPath(creature, legStart, route[leg], listDir, PATH_CLUSTER_SIZE * 2)){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+      ++clusterPathFailures;
+#endif
+      return false;
+    }
+
+    legStart = route[leg];
+    next = leg + 1;
+  }
+
+  return true;
+}
+
+bool Map::getLocalPath(const Creature* creature, const Position& fromPos, const Position& destPos,
+  std::list<Direction>& listDir, int32_t maxSearchDist)
+{
+  Position startPos = destPos;
+  Position endPos = fromPos;
 
-  startNode->x = startPos.x;
-  startNode->y = startPos.y;
+  AStarNodes nodes(getPathMaxNodes());
+  AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 
   startNode->g = 0;
   startNode->h = nodes.getEstimatedDistance(startPos.x, startPos.y, endPos.x, endPos.y);
   startNode->f = startNode->g + startNode->h;
   startNode->parent = NULL;
+  nodes.openNode(startNode);
 
   Position pos;
   pos.z = startPos.z;
@@ -768,7 +1154,6 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
   while(maxSearchDist != -1 || nodes.countClosedNodes() < 100){
     AStarNode* n = nodes.getBestNode();
     if(!n){
-      listDir.clear();
       return false; //no path found
     }
 
@@ -802,27 +1187,23 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
               //The node on the closed/open list is cheaper than this one
               continue;
             }
-
-            nodes.openNode(neighbourNode);
           }
           else{
             //Does not exist in the open/closed list, create a new node
-            neighbourNode = nodes.createOpenNode();
+            neighbourNode = nodes.createNode(pos.x, pos.y);
             if(!neighbourNode){
               //seems we ran out of nodes
-              listDir.clear();
               return false;
             }
           }
 
           //This node is the best node so far with this state
-          neighbourNode->x = pos.x;
-          neighbourNode->y = pos.y;
           neighbourNode->parent = n;
           neighbourNode->g = newg;
           neighbourNode->h = nodes.getEstimatedDistance(neighbourNode->x, neighbourNode->y,
             endPos.x, endPos.y);
           neighbourNode->f = neighbourNode->g + neighbourNode->h;
+          nodes.openNode(neighbourNode);
         }
       }
 
@@ -830,6 +1211,7 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
     }
   }
 
+  size_t prevSize = listDir.size();
   int32_t prevx = endPos.x;
   int32_t prevy = endPos.y;
   int32_t dx, dy;
@@ -872,7 +1254,7 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
     }
   }
 
-  return !listDir.empty();
+  return listDir.size() > prevSize;
 }
 
 bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirList,
@@ -883,14 +1265,12 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
   Position startPos = creature->getPosition();
   Position endPos;
 
-  AStarNodes nodes;
-  AStarNode* startNode = nodes.createOpenNode();
-
-  startNode->x = startPos.x;
-  startNode->y = startPos.y;
+  AStarNodes nodes(getPathMaxNodes());
+  AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 
   startNode->f = 0;
   startNode->parent = NULL;
+  nodes.openNode(startNode);
 
   Position pos;
   pos.z = startPos.z;
@@ -964,12 +1344,10 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
             //The node on the closed/open list is cheaper than this one
             continue;
           }
-
-          nodes.openNode(neighbourNode);
         }
         else{
           //Does not exist in the open/closed list, create a new node
-          neighbourNode = nodes.createOpenNode();
+          neighbourNode = nodes.createNode(pos.x, pos.y);
           if(!neighbourNode){
             if(found){
               //not quite what we want, but we found something
@@ -983,10 +1361,9 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
         }
 
         //This node is the best node so far with this state
-        neighbourNode->x = pos.x;
-        neighbourNode->y = pos.y;
         neighbourNode->parent = n;
         neighbourNode->f = newf;
+        nodes.openNode(neighbourNode);
       }
     }
 
@@ -1043,115 +1420,442 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
   return true;
 }
 
+bool Map::isChaseWalkable(const Tile* tile) const
+{
+  return tile && tile->ground && !tile->blockSolid() && !tile->blockPathFind() &&
+    !tile->floorChange() && !tile->positionChange() && !tile->hasFlag(TILEPROP_PROTECTIONZONE);
+}
+
+void Map::buildChaseField(ChaseField* field)
+{
+  // Dijkstra outward from the tiles next to the target, creatures and
+  // fields only make a tile more expensive like in the A* search
+  typedef std::pair<int32_t, int32_t> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+
+  const Position& center = field->center;
+  for(int32_t y = 0; y < CHASE_FIELD_HEIGHT; ++y){
+    for(int32_t x = 0; x < CHASE_FIELD_WIDTH; ++x){
+      field->dist[y][x] = CHASE_FIELD_UNREACHABLE;
+    }
+  }
+
+  for(int32_t dy = -1; dy <= 1; ++dy){
+    for(int32_t dx = -1; dx <= 1; ++dx){
+      if(dx == 0 && dy == 0){
+        continue;
+      }
+
+      if(isChaseWalkable(getParentTile(center.x + dx, center.y + dy, center.z))){
+        int32_t index = (Map_maxViewportY + dy) * CHASE_FIELD_WIDTH + Map_maxViewportX + dx;
+        field->dist[Map_maxViewportY + dy][Map_maxViewportX + dx] = 0;
+        queue.push(QueueEntry(0, index));
+      }
+    }
+  }
+
+  while(!queue.empty()){
+    QueueEntry entry = queue.top();
+    queue.pop();
+
+    int32_t x = entry.second % CHASE_FIELD_WIDTH;
+    int32_t y = entry.second / CHASE_FIELD_WIDTH;
+    if(entry.first > field->dist[y][x]){
+      continue;
+    }
+
+    for(int32_t dy = -1; dy <= 1; ++dy){
+      for(int32_t dx = -1; dx <= 1; ++dx){
+        int32_t nx = x + dx;
+        int32_t ny = y + dy;
+        if((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= CHASE_FIELD_WIDTH || ny >= CHASE_FIELD_HEIGHT){
+          continue;
+        }
+
+        // The target tile itself is never part of a path
+        if(nx == Map_maxViewportX && ny == Map_maxViewportY){
+          continue;
+        }
+
+        const Tile* tile = getParentTile(center.x + nx - Map_maxViewportX, center.y + ny - Map_maxViewportY, center.z);
+        if(!isChaseWalkable(tile)){
+          continue;
+        }
+
+        int32_t cost = (dx != 0 && dy != 0 ? MAP_DIAGONALWALKCOST : MAP_NORMALWALKCOST);
+        if(!tile->creatures_empty()){
+          cost += MAP_NORMALWALKCOST * 3;
+        }
+        if(tile->getFieldItem()){
+          cost += MAP_NORMALWALKCOST * 3;
+        }
+
+        int32_t dist = entry.first + cost;
+        if(dist < field->dist[ny][nx]){
+          field->dist[ny][nx] = dist;
+          queue.push(QueueEntry(dist, ny * CHASE_FIELD_WIDTH + nx));
+        }
+      }
+    }
+  }
+}
+
+ChaseField* Map::getChaseField(const Creature* target, bool& built)
+{
+  built = false;
+  int64_t now = OTSYS_TIME();
+  const Position& targetPos = target->getPosition();
+
+  ChaseFieldMap::iterator it = chaseFields.find(target->getID());
+  if(it != chaseFields.end()){
+    ChaseField* field = it->second;
+    if(field->expires > now && field->center == targetPos){
+      return field;
+    }
+  }
+  else{
+    // Drop the fields of targets nobody chased lately
+    for(ChaseFieldMap::iterator cit = chaseFields.begin(); cit != chaseFields.end(); ){
+      if(cit->second->expires <= now){
+        delete cit->second;
+        chaseFields.erase(cit++);
+      }
+      else{
+        ++cit;
+      }
+    }
+
+    it = chaseFields.insert(std::make_pair(target->getID(), new ChaseField)).first;
+  }
+
+  ChaseField* field = it->second;
+  field->center = targetPos;
+  field->expires = now + CHASE_FIELD_LIFETIME;
+  buildChaseField(field);
+  built = true;
+  return field;
+}
+
+void Map::onTileChange(const Tile* tile)
+{
+  updateFloorBits(tile);
+
+  const Position& pos = tile->getPosition();
+  for(ChaseFieldMap::iterator it = chaseFields.begin(); it != chaseFields.end(); ++it){
+    ChaseField* field = it->second;
+    if(field->center.z == pos.z &&
+      std::abs(field->center.x - pos.x) <= Map_maxViewportX &&
+      std::abs(field->center.y - pos.y) <= Map_maxViewportY)
+    {
+      field->expires = 0;
+    }
+  }
+}
+
+bool Map::getChasePath(const Creature* creature, const Creature* target,
+  std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+  if(fpp.maxTargetDist != 1 || fpp.minTargetDist > 1 || fpp.keepDistance || !fpp.allowDiagonal){
+    return false;
+  }
+
+  Position startPos = creature->getPosition();
+  const Position& targetPos = target->getPosition();
+  if(startPos.z != targetPos.z ||
+    std::abs(startPos.x - targetPos.x) > Map_maxViewportX ||
+    std::abs(startPos.y - targetPos.y) > Map_maxViewportY)
+  {
+    return false;
+  }
+
+  bool built;
+  ChaseField* field = getChaseField(target, built);
+
+  static int32_t neighbourOrderList[8][2] = {
+    {-1, 0},
+    {0, 1},
+    {1, 0},
+    {0, -1},
+
+    //diagonal
+    {-1, -1},
+    {1, -1},
+    {1, 1},
+    {-1, 1},
+  };
+
+  static Direction neighbourDirList[8] = {
+    WEST, SOUTH, EAST, NORTH, NORTHWEST, NORTHEAST, SOUTHEAST, SOUTHWEST
+  };
+
+  dirList.clear();
+
+  // Walk down the field, every step is checked for this creature
+  FrozenPathingConditionCall pathCondition(targetPos);
+  int32_t x = startPos.x - targetPos.x + Map_maxViewportX;
+  int32_t y = startPos.y - targetPos.y + Map_maxViewportY;
+  Position pos(startPos.x, startPos.y, startPos.z);
+  while(field->dist[y][x] != 0){
+    int32_t best = -1;
+    int32_t bestCost = 0;
+    for(int32_t i = 0; i < 8; ++i){
+      int32_t nx = x + neighbourOrderList[i][0];
+      int32_t ny = y + neighbourOrderList[i][1];
+      if(nx < 0 || ny < 0 || nx >= CHASE_FIELD_WIDTH || ny >= CHASE_FIELD_HEIGHT ||
+        field->dist[ny][nx] >= field->dist[y][x])
+      {
+        continue;
+      }
+
+      int32_t cost = field->dist[ny][nx] + (i >= 4 ? MAP_DIAGONALWALKCOST : MAP_NORMALWALKCOST);
+      if(best != -1 && cost >= bestCost){
+        continue;
+      }
+
+      Position nextPos(pos.x + neighbourOrderList[i][0], pos.y + neighbourOrderList[i][1], pos.z);
+      if(fpp.maxSearchDist != -1 && (std::abs(startPos.x - nextPos.x) > fpp.maxSearchDist ||
+        std::abs(startPos.y - nextPos.y) > fpp.maxSearchDist))
+      {
+        continue;
+      }
+
+      if(canWalkTo(creature, nextPos)){
+        best = i;
+        bestCost = cost;
+      }
+    }
+
+    if(best == -1){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+      ++chaseFieldMisses;
+#endif
+      dirList.clear();
+      return false;
+    }
+
+    x += neighbourOrderList[best][0];
+    y += neighbourOrderList[best][1];
+    pos.x += neighbourOrderList[best][0];
+    pos.y += neighbourOrderList[best][1];
+    dirList.push_back(neighbourDirList[best]);
+  }
+
+  if(!pathCondition.isInRange(startPos, pos, fpp) ||
+    (fpp.clearSight && !isSightClear(pos, targetPos, true)))
+  {
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    ++chaseFieldMisses;
+#endif
+    dirList.clear();
+    return false;
+  }
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  if(built){
+    ++chaseFieldMisses;
+  }
+  else{
+    ++chaseFieldHits;
+  }
+#endif
+  return true;
+}
+
 //*********** AStarNodes *************
 
-AStarNodes::AStarNodes()
+AStarNodes::AStarNodes(uint32_t maxNodes)
 {
+  this->maxNodes = std::max<uint32_t>(1, maxNodes);
   curNode = 0;
-  openNodes.reset();
+  closedNodes = 0;
+
+  nodes.resize(this->maxNodes);
+  heapPosition.resize(this->maxNodes, NODE_NOT_OPEN);
+  openHeap.reserve(this->maxNodes);
+
+  // Keep the table at most half full so probing stays short
+  uint32_t tableSize = 16;
+  while(tableSize < this->maxNodes * 2){
+    tableSize <<= 1;
+  }
+  nodeTable.resize(tableSize, -1);
+  tableMask = tableSize - 1;
+}
+
+uint32_t AStarNodes::getTableSlot(int32_t x, int32_t y) const
+{
+  uint32_t key = ((uint32_t)x << 16) ^ (uint32_t)y;
+  uint32_t slot = (key * 2654435761U) >> 8 & tableMask;
+  while(nodeTable[slot] != -1){
+    const AStarNode& node = nodes[nodeTable[slot]];
+    if(node.x == x && node.y == y){
+      break;
+    }
+    slot = (slot + 1) & tableMask;
+  }
+  return slot;
 }
 
-AStarNode* AStarNodes::createOpenNode()
+AStarNode* AStarNodes::createNode(int32_t x, int32_t y)
 {
-  if(curNode >= MAX_NODES){
+  if(curNode >= maxNodes){
     return NULL;
   }
 
   uint32_t ret_node = curNode;
   curNode++;
-  openNodes[ret_node] = 1;
-  return &nodes[ret_node];
+
+  AStarNode* node = &nodes[ret_node];
+  node->x = x;
+  node->y = y;
+  heapPosition[ret_node] = NODE_NOT_OPEN;
+  nodeTable[getTableSlot(x, y)] = ret_node;
+  return node;
 }
 
-AStarNode* AStarNodes::getBestNode()
+bool AStarNodes::isBetterNode(uint32_t a, uint32_t b) const
 {
-  if(curNode == 0)
-    return NULL;
+  return nodes[a].f < nodes[b].f || (nodes[a].f == nodes[b].f && a < b);
+}
 
-  int best_node_f = 100000;
-  uint32_t best_node = 0;
-  bool found = false;
+void AStarNodes::heapMove(uint32_t index, uint32_t position)
+{
+  openHeap[position] = index;
+  heapPosition[index] = position;
+}
 
-  for(uint32_t i = 0; i < curNode; i++){
-    if(nodes[i].f < best_node_f && openNodes[i] == 1){
-      found = true;
-      best_node_f = nodes[i].f;
-      best_node = i;
+void AStarNodes::heapUp(uint32_t position)
+{
+  uint32_t index = openHeap[position];
+  while(position > 0){
+    uint32_t parent = (position - 1) / 2;
+    if(!isBetterNode(index, openHeap[parent])){
+      break;
     }
+
+    heapMove(openHeap[parent], position);
+    position = parent;
+  }
+  heapMove(index, position);
+}
+
+void AStarNodes::heapDown(uint32_t position)
+{
+  uint32_t index = openHeap[position];
+  uint32_t size = openHeap.size();
+  while(true){
+    uint32_t child = position * 2 + 1;
+    if(child >= size){
+      break;
+    }
+
+    if(child + 1 < size && isBetterNode(openHeap[child + 1], openHeap[child])){
+      ++child;
+    }
+
+    if(!isBetterNode(openHeap[child], index)){
+      break;
+    }
+
+    heapMove(openHeap[child], position);
+    position = child;
   }
+  heapMove(index, position);
+}
+
+AStarNode* AStarNodes::getBestNode()
+{
+  if(openHeap.empty())
+    return NULL;
 
-  if(found){
-    return &nodes[best_node];
+  uint32_t best_node = openHeap.front();
+  heapPosition[best_node] = NODE_NOT_OPEN;
+
+  uint32_t last = openHeap.back();
+  openHeap.pop_back();
+  if(!openHeap.empty()){
+    openHeap[0] = last;
+    heapDown(0);
   }
 
-  return NULL;
+  return &nodes[best_node];
 }
 
 void AStarNodes::closeNode(AStarNode* node)
 {
   uint32_t pos = GET_NODE_INDEX(node);
-  if(pos >= MAX_NODES){
-    assert(pos >= MAX_NODES);
+  if(pos >= curNode){
+    assert(pos >= curNode);
     std::cout << "AStarNodes. trying to close node out of range" << std::endl;
     return;
   }
 
-  openNodes[pos] = 0;
+  int32_t position = heapPosition[pos];
+  if(position == NODE_CLOSED){
+    return;
+  }
+
+  if(position != NODE_NOT_OPEN){
+    uint32_t last = openHeap.back();
+    openHeap.pop_back();
+    if((uint32_t)position < openHeap.size()){
+      openHeap[position] = last;
+      heapPosition[last] = position;
+      heapUp(position);
+      heapDown(heapPosition[last]);
+    }
+  }
+
+  heapPosition[pos] = NODE_CLOSED;
+  ++closedNodes;
 }
 
 void AStarNodes::openNode(AStarNode* node)
 {
   uint32_t pos = GET_NODE_INDEX(node);
-  if(pos >= MAX_NODES){
-    assert(pos >= MAX_NODES);
+  if(pos >= curNode){
+    assert(pos >= curNode);
     std::cout << "AStarNodes. trying to open node out of range" << std::endl;
     return;
   }
 
-  openNodes[pos] = 1;
+  int32_t position = heapPosition[pos];
+  if(position < 0){
+    if(position == NODE_CLOSED){
+      --closedNodes;
+    }
+
+    openHeap.push_back(pos);
+    position = openHeap.size() - 1;
+  }
+
+  heapMove(pos, position);
+  heapUp(position);
 }
 
-uint32_t AStarNodes::countClosedNodes()
+uint32_t AStarNodes::countClosedNodes() const
 {
-  uint32_t counter = 0;
-  for(uint32_t i = 0; i < curNode; i++){
-    if(openNodes[i] == 0){
-      counter++;
-    }
-  }
-  return counter;
+  return closedNodes;
 }
 
-uint32_t AStarNodes::countOpenNodes()
+uint32_t AStarNodes::countOpenNodes() const
 {
-  uint32_t counter = 0;
-  for(uint32_t i = 0; i < curNode; i++){
-    if(openNodes[i] == 1){
-      counter++;
-    }
-  }
-  return counter;
+  return openHeap.size();
 }
 
 bool AStarNodes::isInList(int32_t x, int32_t y)
 {
-  for(uint32_t i = 0; i < curNode; i++){
-    if(nodes[i].x == x && nodes[i].y == y){
-      return true;
-    }
-  }
-  return false;
+  return nodeTable[getTableSlot(x, y)] != -1;
 }
 
 AStarNode* AStarNodes::getNodeInList(int32_t x, int32_t y)
 {
-  for(uint32_t i = 0; i < curNode; i++){
-    if(nodes[i].x == x && nodes[i].y == y){
-      return &nodes[i];
-    }
+  int32_t index = nodeTable[getTableSlot(x, y)];
+  if(index == -1){
+    return NULL;
   }
 
-  return NULL;
+  return &nodes[index];
 }
 
 int32_t AStarNodes::getMapWalkCost(const Creature* creature, AStarNode* node,
@@ -1204,6 +1908,19 @@ Floor::Floor()
       tiles[i][j] = 0;
     }
   }
+  blocked = ~(uint64_t)0;
+  projectileBlocked = 0;
+}
+
+//*********** MapPage constructor **************
+
+MapPage::MapPage()
+{
+  for(uint32_t i = 0; i < MAP_PAGE_LEAVES; ++i){
+    for(uint32_t j = 0; j < MAP_PAGE_LEAVES; ++j){
+      leaves[i][j] = NULL;
+    }
+  }
 }
 
 //**************** QTreeNode **********************
@@ -1291,6 +2008,9 @@ QTreeLeafNode::QTreeLeafNode()
   for(uint32_t i = 0; i < MAP_MAX_LAYERS; ++i){
     m_array[i] = NULL;
   }
+  for(uint32_t i = 0; i <= MAP_MAX_LAYERS; ++i){
+    creature_floor[i] = 0;
+  }
   m_isLeaf = true;
   m_leafS = NULL;
   m_leafE = NULL;
@@ -24,7 +24,10 @@
 #include "classes.h"
 #include "tile.h"
 #include "waypoints.h"
-#include <bitset>
+#include "pathcluster.h"
+#include <vector>
+#include <map>
+#include <unordered_map>
 #include "protocolconst.h"
 
 #define MAP_MAX_LAYERS 16
@@ -37,6 +40,9 @@ struct AStarNode{
 
 #define MAX_NODES 512
 #define GET_NODE_INDEX(a) (a - &nodes[0])
+// Heap position of nodes that are not open
+#define NODE_NOT_OPEN -1
+#define NODE_CLOSED -2
 
 // The cost of a straight step for the pathfinding algorithm
 #define MAP_NORMALWALKCOST 10
@@ -45,17 +51,22 @@ struct AStarNode{
 // then two straight step, else the player / monsters will walk diagonally all the time.
 #define MAP_DIAGONALWALKCOST 25
 
+// Open nodes are kept in a binary heap ordered by f (creation order on
+// ties), positions are found through a small open addressing table
 class AStarNodes{
 public:
-  AStarNodes();
+  AStarNodes(uint32_t maxNodes = MAX_NODES);
   ~AStarNodes(){};
 
-  AStarNode* createOpenNode();
+  // New node at x, y, put it on the open list with openNode once f is set
+  AStarNode* createNode(int32_t x, int32_t y);
+  // Takes the open node with the lowest f from the open list
   AStarNode* getBestNode();
   void closeNode(AStarNode* node);
+  // Adds the node to the open list, or reorders it after its f decreased
   void openNode(AStarNode* node);
-  uint32_t countClosedNodes();
-  uint32_t countOpenNodes();
+  uint32_t countClosedNodes() const;
+  uint32_t countOpenNodes() const;
   bool isInList(int32_t x, int32_t y);
   AStarNode* getNodeInList(int32_t x, int32_t y);
 
@@ -65,11 +76,37 @@ public:
   int32_t getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, int32_t yGoal);
 
 private:
-  AStarNode nodes[MAX_NODES];
-  std::bitset<MAX_NODES> openNodes;
+  bool isBetterNode(uint32_t a, uint32_t b) const;
+  void heapMove(uint32_t index, uint32_t position);
+  void heapUp(uint32_t position);
+  void heapDown(uint32_t position);
+  uint32_t getTableSlot(int32_t x, int32_t y) const;
+
+  std::vector<AStarNode> nodes;
+  std::vector<int32_t> heapPosition;
+  std::vector<uint32_t> openHeap;
+  std::vector<int32_t> nodeTable;
+  uint32_t tableMask;
+  uint32_t maxNodes;
   uint32_t curNode;
+  uint32_t closedNodes;
 };
 
+// Distances toward the tiles next to a chased creature, built once and
+// shared by every actor following it until it moves or expires
+#define CHASE_FIELD_WIDTH (Map_maxViewportX * 2 + 1)
+#define CHASE_FIELD_HEIGHT (Map_maxViewportY * 2 + 1)
+#define CHASE_FIELD_LIFETIME 100
+#define CHASE_FIELD_UNREACHABLE 0xFFFF
+
+struct ChaseField{
+  Position center;
+  int64_t expires;
+  uint16_t dist[CHASE_FIELD_HEIGHT][CHASE_FIELD_WIDTH];
+};
+
+typedef std::map<uint32_t, ChaseField*> ChaseFieldMap;
+
 template<class T> class lessPointer : public std::binary_function<T*, T*, bool>
 {
 public:
@@ -82,12 +119,45 @@ public:
 #define FLOOR_SIZE (1 << FLOOR_BITS)
 #define FLOOR_MASK (FLOOR_SIZE - 1)
 
+#define FLOOR_TILE_BIT(x, y) ((uint64_t)1 << ((((x) & FLOOR_MASK) << FLOOR_BITS) | ((y) & FLOOR_MASK)))
+
 struct Floor{
   Floor();
   Tile* tiles[FLOOR_SIZE][FLOOR_SIZE];
+  // One bit per tile that no creature can path through whatever stands on it
+  // (missing tile or ground, floor change, teleport, immovable solid item)
+  uint64_t blocked;
+  // One bit per tile that blocks projectiles, walked by checkSightLine
+  uint64_t projectileBlocked;
+};
+
+// Direct mapped cache of isSightClear results within the viewport
+#define SIGHT_CACHE_SIZE 65536
+#define SIGHT_CACHE_RANGE 15
+// Projectile changes are tracked per 32x32 sector, hashed into a fixed table
+#define SIGHT_SECTOR_BITS 5
+#define SIGHT_SECTOR_COUNT 4096
+
+struct SightCacheEntry{
+  uint64_t key;
+  uint32_t clock;
+  bool clear;
 };
 
 class FrozenPathingConditionCall;
+struct SpectatorCacheEntry;
+class QTreeLeafNode;
+
+// Flat page table over the quad tree leaves, one page per 256x256 tiles
+#define MAP_PAGE_BITS 8
+#define MAP_PAGE_SIZE (1 << MAP_PAGE_BITS)
+#define MAP_PAGE_MASK (MAP_PAGE_SIZE - 1)
+#define MAP_PAGE_LEAVES (MAP_PAGE_SIZE / FLOOR_SIZE)
+
+struct MapPage{
+  MapPage();
+  QTreeLeafNode* leaves[MAP_PAGE_LEAVES][MAP_PAGE_LEAVES];
+};
 
 class QTreeNode{
 public:
@@ -118,15 +188,19 @@ public:
   QTreeLeafNode* stepSouth(){return m_leafS;}
   QTreeLeafNode* stepEast(){return m_leafE;}
 
-  void addCreature(Creature* c);
-  void removeCreature(Creature* c);
+  void addCreature(Creature* c, int32_t z);
+  void removeCreature(Creature* c, int32_t z);
 
 protected:
   static bool newLeaf;
   QTreeLeafNode* m_leafS;
   QTreeLeafNode* m_leafE;
   Floor* m_array[MAP_MAX_LAYERS];
+  // Creatures grouped by floor, floor z is [creature_floor[z], creature_floor[z + 1])
   CreatureVector creature_list;
+  uint16_t creature_floor[MAP_MAX_LAYERS + 1];
+  // Cached spectator queries whose range covers this leaf
+  std::vector<SpectatorCacheEntry*> spectator_entries;
 
   friend class Map;
   friend class QTreeNode;
@@ -134,6 +208,20 @@ protected:
 
 
 
+// Viewport spectators of one position, patched in place as creatures come and go
+struct SpectatorCacheEntry{
+  Position center;
+  int32_t minRangeZ;
+  int32_t maxRangeZ;
+  SpectatorVecPtr list;
+  std::vector<QTreeLeafNode*> leaves;
+};
+
+typedef std::unordered_map<uint64_t, SpectatorCacheEntry*> SpectatorCache;
+
+// Past this many entries the spectator cache is dropped at the end of a task
+#define SPECTATOR_CACHE_MAX_ENTRIES 2048
+
 /**
   * Map class.
   * Holds all the actual map-data
@@ -167,7 +255,7 @@ public:
   Tile* getParentTile(int32_t x, int32_t y, int32_t z);
   Tile* getParentTile(const Position& pos);
 
-  QTreeLeafNode* getLeaf(uint16_t x, uint16_t y){ return root.getLeaf(x, y);}
+  QTreeLeafNode* getLeaf(uint16_t x, uint16_t y);
 
   /**
   * Set a single tile.
@@ -219,6 +307,12 @@ public:
 
   const Tile* canWalkTo(const Creature* creature, const Position& pos);
 
+  /**
+  * Get a tile together with its static walkability bit.
+  * \param blocked set to true when the tile is missing or statically blocked
+  */
+  Tile* getWalkTile(const Position& pos, bool& blocked);
+
   /**
   * Get the path to a specific position on the map.
   * \param creature The creature that wants a path
@@ -233,6 +327,34 @@ public:
   bool getPathMatching(const Creature* creature, std::list<Direction>& dirList,
     const FrozenPathingConditionCall& pathCondition, const FindPathParams& fpp);
 
+  /**
+  * Get the path next to a followed creature from the shared chase field.
+  * Only melee chases are served, false means getPathMatching has to be used.
+  */
+  bool getChasePath(const Creature* creature, const Creature* target,
+    std::list<Direction>& dirList, const FindPathParams& fpp);
+
+  // Refreshes the static walk bit and drops the chase fields covering a tile whose items changed
+  void onTileChange(const Tile* tile);
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  static uint64_t chaseFieldHits;
+  static uint64_t chaseFieldMisses;
+  static uint64_t staticBlockRejects;
+
+  static uint64_t spectatorCacheHits;
+  static uint64_t spectatorCacheMisses;
+  static uint64_t spectatorCachePatches;
+  static uint64_t spectatorCacheFlushes;
+  static uint64_t spectatorCacheEntries;
+
+  static uint64_t sightCacheHits;
+  static uint64_t sightCacheMisses;
+
+  static uint64_t clusterPathSearches;
+  static uint64_t clusterPathFailures;
+#endif
+
 
   // Waypoints on the map
   Waypoints waypoints;
@@ -243,6 +365,34 @@ protected:
   std::string housefile;
   SpectatorCache spectatorCache;
 
+  static bool isStaticBlocked(const Tile* tile);
+  void updateFloorBits(const Tile* tile);
+
+  bool isProjectileBlocked(int32_t x, int32_t y, int32_t z) const;
+  static uint32_t getSightSector(int32_t x, int32_t y){
+    return (((uint32_t)x >> SIGHT_SECTOR_BITS) * 2654435761u ^ ((uint32_t)y >> SIGHT_SECTOR_BITS)) % SIGHT_SECTOR_COUNT;
+  }
+  // Last sightClock value at which a projectile blocker changed in a sector
+  uint32_t sightSectorClock[SIGHT_SECTOR_COUNT];
+  uint32_t sightClock;
+  mutable std::vector<SightCacheEntry> sightCache;
+
+  // Node cap of a single path search, pathfinding_max_nodes
+  static uint32_t getPathMaxNodes();
+
+  // Plain A* from fromPos to destPos, appends the directions to listDir
+  bool getLocalPath(const Creature* creature, const Position& fromPos, const Position& destPos,
+    std::list<Direction>& listDir, int32_t maxSearchDist);
+  // Follows a route over the cluster graph, refining it one leg at a time
+  bool getClusterPath(const Creature* creature, const Position& fromPos, const Position& destPos,
+    std::list<Direction>& listDir);
+  PathClusterGraph* pathClusters;
+
+  ChaseFieldMap chaseFields;
+  ChaseField* getChaseField(const Creature* target, bool& built);
+  void buildChaseField(ChaseField* field);
+  bool isChaseWalkable(const Tile* tile) const;
+
   // Actually scans the map for spectators
   void getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, bool checkforduplicate,
     int32_t minRangeX, int32_t maxRangeX,
@@ -256,15 +406,42 @@ protected:
     int32_t minRangeX = 0, int32_t maxRangeX = 0,
     int32_t minRangeY = 0, int32_t maxRangeY = 0);
   // The returned SpectatorVec is a temporary and should not be kept around
-  // Take special heed in that the vector will be destroyed if any function
-  // that calls clearSpectatorCache is called.
+  // past the current task, it stays valid and unchanged until releaseSpectators.
   const SpectatorVec& getSpectators(const Position& centerPos);
-
+  // Same as above but keeps the cached vector alive when the cache is cleared
+  // while the caller still iterates it
+  SpectatorVecPtr getSharedSpectators(const Position& centerPos);
+
+  // Adds/removes a creature entering/leaving a tile to the cached entries covering it
+  void updateSpectatorCache(Creature* creature, const Tile* tile, bool removed);
+  // Called at the end of each task, drops the references handed out by
+  // getSpectators and flushes the cache once it grew too large
+  void releaseSpectators();
   void clearSpectatorCache();
 
+  static uint64_t getSpectatorCacheKey(const Position& pos){
+    return ((uint64_t)(uint32_t)pos.x << 32) | ((uint64_t)((uint32_t)pos.y & 0xFFFFFF) << 8) | (uint8_t)pos.z;
+  }
+  static void getSpectatorFloors(int32_t z, int32_t& minRangeZ, int32_t& maxRangeZ);
+  static bool isSpectatorInRange(const SpectatorCacheEntry* entry, const Position& pos);
+
+  // Cached vectors returned by reference during the current task
+  std::vector<SpectatorVecPtr> pinnedSpectators;
+
+  // Stamped on creatures to de-duplicate a query without searching the result
+  uint32_t spectatorEpoch;
+
   // Root node of the quad tree
   QTreeNode root;
 
+  // Pages covering the map bounds from the map header, allocated where
+  // leaves exist. Lookups outside of it go through the quad tree.
+  std::vector<MapPage*> pages;
+  uint32_t pagesWide, pagesHigh;
+  void buildPageTable();
+  void addPageLeaves(QTreeNode* node, uint32_t x, uint32_t y, uint32_t level);
+  void setPageLeaf(uint32_t x, uint32_t y, QTreeLeafNode* leaf);
+
   struct RefreshBlock_t{
     ItemVector list;
     uint64_t lastRefresh;
@@ -280,14 +457,49 @@ protected:
   friend class IOMapSerialize;
 };
 
-inline void QTreeLeafNode::addCreature(Creature* c) {
+inline QTreeLeafNode* Map::getLeaf(uint16_t x, uint16_t y)
+{
+  uint32_t pageX = x >> MAP_PAGE_BITS;
+  uint32_t pageY = y >> MAP_PAGE_BITS;
+  if(pageX < pagesWide && pageY < pagesHigh){
+    MapPage* page = pages[pageY * pagesWide + pageX];
+    if(!page){
+      return NULL;
+    }
+    return page->leaves[(x & MAP_PAGE_MASK) >> FLOOR_BITS][(y & MAP_PAGE_MASK) >> FLOOR_BITS];
+  }
+  return QTreeNode::getLeafStatic(&root, x, y);
+}
+
+inline void QTreeLeafNode::addCreature(Creature* c, int32_t z) {
   creature_list.push_back(c);
+
+  //each floor above z hands its first creature to its end, the free slot
+  //moves down until it is the end of floor z
+  uint32_t hole = creature_list.size() - 1;
+  for(int32_t f = MAP_MAX_LAYERS - 1; f > z; --f){
+    if(creature_floor[f] != hole){
+      std::swap(creature_list[creature_floor[f]], creature_list[hole]);
+    }
+    hole = creature_floor[f];
+    ++creature_floor[f];
+  }
+  ++creature_floor[MAP_MAX_LAYERS];
 }
 
-inline void QTreeLeafNode::removeCreature(Creature* c) {
-  CreatureVector::iterator iter = std::find(creature_list.begin(), creature_list.end(), c);
-  assert(iter != creature_list.end());
-  std::swap(*iter, creature_list.back());
+inline void QTreeLeafNode::removeCreature(Creature* c, int32_t z) {
+  CreatureVector::iterator iter = std::find(creature_list.begin() + creature_floor[z],
+    creature_list.begin() + creature_floor[z + 1], c);
+  assert(iter != creature_list.begin() + creature_floor[z + 1]);
+
+  //fill the gap with the last creature of each floor from z upwards
+  uint32_t hole = iter - creature_list.begin();
+  for(int32_t f = z; f < MAP_MAX_LAYERS; ++f){
+    uint32_t last = creature_floor[f + 1] - 1;
+    creature_list[hole] = creature_list[last];
+    hole = last;
+    --creature_floor[f + 1];
+  }
   creature_list.pop_back();
 }
 
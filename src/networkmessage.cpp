@@ -25,13 +25,29 @@
 #include "item.h"
 
 NetworkMessage::NetworkMessage()
+  : m_MsgBuf(new uint8_t[NETWORKMESSAGE_MAXSIZE]), m_MsgBufSize(NETWORKMESSAGE_MAXSIZE), m_ownsBuffer(true)
+{
+  Reset();
+}
+
+NetworkMessage::NetworkMessage(uint8_t* buffer, int32_t bufferSize)
+  : m_MsgBuf(buffer), m_MsgBufSize(bufferSize), m_ownsBuffer(false)
 {
   Reset();
 }
 
 NetworkMessage::~NetworkMessage()
 {
+  if(m_ownsBuffer){
+    delete[] m_MsgBuf;
+  }
+}
 
+void NetworkMessage::setBuffer(uint8_t* buffer, int32_t bufferSize)
+{
+  assert(!m_ownsBuffer);
+  m_MsgBuf = buffer;
+  m_MsgBufSize = bufferSize;
 }
 
 uint8_t NetworkMessage::GetByte()
@@ -73,7 +89,7 @@ uint64_t NetworkMessage::GetU64() const
 std::string NetworkMessage::GetString()
 {
   uint16_t stringlen = GetU16();
-  if(stringlen >= (NETWORKMESSAGE_MAXSIZE - m_ReadPos))
+  if(stringlen >= (m_MsgBufSize - m_ReadPos))
     return std::string();
 
   char* v = (char*)(m_MsgBuf + m_ReadPos);
@@ -84,7 +100,7 @@ std::string NetworkMessage::GetString()
 std::string NetworkMessage::GetRaw()
 {
   uint16_t stringlen = m_MsgSize- m_ReadPos;
-  if(stringlen >= (NETWORKMESSAGE_MAXSIZE - m_ReadPos))
+  if(stringlen >= (m_MsgBufSize - m_ReadPos))
     return std::string();
 
   char* v = (char*)(m_MsgBuf + m_ReadPos);
@@ -266,7 +282,12 @@ void NetworkMessage::Reset()
   m_ReadPos = 8;
 }
 
-bool NetworkMessage::canAdd(uint32_t size) const
+bool NetworkMessage::canAdd(uint32_t size)
 {
-  return size + m_ReadPos < max_body_length;
+  // leave room for the headers and the xtea padding
+  if(size + m_ReadPos < (uint32_t)(m_MsgBufSize - header_length - crypto_length - xtea_multiple)){
+    return true;
+  }
+
+  return expand(size);
 }
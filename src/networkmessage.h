@@ -39,6 +39,7 @@ public:
   enum { max_body_length = NETWORKMESSAGE_MAXSIZE - header_length - crypto_length - xtea_multiple };
 
   // constructor/destructor
+  // The default message owns a buffer of NETWORKMESSAGE_MAXSIZE bytes
   NetworkMessage();
   virtual ~NetworkMessage();
 
@@ -90,13 +91,30 @@ public:
 #endif
 
 protected:
+  // Used by derived messages that bring their own buffer, may be NULL
+  NetworkMessage(uint8_t* buffer, int32_t bufferSize);
+
   void Reset();
-  bool canAdd(uint32_t size) const;
+  bool canAdd(uint32_t size);
+
+  // Called when size bytes do not fit into the buffer anymore,
+  // derived messages may switch to a bigger buffer here
+  virtual bool expand(uint32_t size) {return false;}
+
+  void setBuffer(uint8_t* buffer, int32_t bufferSize);
+  int32_t getBufferSize() const {return m_MsgBufSize;}
 
   int32_t m_MsgSize;
   int32_t m_ReadPos;
 
-  uint8_t m_MsgBuf[NETWORKMESSAGE_MAXSIZE];
+  uint8_t* m_MsgBuf;
+  int32_t m_MsgBufSize;
+
+private:
+  NetworkMessage(const NetworkMessage&);
+  NetworkMessage& operator=(const NetworkMessage&);
+
+  bool m_ownsBuffer;
 };
 
 typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
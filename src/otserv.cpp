@@ -23,6 +23,7 @@
 #include "otsystem.h"
 #include "tasks.h"
 #include "scheduler.h"
+#include "database_writer.h"
 #include "server.h"
 #include "database_driver.h"
 #include "ioplayer.h"
@@ -34,11 +35,13 @@
 #include "protocolgame.h"
 #include "protocolold.h"
 #include "protocollogin.h"
+#include "outputmessage.h"
 #include "status.h"
 #include "admin.h"
 #include "tools.h"
 #include "ban.h"
 #include "rsa.h"
+#include "xtea.h"
 #include "configmanager.h"
 
 
@@ -68,6 +71,7 @@
 Game g_game;
 Dispatcher g_dispatcher;
 Scheduler g_scheduler;
+DatabaseWriter g_databaseWriter;
 RSA g_RSA;
 ConfigManager g_config;
 CreatureManager g_creature_types;
@@ -243,9 +247,10 @@ int main(int argc, char *argv[])
 
   ServiceManager servicer;
 
-  // Start scheduler and dispatcher threads
+  // Start scheduler, dispatcher and database writer threads
   g_dispatcher.start();
   g_scheduler.start();
+  g_databaseWriter.start();
 
   // Add load task
   g_dispatcher.addTask(createTask(boost::bind(mainLoader, g_command_opts, &servicer)));
@@ -266,6 +271,8 @@ int main(int argc, char *argv[])
 #endif
   g_scheduler.shutdownAndWait();
   g_dispatcher.shutdownAndWait();
+  // Write the player saves that are still queued
+  g_databaseWriter.shutdownAndWait();
   // Don't run destructors, may hang!
   exit(EXIT_SUCCESS);
 
@@ -485,6 +492,13 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
   }
   std::cout << "[done]" << std::endl;
 
+  std::cout << ":: Loading IP bans... ";
+  if(!g_bans.loadIpBans()){
+    ErrorMessage("Unable to load IP bans!");
+    exit(EXIT_FAILURE);
+  }
+  std::cout << "[done]" << std::endl;
+
   std::cout << ":: NO DATABASE VERSION CHECK, TURN ON AGAIN WHEN SCHEMA IS STABLE!" << std::endl;
   /*
    * TODO: Enable this again when DB schema is stable
@@ -522,6 +536,14 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 
   std::cout << "[done]" << std::endl;
 
+  //the parallel XTEA versions picked for this CPU must match the plain one
+  std::cout << ":: Checking XTEA... " << std::flush;
+  if(!xteaSelfTest()){
+    ErrorMessage("XTEA gives wrong results on this CPU!");
+    exit(EXIT_FAILURE);
+  }
+  std::cout << "[done]" << std::endl;
+
   std::stringstream filename;
 
   //load vocations
@@ -780,6 +802,24 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
     }
   }
 
+  std::string flushPolicy = asLowerCaseString(g_config.getString(ConfigManager::OUTPUT_FLUSH_POLICY));
+  OutputFlushPolicy_t outputFlushPolicy = OUTPUT_FLUSH_THRESHOLD;
+  if(flushPolicy == "nagle")
+    outputFlushPolicy = OUTPUT_FLUSH_NAGLE;
+  else if(flushPolicy == "latency")
+    outputFlushPolicy = OUTPUT_FLUSH_LATENCY;
+  else if(flushPolicy != "threshold"){
+    ErrorMessage("Unknown output flush policy!");
+    exit(EXIT_FAILURE);
+  }
+  OutputMessagePool::getInstance()->setFlushPolicy(outputFlushPolicy,
+    (uint32_t)std::max<int64_t>(0, g_config.getNumber(ConfigManager::OUTPUT_FLUSH_SIZE)),
+    (uint32_t)std::max<int64_t>(0, g_config.getNumber(ConfigManager::OUTPUT_FLUSH_DELAY)));
+  std::cout << ":: Output flush policy: " << asUpperCaseString(flushPolicy) << std::endl;
+
+  // Spread connections over the network reactor threads
+  service_manager->setNetworkThreads((uint32_t)std::max<int64_t>(1, g_config.getNumber(ConfigManager::NETWORK_THREADS)));
+
   // Tie ports and register services
 
   // Tibia protocols
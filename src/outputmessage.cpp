@@ -30,9 +30,19 @@ extern Dispatcher g_dispatcher;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t OutputMessagePool::OutputMessagePoolCount = OUTPUT_POOL_SIZE;
+uint64_t OutputMessagePool::flushReasonCount[OUTPUT_FLUSH_REASON_COUNT] = {0};
+uint64_t OutputMessagePool::flushQueuedTime = 0;
+uint64_t OutputMessagePool::flushQueuedTimeMax = 0;
 #endif
 
+namespace {
+  const int32_t outputBufferSizes[OUTPUT_BUFFER_CLASS_COUNT] = {256, 2048, NETWORKMESSAGE_MAXSIZE};
+  // Free buffers kept per class, the rest goes back to the heap
+  const size_t outputBufferFreeLimit[OUTPUT_BUFFER_CLASS_COUNT] = {4096, 1024, 64};
+}
+
 OutputMessage::OutputMessage()
+  : NetworkMessage(NULL, 0), m_bufferClass(OUTPUT_BUFFER_SMALL)
 {
   freeMessage();
 }
@@ -75,8 +85,35 @@ uint64_t OutputMessage::getFrame() const
   return m_frame;
 }
 
+bool OutputMessage::expand(uint32_t size)
+{
+  uint32_t needed = m_ReadPos + size + header_length + crypto_length + xtea_multiple + 1;
+  uint32_t bufferClass = m_bufferClass + 1;
+  while(bufferClass < OUTPUT_BUFFER_CLASS_COUNT && (uint32_t)OutputMessagePool::getBufferSize(bufferClass) < needed){
+    ++bufferClass;
+  }
+
+  if(bufferClass >= OUTPUT_BUFFER_CLASS_COUNT){
+    return false;
+  }
+
+  OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+  uint8_t* buffer = outputPool->allocateBuffer(bufferClass);
+  memcpy(buffer, m_MsgBuf, m_MsgBufSize);
+  outputPool->releaseBuffer(m_MsgBuf, m_bufferClass);
+
+  setBuffer(buffer, OutputMessagePool::getBufferSize(bufferClass));
+  m_bufferClass = bufferClass;
+  return true;
+}
+
 void OutputMessage::freeMessage()
 {
+  if(m_MsgBuf){
+    OutputMessagePool::getInstance()->releaseBuffer(m_MsgBuf, m_bufferClass);
+    setBuffer(NULL, 0);
+  }
+
   setConnection(Connection_ptr());
   setProtocol(NULL);
   m_frame = 0;
@@ -118,24 +155,37 @@ void OutputMessage::setFrame(uint64_t frame)
 //*********** OutputMessagePool ****************
 
 OutputMessagePool::OutputMessagePool()
+  : m_autoSendProtocols(NULL), m_autoSendCount(0),
+  m_flushPolicy(OUTPUT_FLUSH_THRESHOLD), m_flushSize(1024), m_flushDelay(10)
 {
+  for(uint32_t i = 0; i < OUTPUT_BUFFER_CLASS_COUNT; ++i){
+    m_allocatedBuffers[i] = 0;
+  }
+
   for(uint32_t i = 0; i < OUTPUT_POOL_SIZE; ++i){
     OutputMessage* msg = new OutputMessage();
     m_outputMessages.push_back(msg);
-#ifdef __TRACK_NETWORK__
-    m_allOutputMessages.push_back(msg);
-#endif
+    m_allOutputMessages.insert(msg);
   }
   m_frameTime = OTSYS_TIME();
 }
 
 OutputMessagePool::~OutputMessagePool()
 {
-  InternalOutputMessageList::iterator it;
-  for(it = m_outputMessages.begin(); it != m_outputMessages.end(); ++it){
+  //messages still being sent hold a buffer of their own
+  for(OutputMessageSet::iterator it = m_allOutputMessages.begin(); it != m_allOutputMessages.end(); ++it){
+    delete[] (*it)->m_MsgBuf;
     delete *it;
   }
+  m_allOutputMessages.clear();
   m_outputMessages.clear();
+
+  for(uint32_t i = 0; i < OUTPUT_BUFFER_CLASS_COUNT; ++i){
+    for(std::vector<uint8_t*>::iterator it = m_freeBuffers[i].begin(); it != m_freeBuffers[i].end(); ++it){
+      delete[] *it;
+    }
+    m_freeBuffers[i].clear();
+  }
 }
 
 void OutputMessagePool::startExecutionFrame()
@@ -161,7 +211,57 @@ size_t OutputMessagePool::getAvailableMessageCount() const
 
 size_t OutputMessagePool::getAutoMessageCount() const
 {
-  return m_autoSendOutputMessages.size();
+  return m_autoSendCount;
+}
+
+int32_t OutputMessagePool::getBufferSize(uint32_t bufferClass)
+{
+  return outputBufferSizes[bufferClass];
+}
+
+uint8_t* OutputMessagePool::allocateBuffer(uint32_t bufferClass)
+{
+  boost::mutex::scoped_lock lockClass(m_bufferLock);
+  ++m_allocatedBuffers[bufferClass];
+
+  if(m_freeBuffers[bufferClass].empty()){
+    return new uint8_t[outputBufferSizes[bufferClass]];
+  }
+
+  uint8_t* buffer = m_freeBuffers[bufferClass].back();
+  m_freeBuffers[bufferClass].pop_back();
+  return buffer;
+}
+
+void OutputMessagePool::releaseBuffer(uint8_t* buffer, uint32_t bufferClass)
+{
+  boost::mutex::scoped_lock lockClass(m_bufferLock);
+  --m_allocatedBuffers[bufferClass];
+
+  if(m_freeBuffers[bufferClass].size() >= outputBufferFreeLimit[bufferClass]){
+    delete[] buffer;
+  }
+  else{
+    m_freeBuffers[bufferClass].push_back(buffer);
+  }
+}
+
+size_t OutputMessagePool::getAllocatedBufferCount(uint32_t bufferClass)
+{
+  boost::mutex::scoped_lock lockClass(m_bufferLock);
+  return m_allocatedBuffers[bufferClass];
+}
+
+size_t OutputMessagePool::getFreeBufferCount(uint32_t bufferClass)
+{
+  boost::mutex::scoped_lock lockClass(m_bufferLock);
+  return m_freeBuffers[bufferClass].size();
+}
+
+size_t OutputMessagePool::getBufferMemory(uint32_t bufferClass)
+{
+  boost::mutex::scoped_lock lockClass(m_bufferLock);
+  return (m_allocatedBuffers[bufferClass] + m_freeBuffers[bufferClass].size()) * outputBufferSizes[bufferClass];
 }
 
 OutputMessagePool* OutputMessagePool::getInstance()
@@ -181,18 +281,7 @@ void OutputMessagePool::send(OutputMessage_ptr msg)
     std::cout << "Sending message - SINGLE" << std::endl;
     #endif
 
-    if(msg->getConnection()){
-      if(!msg->getConnection()->send(msg)){
-        // Send only fails when connection is closing (or in error state)
-        // This call will free the message
-        msg->getProtocol()->onSendMessage(msg);
-      }
-    }
-    else{
-      #ifdef __DEBUG_NET_DETAIL__
-      std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
-      #endif
-    }
+    internalSend(msg);
   }
   else{
     #ifdef __DEBUG_NET_DETAIL__
@@ -201,59 +290,150 @@ void OutputMessagePool::send(OutputMessage_ptr msg)
   }
 }
 
-void OutputMessagePool::sendAll()
+void OutputMessagePool::internalSend(OutputMessage_ptr msg)
 {
-  boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-  OutputMessageMessageList::iterator it;
-
-  for(it = m_toAddQueue.begin(); it != m_toAddQueue.end();){
-    //drop messages that are older than Connection::read_timeout seconds
-    if(OTSYS_TIME() - (*it)->getFrame() > Connection::read_timeout * 1000 ){
-      (*it)->getProtocol()->onSendMessage(*it);
-      it = m_toAddQueue.erase(it);
-      continue;
+  if(msg->getConnection()){
+    if(!msg->getConnection()->send(msg)){
+      // Send only fails when connection is closing (or in error state)
+      // This call will free the message
+      msg->getProtocol()->onSendMessage(msg);
     }
-
-    (*it)->setState(OutputMessage::STATE_ALLOCATED);
-    m_autoSendOutputMessages.push_back(*it);
-    ++it;
   }
-
-  m_toAddQueue.clear();
-
-  for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end(); ){
-    OutputMessage_ptr omsg = *it;
-    #ifdef __NO_PLAYER_SENDBUFFER__
-    //use this define only for debugging
-    bool v = 1;
-    #else
-    //It will send only messages bigger then 1 kb or with a lifetime greater than 10 ms
-    bool v = omsg->getMessageLength() > 1024 || (m_frameTime - omsg->getFrame() > 10);
+  else{
+    #ifdef __DEBUG_NET_DETAIL__
+    std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
     #endif
-    if(v){
+  }
+}
+
+void OutputMessagePool::sendAll()
+{
+  // Only protocols that wrote something are linked here, the list is
+  // owned by the dispatcher thread so no lock is needed
+  Protocol* protocol = m_autoSendProtocols;
+  while(protocol){
+    Protocol* next = protocol->m_nextAutoSend;
+    OutputMessage* omsg = protocol->m_outputBuffer.get();
+
+    OutputFlushReason_t reason;
+    if(!omsg){
+      removeAutoSend(protocol);
+    }
+    else if(shouldFlush(protocol, omsg, reason)){
       #ifdef __DEBUG_NET_DETAIL__
       std::cout << "Sending message - ALL" << std::endl;
       #endif
 
-      if(omsg->getConnection()){
-        if(!omsg->getConnection()->send(omsg)){
-          // Send only fails when connection is closing (or in error state)
-          // This call will free the message
-          omsg->getProtocol()->onSendMessage(omsg);
-        }
-      }
-      else{
-        #ifdef __DEBUG_NET__
-        std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
-        #endif
-      }
-
-      it = m_autoSendOutputMessages.erase(it);
+      flushAutoSend(protocol, reason);
     }
-    else{
-      ++it;
+
+    protocol = next;
+  }
+}
+
+bool OutputMessagePool::shouldFlush(Protocol* protocol, const OutputMessage* msg, OutputFlushReason_t& reason) const
+{
+  #ifdef __NO_PLAYER_SENDBUFFER__
+  //use this define only for debugging
+  reason = OUTPUT_FLUSH_REASON_AGE;
+  return true;
+  #endif
+
+  if((uint32_t)msg->getMessageLength() > m_flushSize){
+    reason = OUTPUT_FLUSH_REASON_SIZE;
+    return true;
+  }
+
+  uint64_t delay = m_flushDelay;
+  if(m_flushPolicy == OUTPUT_FLUSH_NAGLE){
+    // Nothing on the wire, so holding the data back gains nothing
+    Connection* connection = msg->m_connection.get();
+    if(connection && !connection->isWriting()){
+      reason = OUTPUT_FLUSH_REASON_IDLE;
+      return true;
     }
   }
+  else if(m_flushPolicy == OUTPUT_FLUSH_LATENCY){
+    // Queueing should stay a small part of what the client already waits for
+    uint32_t rtt = protocol->getRoundTripTime();
+    if(rtt > 0){
+      delay = std::min<uint64_t>(delay, rtt / 8);
+    }
+  }
+
+  if(m_frameTime - msg->getFrame() > delay){
+    reason = OUTPUT_FLUSH_REASON_AGE;
+    return true;
+  }
+  return false;
+}
+
+void OutputMessagePool::setFlushPolicy(OutputFlushPolicy_t policy, uint32_t size, uint32_t delay)
+{
+  m_flushPolicy = policy;
+  m_flushSize = size;
+  m_flushDelay = delay;
+}
+
+OutputFlushPolicy_t OutputMessagePool::getFlushPolicy() const
+{
+  return m_flushPolicy;
+}
+
+void OutputMessagePool::addAutoSend(Protocol* protocol)
+{
+  if(protocol->m_autoSendLinked){
+    return;
+  }
+
+  protocol->m_prevAutoSend = NULL;
+  protocol->m_nextAutoSend = m_autoSendProtocols;
+  if(m_autoSendProtocols){
+    m_autoSendProtocols->m_prevAutoSend = protocol;
+  }
+  m_autoSendProtocols = protocol;
+  protocol->m_autoSendLinked = true;
+  ++m_autoSendCount;
+}
+
+void OutputMessagePool::removeAutoSend(Protocol* protocol)
+{
+  if(!protocol->m_autoSendLinked){
+    return;
+  }
+
+  if(protocol->m_prevAutoSend){
+    protocol->m_prevAutoSend->m_nextAutoSend = protocol->m_nextAutoSend;
+  }
+  else{
+    m_autoSendProtocols = protocol->m_nextAutoSend;
+  }
+
+  if(protocol->m_nextAutoSend){
+    protocol->m_nextAutoSend->m_prevAutoSend = protocol->m_prevAutoSend;
+  }
+
+  protocol->m_prevAutoSend = NULL;
+  protocol->m_nextAutoSend = NULL;
+  protocol->m_autoSendLinked = false;
+  --m_autoSendCount;
+}
+
+void OutputMessagePool::flushAutoSend(Protocol* protocol, OutputFlushReason_t reason)
+{
+  OutputMessage_ptr omsg;
+  omsg.swap(protocol->m_outputBuffer);
+  removeAutoSend(protocol);
+
+  if(omsg){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    uint64_t queuedTime = m_frameTime - omsg->getFrame();
+    ++flushReasonCount[reason];
+    flushQueuedTime += queuedTime;
+    flushQueuedTimeMax = std::max(flushQueuedTimeMax, queuedTime);
+#endif
+    internalSend(omsg);
+  }
 }
 
 void OutputMessagePool::stop()
@@ -296,6 +476,17 @@ void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
 #endif
 
   m_outputPoolLock.lock();
+  if(m_outputMessages.size() >= OUTPUT_POOL_FREE_LIMIT){
+    m_allOutputMessages.erase(msg);
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    OutputMessagePoolCount--;
+#endif
+    m_outputPoolLock.unlock();
+
+    delete msg;
+    return;
+  }
+
   m_outputMessages.push_back(msg);
   m_outputPoolLock.unlock();
 }
@@ -320,13 +511,11 @@ OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool a
     OutputMessage* msg = new OutputMessage();
     m_outputMessages.push_back(msg);
 
+    m_allOutputMessages.insert(msg);
+
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
   OutputMessagePoolCount++;
 #endif
-
-#ifdef __TRACK_NETWORK__
-    m_allOutputMessages.push_back(msg);
-#endif
   }
 
   OutputMessage_ptr outputmessage;
@@ -342,10 +531,12 @@ OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool a
 void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend)
 {
   TRACK_MESSAGE(msg);
+  msg->setBuffer(allocateBuffer(OUTPUT_BUFFER_SMALL), outputBufferSizes[OUTPUT_BUFFER_SMALL]);
+  msg->m_bufferClass = OUTPUT_BUFFER_SMALL;
   msg->Reset();
   if(autosend){
     msg->setState(OutputMessage::STATE_ALLOCATED);
-    m_autoSendOutputMessages.push_back(msg);
+    addAutoSend(protocol);
   }
   else{
     msg->setState(OutputMessage::STATE_ALLOCATED_NO_AUTOSEND);
@@ -367,10 +558,3 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
   msg->setFrame(m_frameTime);
 }
 
-void OutputMessagePool::addToAutoSend(OutputMessage_ptr msg)
-{
-  m_outputPoolLock.lock();
-  m_toAddQueue.push_back(msg);
-  m_outputPoolLock.unlock();
-}
-
@@ -23,8 +23,11 @@
 
 #include <cstddef>
 #include <list>
+#include <set>
 #include <stdint.h>
+#include <vector>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
 #include "networkmessage.h"
 
 class Connection;
@@ -33,6 +36,32 @@ class Protocol;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 
 #define OUTPUT_POOL_SIZE 100
+// Released messages kept for reuse, the pool shrinks back to this after bursts
+#define OUTPUT_POOL_FREE_LIMIT 1000
+
+// Output messages start with a small buffer and are moved to the next
+// size class when a write does not fit anymore
+enum OutputBufferClass_t {
+  OUTPUT_BUFFER_SMALL = 0,
+  OUTPUT_BUFFER_MEDIUM,
+  OUTPUT_BUFFER_LARGE,
+  OUTPUT_BUFFER_CLASS_COUNT
+};
+
+// When auto send messages are handed to the connection
+enum OutputFlushPolicy_t {
+  OUTPUT_FLUSH_THRESHOLD = 0,  // bigger than the size threshold or older than the delay
+  OUTPUT_FLUSH_NAGLE,          // as soon as the connection has no write in flight
+  OUTPUT_FLUSH_LATENCY         // delay limited by a share of the connection round trip time
+};
+
+enum OutputFlushReason_t {
+  OUTPUT_FLUSH_REASON_SIZE = 0,
+  OUTPUT_FLUSH_REASON_AGE,
+  OUTPUT_FLUSH_REASON_IDLE,
+  OUTPUT_FLUSH_REASON_FULL,
+  OUTPUT_FLUSH_REASON_COUNT
+};
 
 class OutputMessage : public NetworkMessage, boost::noncopyable
 {
@@ -104,6 +133,8 @@ protected:
 
   void freeMessage();
 
+  virtual bool expand(uint32_t size);
+
   void setProtocol(Protocol* protocol);
   void setConnection(Connection_ptr connection);
 
@@ -116,6 +147,7 @@ protected:
   Connection_ptr m_connection;
 
   uint32_t m_outputBufferStart;
+  uint32_t m_bufferClass;
   uint64_t m_frame;
 
   OutputMessageState m_state;
@@ -133,10 +165,24 @@ public:
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
   static uint32_t OutputMessagePoolCount;
+
+  // Auto send flushes per reason, and how long those messages were queued
+  static uint64_t flushReasonCount[OUTPUT_FLUSH_REASON_COUNT];
+  static uint64_t flushQueuedTime;
+  static uint64_t flushQueuedTimeMax;
 #endif
 
   void send(OutputMessage_ptr msg);
   void sendAll();
+
+  // Protocols with a pending auto send message, dispatcher thread only
+  void addAutoSend(Protocol* protocol);
+  void removeAutoSend(Protocol* protocol);
+  void flushAutoSend(Protocol* protocol, OutputFlushReason_t reason);
+
+  void setFlushPolicy(OutputFlushPolicy_t policy, uint32_t size, uint32_t delay);
+  OutputFlushPolicy_t getFlushPolicy() const;
+
   void stop();
   OutputMessage_ptr getOutputMessage(Protocol* protocol, bool autosend = true);
   void startExecutionFrame();
@@ -144,22 +190,43 @@ public:
   size_t getTotalMessageCount() const;
   size_t getAvailableMessageCount() const;
   size_t getAutoMessageCount() const;
-  void addToAutoSend(OutputMessage_ptr msg);
+
+  static int32_t getBufferSize(uint32_t bufferClass);
+  uint8_t* allocateBuffer(uint32_t bufferClass);
+  void releaseBuffer(uint8_t* buffer, uint32_t bufferClass);
+
+  // Buffer memory per size class
+  size_t getAllocatedBufferCount(uint32_t bufferClass);
+  size_t getFreeBufferCount(uint32_t bufferClass);
+  size_t getBufferMemory(uint32_t bufferClass);
 
 protected:
 
   void configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend);
   void releaseMessage(OutputMessage* msg);
   void internalReleaseMessage(OutputMessage* msg);
+  void internalSend(OutputMessage_ptr msg);
+  bool shouldFlush(Protocol* protocol, const OutputMessage* msg, OutputFlushReason_t& reason) const;
 
   typedef std::list<OutputMessage*> InternalOutputMessageList;
-  typedef std::list<OutputMessage_ptr> OutputMessageMessageList;
+  typedef std::set<OutputMessage*> OutputMessageSet;
 
   InternalOutputMessageList m_outputMessages;
-  InternalOutputMessageList m_allOutputMessages;
-  OutputMessageMessageList m_autoSendOutputMessages;
-  OutputMessageMessageList m_toAddQueue;
+  // Every message the pool created, deleted with the pool
+  OutputMessageSet m_allOutputMessages;
   boost::recursive_mutex m_outputPoolLock;
+
+  Protocol* m_autoSendProtocols;
+  size_t m_autoSendCount;
+
+  std::vector<uint8_t*> m_freeBuffers[OUTPUT_BUFFER_CLASS_COUNT];
+  size_t m_allocatedBuffers[OUTPUT_BUFFER_CLASS_COUNT];
+  boost::mutex m_bufferLock;
+
+  OutputFlushPolicy_t m_flushPolicy;
+  uint32_t m_flushSize;
+  uint32_t m_flushDelay;
+
   uint64_t m_frameTime;
   bool m_isOpen;
 };
@@ -0,0 +1,420 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "pathcluster.h"
+#include "map.h"
+#include <queue>
+#include <algorithm>
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+uint64_t PathClusterGraph::clusterBuilds = 0;
+uint64_t PathClusterGraph::routeSearches = 0;
+uint64_t PathClusterGraph::routeFailures = 0;
+#endif
+
+namespace {
+  // The start and the goal of a route search are not entrances
+  const uint64_t ROUTE_START_ID = (uint64_t)1 << 62;
+  const uint64_t ROUTE_END_ID = ROUTE_START_ID + 1;
+
+  struct RouteNode{
+    Position pos;
+    uint64_t parent;
+    int32_t g;
+    bool closed;
+  };
+
+  typedef std::unordered_map<uint64_t, RouteNode> RouteNodeMap;
+  typedef std::pair<int32_t, uint64_t> RouteQueueItem;
+  typedef std::priority_queue<RouteQueueItem, std::vector<RouteQueueItem>,
+    std::greater<RouteQueueItem> > RouteQueue;
+
+  int32_t neighbourOffsets[8][2] =
+  {
+    {-1, 0},
+    {0, 1},
+    {1, 0},
+    {0, -1},
+
+    //diagonal
+    {-1, -1},
+    {1, -1},
+    {1, 1},
+    {-1, 1},
+  };
+}
+
+PathClusterGraph::PathClusterGraph(Map* _map) :
+  map(_map)
+{
+  //
+}
+
+PathClusterGraph::~PathClusterGraph()
+{
+  for(ClusterMap::iterator it = clusters.begin(); it != clusters.end(); ++it){
+    delete it->second;
+  }
+  clusters.clear();
+}
+
+int32_t PathClusterGraph::getEstimatedDistance(const Position& from, const Position& to)
+{
+  int32_t dx = std::abs((int32_t)from.x - (int32_t)to.x);
+  int32_t dy = std::abs((int32_t)from.y - (int32_t)to.y);
+  int32_t diagonal = std::min(dx, dy);
+  return MAP_DIAGONALWALKCOST * diagonal + MAP_NORMALWALKCOST * (dx + dy - 2 * diagonal);
+}
+
+PathCluster* PathClusterGraph::getCluster(int32_t cx, int32_t cy, int32_t z)
+{
+  if(cx < 0 || cy < 0 || cx > 0xFFF || cy > 0xFFF || z < 0 || z >= MAP_MAX_LAYERS){
+    return NULL;
+  }
+
+  PathCluster*& cluster = clusters[getClusterKey(cx, cy, z)];
+  if(!cluster){
+    cluster = new PathCluster();
+  }
+
+  if(cluster->dirty){
+    buildCluster(cluster, cx, cy, z);
+  }
+
+  return cluster;
+}
+
+void PathClusterGraph::markDirty(int32_t cx, int32_t cy, int32_t z)
+{
+  if(cx < 0 || cy < 0){
+    return;
+  }
+
+  ClusterMap::iterator it = clusters.find(getClusterKey(cx, cy, z));
+  if(it != clusters.end()){
+    it->second->dirty = true;
+  }
+}
+
+void PathClusterGraph::onTileChange(const Position& pos)
+{
+  int32_t cx = pos.x >> PATH_CLUSTER_BITS;
+  int32_t cy = pos.y >> PATH_CLUSTER_BITS;
+  markDirty(cx, cy, pos.z);
+
+  //border tiles also decide the entrances of the neighbour
+  if((pos.x & PATH_CLUSTER_MASK) == 0){
+    markDirty(cx - 1, cy, pos.z);
+  }
+  else if((pos.x & PATH_CLUSTER_MASK) == PATH_CLUSTER_MASK){
+    markDirty(cx + 1, cy, pos.z);
+  }
+
+  if((pos.y & PATH_CLUSTER_MASK) == 0){
+    markDirty(cx, cy - 1, pos.z);
+  }
+  else if((pos.y & PATH_CLUSTER_MASK) == PATH_CLUSTER_MASK){
+    markDirty(cx, cy + 1, pos.z);
+  }
+}
+
+void PathClusterGraph::buildCluster(PathCluster* cluster, int32_t cx, int32_t cy, int32_t z)
+{
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++clusterBuilds;
+#endif
+
+  cluster->nodes.clear();
+  cluster->edges.clear();
+
+  int32_t baseX = cx << PATH_CLUSTER_BITS;
+  int32_t baseY = cy << PATH_CLUSTER_BITS;
+
+  //north, south, west and east border
+  addEntrances(cluster, Position(baseX, baseY, z), 1, 0, 0, -1);
+  addEntrances(cluster, Position(baseX, baseY + PATH_CLUSTER_MASK, z), 1, 0, 0, 1);
+  addEntrances(cluster, Position(baseX, baseY, z), 0, 1, -1, 0);
+  addEntrances(cluster, Position(baseX + PATH_CLUSTER_MASK, baseY, z), 0, 1, 1, 0);
+
+  cluster->edges.resize(cluster->nodes.size());
+
+  ClusterWalkable walkable;
+  getWalkable(Position(baseX, baseY, z), walkable);
+
+  ClusterDistances dist;
+  for(size_t i = 0; i < cluster->nodes.size(); ++i){
+    getDistances(cluster->nodes[i], walkable, dist);
+
+    for(size_t j = 0; j < cluster->nodes.size(); ++j){
+      const Position& nodePos = cluster->nodes[j];
+      int32_t cost = dist[nodePos.y - baseY][nodePos.x - baseX];
+      if(i != j && cost != PATH_CLUSTER_UNREACHABLE){
+        PathClusterEdge edge = {(uint16_t)j, cost};
+        cluster->edges[i].push_back(edge);
+      }
+    }
+  }
+
+  cluster->dirty = false;
+}
+
+void PathClusterGraph::addEntrances(PathCluster* cluster, const Position& first,
+  int32_t stepX, int32_t stepY, int32_t outX, int32_t outY)
+{
+  //both clusters of a border walk it in the same direction and agree on the midpoints
+  int32_t runStart = -1;
+  for(int32_t i = 0; i <= PATH_CLUSTER_SIZE; ++i){
+    bool open = false;
+    if(i < PATH_CLUSTER_SIZE){
+      int32_t x = first.x + stepX * i;
+      int32_t y = first.y + stepY * i;
+      open = isWalkable(x, y, first.z) && isWalkable(x + outX, y + outY, first.z);
+    }
+
+    if(open){
+      if(runStart == -1){
+        runStart = i;
+      }
+    }
+    else if(runStart != -1){
+      int32_t middle = (runStart + i - 1) / 2;
+      Position entrance(first.x + stepX * middle, first.y + stepY * middle, first.z);
+      if(std::find(cluster->nodes.begin(), cluster->nodes.end(), entrance) == cluster->nodes.end()){
+        cluster->nodes.push_back(entrance);
+      }
+
+      runStart = -1;
+    }
+  }
+}
+
+bool PathClusterGraph::isWalkable(int32_t x, int32_t y, int32_t z)
+{
+  if(x < 0 || y < 0){
+    return false;
+  }
+
+  bool blocked;
+  map->getWalkTile(Position(x, y, z), blocked);
+  return !blocked;
+}
+
+void PathClusterGraph::getWalkable(const Position& pos, ClusterWalkable& walkable)
+{
+  int32_t baseX = pos.x & ~PATH_CLUSTER_MASK;
+  int32_t baseY = pos.y & ~PATH_CLUSTER_MASK;
+
+  for(int32_t y = 0; y < PATH_CLUSTER_SIZE; ++y){
+    for(int32_t x = 0; x < PATH_CLUSTER_SIZE; ++x){
+      walkable[y][x] = isWalkable(baseX + x, baseY + y, pos.z);
+    }
+  }
+}
+
+void PathClusterGraph::getDistances(const Position& pos, const ClusterWalkable& walkable,
+  ClusterDistances& dist)
+{
+  for(int32_t y = 0; y < PATH_CLUSTER_SIZE; ++y){
+    for(int32_t x = 0; x < PATH_CLUSTER_SIZE; ++x){
+      dist[y][x] = PATH_CLUSTER_UNREACHABLE;
+    }
+  }
+
+  typedef std::pair<int32_t, int32_t> CellItem;
+  std::priority_queue<CellItem, std::vector<CellItem>, std::greater<CellItem> > queue;
+
+  int32_t startX = pos.x & PATH_CLUSTER_MASK;
+  int32_t startY = pos.y & PATH_CLUSTER_MASK;
+  dist[startY][startX] = 0;
+  queue.push(CellItem(0, (startY << PATH_CLUSTER_BITS) | startX));
+
+  while(!queue.empty()){
+    CellItem item = queue.top();
+    queue.pop();
+
+    int32_t x = item.second & PATH_CLUSTER_MASK;
+    int32_t y = item.second >> PATH_CLUSTER_BITS;
+    if(item.first > dist[y][x]){
+      continue;
+    }
+
+    for(int32_t i = 0; i < 8; ++i){
+      int32_t nx = x + neighbourOffsets[i][0];
+      int32_t ny = y + neighbourOffsets[i][1];
+      if(nx < 0 || ny < 0 || nx >= PATH_CLUSTER_SIZE || ny >= PATH_CLUSTER_SIZE || !walkable[ny][nx]){
+        continue;
+      }
+
+      int32_t cost = item.first + (i < 4 ? MAP_NORMALWALKCOST : MAP_DIAGONALWALKCOST);
+      if(cost < dist[ny][nx]){
+        dist[ny][nx] = cost;
+        queue.push(CellItem(cost, (ny << PATH_CLUSTER_BITS) | nx));
+      }
+    }
+  }
+}
+
+static void openRouteNode(RouteNodeMap& nodes, RouteQueue& queue, uint64_t id, uint64_t parent,
+  const Position& pos, int32_t g, int32_t h)
+{
+  RouteNodeMap::iterator it = nodes.find(id);
+  if(it != nodes.end()){
+    if(it->second.closed || it->second.g <= g){
+      return;
+    }
+  }
+  else{
+    it = nodes.insert(std::make_pair(id, RouteNode())).first;
+    it->second.closed = false;
+  }
+
+  it->second.pos = pos;
+  it->second.parent = parent;
+  it->second.g = g;
+  queue.push(RouteQueueItem(g + h, id));
+}
+
+bool PathClusterGraph::getRoute(const Position& startPos, const Position& endPos,
+  std::vector<Position>& route)
+{
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  ++routeSearches;
+#endif
+
+  route.clear();
+  if(startPos.z != endPos.z){
+    return false;
+  }
+
+  int32_t z = startPos.z;
+  uint64_t startKey = getClusterKey(startPos.x >> PATH_CLUSTER_BITS, startPos.y >> PATH_CLUSTER_BITS, z);
+  uint64_t endKey = getClusterKey(endPos.x >> PATH_CLUSTER_BITS, endPos.y >> PATH_CLUSTER_BITS, z);
+  PathCluster* startCluster = getCluster(startPos.x >> PATH_CLUSTER_BITS, startPos.y >> PATH_CLUSTER_BITS, z);
+  PathCluster* endCluster = getCluster(endPos.x >> PATH_CLUSTER_BITS, endPos.y >> PATH_CLUSTER_BITS, z);
+  if(!startCluster || !endCluster){
+    return false;
+  }
+
+  //the start and the goal are connected to the entrances of their own cluster
+  ClusterWalkable walkable;
+  ClusterDistances startDist, endDist;
+  getWalkable(startPos, walkable);
+  getDistances(startPos, walkable, startDist);
+  getWalkable(endPos, walkable);
+  getDistances(endPos, walkable, endDist);
+
+  RouteNodeMap nodes;
+  RouteQueue queue;
+  openRouteNode(nodes, queue, ROUTE_START_ID, 0, startPos, 0, getEstimatedDistance(startPos, endPos));
+
+  bool found = false;
+  int32_t expansions = 0;
+  while(!queue.empty() && expansions < PATH_CLUSTER_MAX_EXPANSIONS){
+    uint64_t id = queue.top().second;
+    queue.pop();
+
+    RouteNode& node = nodes[id];
+    if(node.closed){
+      continue;
+    }
+
+    node.closed = true;
+    ++expansions;
+
+    if(id == ROUTE_END_ID){
+      found = true;
+      break;
+    }
+
+    const Position pos = node.pos;
+    const int32_t g = node.g;
+
+    if(id == ROUTE_START_ID){
+      for(size_t i = 0; i < startCluster->nodes.size(); ++i){
+        const Position& nodePos = startCluster->nodes[i];
+        int32_t cost = startDist[nodePos.y & PATH_CLUSTER_MASK][nodePos.x & PATH_CLUSTER_MASK];
+        if(cost != PATH_CLUSTER_UNREACHABLE){
+          openRouteNode(nodes, queue, (startKey << 16) | i, id, nodePos, g + cost,
+            getEstimatedDistance(nodePos, endPos));
+        }
+      }
+
+      if(startKey == endKey){
+        int32_t cost = startDist[endPos.y & PATH_CLUSTER_MASK][endPos.x & PATH_CLUSTER_MASK];
+        if(cost != PATH_CLUSTER_UNREACHABLE){
+          openRouteNode(nodes, queue, ROUTE_END_ID, id, endPos, g + cost, 0);
+        }
+      }
+      continue;
+    }
+
+    uint64_t clusterKey = id >> 16;
+    PathCluster* cluster = getCluster(pos.x >> PATH_CLUSTER_BITS, pos.y >> PATH_CLUSTER_BITS, z);
+    const std::vector<PathClusterEdge>& edges = cluster->edges[id & 0xFFFF];
+    for(std::vector<PathClusterEdge>::const_iterator it = edges.begin(); it != edges.end(); ++it){
+      const Position& nodePos = cluster->nodes[it->to];
+      openRouteNode(nodes, queue, (clusterKey << 16) | it->to, id, nodePos, g + it->cost,
+        getEstimatedDistance(nodePos, endPos));
+    }
+
+    //step over the border onto the matching entrance of the neighbour
+    for(int32_t i = 0; i < 4; ++i){
+      int32_t nx = pos.x + neighbourOffsets[i][0];
+      int32_t ny = pos.y + neighbourOffsets[i][1];
+      if(nx < 0 || ny < 0 || ((nx ^ pos.x) | (ny ^ pos.y)) >> PATH_CLUSTER_BITS == 0){
+        continue;
+      }
+
+      PathCluster* other = getCluster(nx >> PATH_CLUSTER_BITS, ny >> PATH_CLUSTER_BITS, z);
+      if(!other){
+        continue;
+      }
+
+      Position nextPos(nx, ny, z);
+      std::vector<Position>::iterator entrance = std::find(other->nodes.begin(), other->nodes.end(), nextPos);
+      if(entrance != other->nodes.end()){
+        uint64_t otherKey = getClusterKey(nx >> PATH_CLUSTER_BITS, ny >> PATH_CLUSTER_BITS, z);
+        openRouteNode(nodes, queue, (otherKey << 16) | (entrance - other->nodes.begin()), id, nextPos,
+          g + MAP_NORMALWALKCOST, getEstimatedDistance(nextPos, endPos));
+      }
+    }
+
+    if(clusterKey == endKey){
+      int32_t cost = endDist[pos.y & PATH_CLUSTER_MASK][pos.x & PATH_CLUSTER_MASK];
+      if(cost != PATH_CLUSTER_UNREACHABLE){
+        openRouteNode(nodes, queue, ROUTE_END_ID, id, endPos, g + cost, 0);
+      }
+    }
+  }
+
+  if(!found){
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+    ++routeFailures;
+#endif
+    return false;
+  }
+
+  for(uint64_t id = ROUTE_END_ID; id != ROUTE_START_ID; id = nodes[id].parent){
+    route.push_back(nodes[id].pos);
+  }
+  std::reverse(route.begin(), route.end());
+  return true;
+}
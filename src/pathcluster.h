@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+
+#ifndef __OTSERV_PATHCLUSTER_H__
+#define __OTSERV_PATHCLUSTER_H__
+
+#include "position.h"
+#include <vector>
+#include <unordered_map>
+
+class Map;
+
+// Clusters of 16x16 tiles per floor, connected through entrances on their borders
+#define PATH_CLUSTER_BITS 4
+#define PATH_CLUSTER_SIZE (1 << PATH_CLUSTER_BITS)
+#define PATH_CLUSTER_MASK (PATH_CLUSTER_SIZE - 1)
+// Node expansions of one search on the cluster graph
+#define PATH_CLUSTER_MAX_EXPANSIONS 4096
+#define PATH_CLUSTER_UNREACHABLE 0x7FFFFFFF
+
+struct PathClusterEdge{
+  uint16_t to;
+  int32_t cost;
+};
+
+struct PathCluster{
+  PathCluster() : dirty(true) {}
+
+  // Entrance tiles of the cluster and the walking cost between them
+  std::vector<Position> nodes;
+  std::vector< std::vector<PathClusterEdge> > edges;
+  bool dirty;
+};
+
+/**
+  * Abstract graph over the static walkability of the map, used to route
+  * searches that are too long for a single A* run. Clusters are built the
+  * first time a search needs them and rebuilt after a tile on them changed.
+  */
+class PathClusterGraph{
+public:
+  PathClusterGraph(Map* map);
+  ~PathClusterGraph();
+
+  /**
+  * Get a route of entrance positions from startPos to endPos, endPos included.
+  * Walkability is the creature independent one, the route has to be refined.
+  */
+  bool getRoute(const Position& startPos, const Position& endPos, std::vector<Position>& route);
+
+  // Marks the clusters sharing a tile as stale after its walkability changed
+  void onTileChange(const Position& pos);
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+  static uint64_t clusterBuilds;
+  static uint64_t routeSearches;
+  static uint64_t routeFailures;
+#endif
+
+protected:
+  typedef std::unordered_map<uint64_t, PathCluster*> ClusterMap;
+  typedef int32_t ClusterDistances[PATH_CLUSTER_SIZE][PATH_CLUSTER_SIZE];
+  typedef bool ClusterWalkable[PATH_CLUSTER_SIZE][PATH_CLUSTER_SIZE];
+
+  Map* map;
+  ClusterMap clusters;
+
+  // Map coordinates are below 0x10000, so a cluster fits in 28 bits and
+  // a search node (cluster, entrance index) in 44
+  static uint64_t getClusterKey(int32_t cx, int32_t cy, int32_t z){
+    return ((uint64_t)(cx & 0xFFF) << 16) | ((uint64_t)(cy & 0xFFF) << 4) | (uint64_t)(z & 0xF);
+  }
+  static int32_t getEstimatedDistance(const Position& from, const Position& to);
+
+  PathCluster* getCluster(int32_t cx, int32_t cy, int32_t z);
+  void markDirty(int32_t cx, int32_t cy, int32_t z);
+  void buildCluster(PathCluster* cluster, int32_t cx, int32_t cy, int32_t z);
+  // Adds one entrance per run of open tile pairs along a border
+  void addEntrances(PathCluster* cluster, const Position& first,
+    int32_t stepX, int32_t stepY, int32_t outX, int32_t outY);
+  bool isWalkable(int32_t x, int32_t y, int32_t z);
+  void getWalkable(const Position& pos, ClusterWalkable& walkable);
+  // Walking cost from pos to every tile of its cluster, without leaving it
+  void getDistances(const Position& pos, const ClusterWalkable& walkable, ClusterDistances& dist);
+};
+
+#endif
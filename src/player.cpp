@@ -123,6 +123,8 @@ Creature()
     skills[i->value()][SKILL_LEVEL]= 10;
     skills[i->value()][SKILL_TRIES]= 0;
     skills[i->value()][SKILL_PERCENT] = 0;
+    savedSkills[i->value()][SKILL_LEVEL] = 10;
+    savedSkills[i->value()][SKILL_TRIES] = 0;
   }
 
   for(SkillType::iterator i = SkillType::begin(); i != SkillType::end(); ++i){
@@ -143,6 +145,7 @@ Creature()
 
   maxDepotLimit = 1000;
   maxVipLimit = 50;
+  vipListDirty = false;
   groupFlags = 0;
   premiumDays = 0;
 
@@ -2466,6 +2469,7 @@ bool Player::removeVIP(uint32_t _guid)
   VIPListSet::iterator it = VIPList.find(_guid);
   if(it != VIPList.end()){
     VIPList.erase(it);
+    vipListDirty = true;
     return true;
   }
   return false;
@@ -2493,6 +2497,7 @@ bool Player::addVIP(uint32_t _guid, std::string& name, bool isOnline, bool inter
   }
 
   VIPList.insert(_guid);
+  vipListDirty = true;
 
   if(client && !internal){
     client->sendVIP(_guid, name, isOnline);
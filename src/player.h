@@ -543,6 +543,8 @@ public:
 
   VIPListSet VIPList;
   uint32_t maxVipLimit;
+  // The VIP list changed since it was last saved
+  bool vipListDirty;
 
   //items
   ContainerVector containerVec;
@@ -692,6 +694,8 @@ protected:
 
   //player advances variables
   uint32_t skills[SkillType::size][3];
+  // Level and tries as last written to the database
+  uint32_t savedSkills[SkillType::size][2];
 
   //extra skill modifiers
   int32_t varSkills[SkillType::size];
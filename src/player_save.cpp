@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "player_save.h"
+#include "database_driver.h"
+
+void takePlayerChanges(PlayerSaveData& data, uint32_t savedSkills[7][2],
+  const StorageMap& storage, StorageKeySet& dirtyStorageKeys,
+  const VIPListSet& vipList, bool& vipListDirty)
+{
+  for(int32_t i = 0; i <= 6; i++){
+    data.skillChanged[i] = (data.skills[i][0] != savedSkills[i][0] ||
+      data.skills[i][1] != savedSkills[i][1]);
+
+    savedSkills[i][0] = data.skills[i][0];
+    savedSkills[i][1] = data.skills[i][1];
+  }
+
+  data.storage.clear();
+  data.erasedStorage.clear();
+  data.saveVipList = false;
+  data.vipList.clear();
+  if(data.shallow){
+    //storage and VIP list stay dirty for the next full snapshot
+    return;
+  }
+
+  if(data.fullSave){
+    data.storage.assign(storage.begin(), storage.end());
+  }
+  else{
+    for(StorageKeySet::const_iterator it = dirtyStorageKeys.begin(); it != dirtyStorageKeys.end(); ++it){
+      StorageMap::const_iterator value = storage.find(*it);
+      if(value != storage.end()){
+        data.storage.push_back(*value);
+      }
+      else{
+        data.erasedStorage.push_back(*it);
+      }
+    }
+  }
+  dirtyStorageKeys.clear();
+
+  if(data.fullSave || vipListDirty){
+    data.saveVipList = true;
+    data.vipList.assign(vipList.begin(), vipList.end());
+  }
+  vipListDirty = false;
+}
+
+bool writePlayerData(const PlayerSaveData& data)
+{
+  DatabaseDriver* db = DatabaseDriver::instance();
+  DBQuery query;
+  DBResult_ptr result;
+
+  //check if the player has to be saved or not
+  DBStatement_ptr stmt = db->prepare("SELECT `save` FROM `players` WHERE `id` = ?");
+  stmt->bindInt(0, data.guid);
+  if(!(result = stmt->query())){
+    return false;
+  }
+
+  const uint32_t save = result->getDataInt("save");
+  result.reset();
+
+  if(save == 0)
+    return true;
+
+  //First, an UPDATE query to write the player itself
+  query.reset();
+  query << "UPDATE `players` SET `level` = " << data.level
+  << ", `vocation` = " << data.vocation
+  << ", `health` = " << data.health
+  << ", `healthmax` = " << data.healthMax
+  << ", `direction` = " << data.direction
+  << ", `experience` = " << data.experience
+  << ", `lookbody` = " << data.lookBody
+  << ", `lookfeet` = " << data.lookFeet
+  << ", `lookhead` = " << data.lookHead
+  << ", `looklegs` = " << data.lookLegs
+  << ", `looktype` = " << data.lookType
+  << ", `lookaddons` = " << data.lookAddons
+  << ", `maglevel` = " << data.magLevel
+  << ", `mana` = " << data.mana
+  << ", `manamax` = " << data.manaMax
+  << ", `manaspent` = " << data.manaSpent
+  << ", `soul` = " << data.soul
+  << ", `town_id` = " << data.town
+  << ", `posx` = " << data.loginPosition.x
+  << ", `posy` = " << data.loginPosition.y
+  << ", `posz` = " << data.loginPosition.z
+  << ", `cap` = " << data.capacity
+  << ", `sex` = " << data.sex
+  << ", `conditions` = " << db->escapeBlob(data.conditions.data(), (uint32_t)data.conditions.size())
+  << ", `loss_experience` = " << data.lossExperience
+  << ", `loss_mana` = " << data.lossMana
+  << ", `loss_skills` = " << data.lossSkills
+  << ", `loss_items` = " << data.lossItems
+  << ", `loss_containers` = " << data.lossContainers
+  << ", `stamina` = " << data.stamina;
+
+#ifdef __SKULLSYSTEM__
+  query << ", `skull_type` = " << data.skullType;
+  query << ", `skull_time` = " << data.skullTime;
+#endif
+
+  query << " WHERE `id` = " << data.guid;
+
+  DBTransaction transaction(db);
+  if(!transaction.begin())
+    return false;
+
+  if(!db->executeQuery(query)){
+    return false;
+  }
+
+  //skills, only the ones that changed
+  stmt = db->prepare("UPDATE `player_skills` SET `value` = ?, `count` = ? WHERE `player_id` = ? AND `skill_id` = ?");
+  stmt->bindInt(2, data.guid);
+  for(int32_t i = 0; i <= 6; i++){
+    if(!data.fullSave && !data.skillChanged[i]){
+      continue;
+    }
+
+    stmt->bindInt(0, data.skills[i][0]);
+    stmt->bindInt(1, data.skills[i][1]);
+    stmt->bindInt(3, i);
+    if(!stmt->execute()){
+      return false;
+    }
+  }
+
+  if(data.shallow)
+    return transaction.commit();
+
+  // deletes all player-related stuff
+
+  /*
+  query << "DELETE FROM `player_items` WHERE `player_id` = " << player->getGUID();
+
+  if(!db->executeQuery(query.str())){
+    return false;
+  }
+  query.str("");
+
+  query << "DELETE FROM `player_depotitems` WHERE `player_id` = " << player->getGUID();
+
+  if(!db->executeQuery(query.str())){
+    return false;
+  }
+  query.str("");
+  */
+
+  //storage keys that changed are deleted and inserted again, which works the
+  //same on every database engine
+  if(data.fullSave || !data.storage.empty() || !data.erasedStorage.empty()){
+    query.reset();
+    query << "DELETE FROM `player_storage` WHERE `player_id` = " << data.guid;
+
+    if(!data.fullSave){
+      query << " AND `id` IN (";
+      for(std::vector< std::pair<std::string, std::string> >::const_iterator it = data.storage.begin(); it != data.storage.end(); ++it){
+        query << (it == data.storage.begin() ? "" : ",") << db->escapeString(it->first);
+      }
+      for(std::vector<std::string>::const_iterator it = data.erasedStorage.begin(); it != data.erasedStorage.end(); ++it){
+        query << (it == data.erasedStorage.begin() && data.storage.empty() ? "" : ",") << db->escapeString(*it);
+      }
+      query << ")";
+    }
+
+    if(!db->executeQuery(query)){
+      return false;
+    }
+  }
+
+  if(data.saveVipList){
+    query.reset();
+    query << "DELETE FROM `player_viplist` WHERE `player_id` = " << data.guid;
+
+    if(!db->executeQuery(query.str())){
+      return false;
+    }
+  }
+
+  // Starti inserting
+  DBInsert insert(db);
+
+  /*
+  ItemBlockList itemList;
+  Item* item;
+  for(int32_t slotId = 1; slotId <= 10; ++slotId){
+    if((item = player->inventory[slotId])){
+      itemList.push_back(itemBlock(slotId, item));
+    }
+  }
+
+  //item saving
+  stmt.setQuery("INSERT INTO `player_items` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
+  if(!(saveItems(player, itemList, stmt) && stmt.execute())){
+    return false;
+  }
+
+  itemList.clear();
+  for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it){
+    itemList.push_back(itemBlock(it->first, it->second));
+  }
+
+  //save depot items
+  stmt.setQuery("INSERT INTO `player_depotitems` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
+  if(!(saveItems(player, itemList, stmt) && stmt.execute())){
+    return false;
+  }
+  */
+
+  insert.setQuery("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES ");
+  for(std::vector< std::pair<std::string, std::string> >::const_iterator cit = data.storage.begin(); cit != data.storage.end(); ++cit){
+    query.reset();
+    query << data.guid << ", " << db->escapeString(cit->first) << ", " << db->escapeString(cit->second);
+    if(!insert.addRow(query.str())){
+      return false;
+    }
+  }
+
+  if(!insert.execute()){
+    return false;
+  }
+
+  //save vip list
+  if(data.saveVipList && !data.vipList.empty()){
+    query.reset();
+    query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << data.guid
+      << ", `id` FROM `players` WHERE `id` IN (";
+    for(std::vector<uint32_t>::const_iterator it = data.vipList.begin(); it != data.vipList.end(); ){
+      query << (*it);
+      ++it;
+      if(it != data.vipList.end()){
+        query << ",";
+      }
+      else{
+        query << ")";
+      }
+    }
+
+    if(!db->executeQuery(query)){
+      return false;
+    }
+  }
+
+  //End the transaction
+  return transaction.commit();
+}
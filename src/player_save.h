@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Player snapshots and writing them to the database
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_PLAYER_SAVE_H__
+#define __OTSERV_PLAYER_SAVE_H__
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+#include "position.h"
+
+typedef std::map<std::string, std::string> StorageMap;
+typedef std::set<std::string> StorageKeySet;
+typedef std::set<uint32_t> VIPListSet;
+
+/** Everything savePlayer writes, copied out of the player on the game thread
+  * so it can be written from any thread. Unless fullSave is set, only what
+  * changed since the previous snapshot is written.
+  */
+struct PlayerSaveData{
+  uint32_t guid;
+  std::string name;
+  bool shallow;
+  bool fullSave;
+
+  uint32_t level;
+  int32_t vocation;
+  int32_t health, healthMax;
+  int32_t direction;
+  uint64_t experience;
+  int32_t lookBody, lookFeet, lookHead, lookLegs, lookType, lookAddons;
+  uint32_t magLevel;
+  int32_t mana, manaMax;
+  uint32_t manaSpent;
+  int32_t soul;
+  uint32_t town;
+  Position loginPosition;
+  double capacity;
+  int32_t sex;
+  std::string conditions;
+  int32_t lossExperience, lossMana, lossSkills, lossItems, lossContainers;
+  int32_t stamina;
+  int32_t skullType;
+  int64_t skullTime;
+
+  uint32_t skills[7][2];
+  bool skillChanged[7];
+  // Storage keys to (re)write and to erase
+  std::vector< std::pair<std::string, std::string> > storage;
+  std::vector<std::string> erasedStorage;
+  bool saveVipList;
+  std::vector<uint32_t> vipList;
+};
+
+/** Fill in the rows of a snapshot that are only written when they changed,
+  * data.skills has to be set already. The skills are compared to savedSkills,
+  * unless the snapshot is shallow the dirty storage keys and the VIP list are
+  * taken too. Whatever is taken counts as saved from then on.
+  */
+void takePlayerChanges(PlayerSaveData& data, uint32_t savedSkills[7][2],
+  const StorageMap& storage, StorageKeySet& dirtyStorageKeys,
+  const VIPListSet& vipList, bool& vipListDirty);
+
+/** Write a snapshot in one transaction on the connection of this thread.
+  * Callers go through DatabaseWriter::savePlayerData, which orders the writes.
+  */
+bool writePlayerData(const PlayerSaveData& data);
+
+#endif
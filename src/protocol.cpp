@@ -28,6 +28,7 @@
 #include "outputmessage.h"
 #include "rsa.h"
 #include "connection.h"
+#include "xtea.h"
 
 extern RSA g_RSA;
 
@@ -55,6 +56,7 @@ void Protocol::onSendMessage(OutputMessage_ptr msg)
 
   if(msg == m_outputBuffer){
     m_outputBuffer.reset();
+    OutputMessagePool::getInstance()->removeAutoSend(this);
   }
 }
 
@@ -80,7 +82,13 @@ OutputMessage_ptr Protocol::getOutputBuffer()
     return m_outputBuffer;
   }
   else if(m_connection){
-    m_outputBuffer = OutputMessagePool::getInstance()->getOutputMessage(this);
+    OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+    if(m_outputBuffer){
+      //the current buffer is full, it has to go out before the new one
+      outputPool->flushAutoSend(this, OUTPUT_FLUSH_REASON_FULL);
+    }
+
+    m_outputBuffer = outputPool->getOutputMessage(this);
     return m_outputBuffer;
   }
   else{
@@ -88,6 +96,25 @@ OutputMessage_ptr Protocol::getOutputBuffer()
   }
 }
 
+void Protocol::onPingSent()
+{
+  int64_t expected = 0;
+  // Keep the oldest unanswered ping, the answer belongs to it
+  m_pingSentTime.compare_exchange_strong(expected, OTSYS_TIME());
+}
+
+void Protocol::onPingReceived()
+{
+  int64_t sentTime = m_pingSentTime.exchange(0);
+  if(sentTime == 0){
+    return;
+  }
+
+  uint32_t sample = (uint32_t)std::max<int64_t>(0, OTSYS_TIME() - sentTime);
+  uint32_t rtt = m_roundTripTime;
+  m_roundTripTime = (rtt == 0 ? sample : (rtt * 7 + sample) / 8);
+}
+
 void Protocol::releaseProtocol()
 {
   if(m_refCount > 0){
@@ -104,6 +131,7 @@ void Protocol::deleteProtocolTask()
 {
   //dispather thread
   assert(m_refCount == 0);
+  OutputMessagePool::getInstance()->removeAutoSend(this);
   setConnection(Connection_ptr());
 
   delete this;
@@ -124,21 +152,7 @@ void Protocol::XTEA_encrypt(OutputMessage& msg)
     messageLength = messageLength + n;
   }
 
-  int read_pos = 0;
-  uint32_t* buffer = (uint32_t*)msg.getOutputBuffer();
-  while(read_pos < messageLength/4){
-    uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-    uint32_t delta = 0x61C88647;
-    uint32_t sum = 0;
-
-    for(int32_t i = 0; i < 32; i++) {
-      v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-      sum -= delta;
-      v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
-    }
-    buffer[read_pos] = v0; buffer[read_pos + 1] = v1;
-    read_pos = read_pos + 2;
-  }
+  xteaEncrypt((uint32_t*)msg.getOutputBuffer(), messageLength / 8, k);
 }
 
 bool Protocol::XTEA_decrypt(NetworkMessage& msg)
@@ -154,22 +168,7 @@ bool Protocol::XTEA_decrypt(NetworkMessage& msg)
   uint32_t k[4];
   k[0] = m_key[0]; k[1] = m_key[1]; k[2] = m_key[2]; k[3] = m_key[3];
 
-  uint32_t* buffer = (uint32_t*)(msg.getBuffer() + msg.getReadPos());
-  int read_pos = 0;
-  int32_t messageLength = msg.getMessageLength() - 6;
-  while(read_pos < messageLength/4){
-    uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-    uint32_t delta = 0x61C88647;
-    uint32_t sum = 0xC6EF3720;
-
-    for(int32_t i = 0; i < 32; i++) {
-      v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
-      sum += delta;
-      v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-    }
-    buffer[read_pos] = v0; buffer[read_pos + 1] = v1;
-    read_pos = read_pos + 2;
-  }
+  xteaDecrypt((uint32_t*)(msg.getBuffer() + msg.getReadPos()), (msg.getMessageLength() - 6) / 8, k);
   //
 
   int tmp = msg.GetU16();
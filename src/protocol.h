@@ -23,6 +23,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
 #include <stdint.h>
 #include "protocolconst.h"
 
@@ -45,6 +46,11 @@ public:
     m_rawMessages = false;
     m_key[0] = 0; m_key[1] = 0; m_key[2] = 0; m_key[3] = 0;
     m_refCount = 0;
+    m_prevAutoSend = NULL;
+    m_nextAutoSend = NULL;
+    m_autoSendLinked = false;
+    m_pingSentTime = 0;
+    m_roundTripTime = 0;
   }
 
   virtual ~Protocol() {}
@@ -64,6 +70,9 @@ public:
   int32_t addRef() {return ++m_refCount;}
   int32_t unRef() {return --m_refCount;}
 
+  // Smoothed ping round trip in milliseconds, 0 until the first answer
+  uint32_t getRoundTripTime() const { return m_roundTripTime; }
+
 protected:
   //Use this function for autosend messages only
   OutputMessage_ptr getOutputBuffer();
@@ -83,18 +92,30 @@ protected:
 
   void setRawMessages(bool value) { m_rawMessages = value; }
 
+  void onPingSent();
+  void onPingReceived();
+
   virtual void releaseProtocol();
   virtual void deleteProtocolTask();
   friend class Connection;
+  friend class OutputMessagePool;
 private:
 
   OutputMessage_ptr m_outputBuffer;
+  // Link in the output pool list of protocols with a pending auto send message
+  Protocol* m_prevAutoSend;
+  Protocol* m_nextAutoSend;
+  bool m_autoSendLinked;
   Connection_ptr m_connection;
   bool m_encryptionEnabled;
   bool m_checksumEnabled;
   bool m_rawMessages;
   uint32_t m_key[4];
   uint32_t m_refCount;
+
+  // Ping is sent from the dispatcher and answered on the network thread
+  boost::atomic<int64_t> m_pingSentTime;
+  boost::atomic<uint32_t> m_roundTripTime;
 };
 
 #endif
@@ -42,7 +42,7 @@ extern BanManager g_bans;
 Chat g_chat;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t ProtocolGame::protocolGameCount = 0;
+boost::atomic<uint32_t> ProtocolGame::protocolGameCount(0);
 #endif
 
 // Helping templates to add dispatcher tasks
@@ -961,6 +961,7 @@ void ProtocolGame::parseDebug(NetworkMessage& msg)
 
 void ProtocolGame::parseReceivePing(NetworkMessage& msg)
 {
+  onPingReceived();
   g_dispatcher.addTask(
     createTask(boost::bind(&Game::playerReceivePing, &g_game, player->getID())));
 }
@@ -1890,6 +1891,7 @@ void ProtocolGame::sendPing()
   if(msg){
     TRACK_MESSAGE(msg);
     msg->AddByte(0x1E);
+    onPingSent();
   }
 }
 
@@ -40,7 +40,7 @@ public:
   static const char* protocol_name() {return "gameworld protocol";}
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-  static uint32_t protocolGameCount;
+  static boost::atomic<uint32_t> protocolGameCount;
 #endif
 
   ProtocolGame(Connection_ptr connection);
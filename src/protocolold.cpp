@@ -27,7 +27,7 @@
 extern Game g_game;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t ProtocolOld::protocolOldCount = 0;
+boost::atomic<uint32_t> ProtocolOld::protocolOldCount(0);
 #endif
 
 #ifdef __DEBUG_NET_DETAIL__
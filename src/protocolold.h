@@ -35,7 +35,7 @@ public:
   enum {use_checksum = false};
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-  static uint32_t protocolOldCount;
+  static boost::atomic<uint32_t> protocolOldCount;
 #endif
 
   ProtocolOld(Connection_ptr connection);
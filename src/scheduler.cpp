@@ -28,7 +28,11 @@
 Scheduler::Scheduler()
 {
   m_lastEventId = 0;
+  m_currentTick = 0;
+  m_firedEvents = 0;
+  m_cancelledEvents = 0;
   m_threadState = STATE_TERMINATED;
+  memset(m_wheel, 0, sizeof(m_wheel));
 }
 
 void Scheduler::shutdownAndWait()
@@ -40,6 +44,8 @@ void Scheduler::shutdownAndWait()
 void Scheduler::start()
 {
   assert(m_threadState == STATE_TERMINATED);
+  m_startTime = boost::get_system_time();
+  m_currentTick = 0;
   m_threadState = STATE_RUNNING;
   m_thread = boost::thread(boost::bind(&Scheduler::schedulerThread, (void*)this));
 }
@@ -55,18 +61,16 @@ void Scheduler::schedulerThread(void* p)
   std::cout << "Starting Scheduler" << std::endl;
   #endif
 
+  std::vector<SchedulerTask*> expired;
+
   // NOTE: second argument defer_lock is to prevent from immediate locking
   boost::unique_lock<boost::mutex> eventLockUnique(scheduler->m_eventLock, boost::defer_lock);
 
   while(scheduler->m_threadState != STATE_TERMINATED){
-    SchedulerTask* task = NULL;
-    bool runTask = false;
-    bool ret = true;
-
     // check if there are events waiting...
     eventLockUnique.lock();
 
-    if(scheduler->m_eventList.empty()){
+    if(scheduler->m_events.empty()){
       #ifdef __DEBUG_SCHEDULER__
       std::cout << "Scheduler: No events" << std::endl;
       #endif
@@ -74,9 +78,9 @@ void Scheduler::schedulerThread(void* p)
     }
     else{
       #ifdef __DEBUG_SCHEDULER__
-      std::cout << "Scheduler: Waiting for event" << std::endl;
+      std::cout << "Scheduler: Waiting for next tick" << std::endl;
       #endif
-      ret = scheduler->m_eventSignal.timed_wait(eventLockUnique, scheduler->m_eventList.top()->getCycle());
+      scheduler->m_eventSignal.timed_wait(eventLockUnique, scheduler->getTickTime(scheduler->m_currentTick + 1));
     }
 
     #ifdef __DEBUG_SCHEDULER__
@@ -84,78 +88,193 @@ void Scheduler::schedulerThread(void* p)
     #endif
 
     // the mutex is locked again now...
-    if(ret == false && (scheduler->m_threadState != STATE_TERMINATED)){
-      // ok we had a timeout, so there has to be an event we have to execute...
-      task = scheduler->m_eventList.top();
-      scheduler->m_eventList.pop();
-
-      // check if the event was stopped
-      EventIdSet::iterator it = scheduler->m_eventIds.find(task->getEventId());
-      if(it != scheduler->m_eventIds.end()){
-        // was not stopped so we should run it
-        runTask = true;
-        scheduler->m_eventIds.erase(it);
-      }
+    if(scheduler->m_threadState != STATE_TERMINATED){
+      scheduler->advance(expired);
     }
 
     eventLockUnique.unlock();
 
-    // add task to dispatcher
-    if(task){
-      // if it was not stopped
-      if(runTask){
-        // Expiration has another meaning for dispatcher tasks, reset it
-        task->setDontExpire();
-        #ifdef __DEBUG_SCHEDULER__
-        std::cout << "Scheduler: Executing event " << task->getEventId() << std::endl;
-        #endif
-        g_dispatcher.addTask(task);
-      }
-      else{
-        // was stopped, have to be deleted here
-        delete task;
-      }
+    // add the expired tasks to the dispatcher
+    for(std::vector<SchedulerTask*>::iterator it = expired.begin(); it != expired.end(); ++it){
+      SchedulerTask* task = *it;
+      // Expiration has another meaning for dispatcher tasks, reset it
+      task->setDontExpire();
+      #ifdef __DEBUG_SCHEDULER__
+      std::cout << "Scheduler: Executing event " << task->getEventId() << std::endl;
+      #endif
+      g_dispatcher.addTask(task);
     }
+    expired.clear();
   }
 #if defined __EXCEPTION_TRACER__
   schedulerExceptionHandler.RemoveHandler();
 #endif
 }
 
+uint64_t Scheduler::getTick(const boost::system_time& time) const
+{
+  int64_t ms = (time - m_startTime).total_milliseconds();
+  if(ms <= 0){
+    return 0;
+  }
+  return (uint64_t)ms / SCHEDULER_MINTICKS;
+}
+
+boost::system_time Scheduler::getTickTime(uint64_t tick) const
+{
+  return m_startTime + boost::posix_time::milliseconds(tick * SCHEDULER_MINTICKS);
+}
+
+void Scheduler::linkTask(SchedulerTask* task)
+{
+  // Find the level whose range covers the distance to the event
+  uint64_t tick = task->m_tick;
+  uint64_t delta = tick - m_currentTick;
+  uint32_t level = 0;
+  while(level < SCHEDULER_WHEEL_LEVELS - 1 && delta >= (uint64_t(1) << ((level + 1) * SCHEDULER_WHEEL_BITS))){
+    ++level;
+  }
+
+  if(delta >= (uint64_t(1) << (SCHEDULER_WHEEL_LEVELS * SCHEDULER_WHEEL_BITS))){
+    // Beyond the wheel, park it in the last slot, it is re-placed on cascade
+    tick = m_currentTick + (uint64_t(1) << (SCHEDULER_WHEEL_LEVELS * SCHEDULER_WHEEL_BITS)) - 1;
+  }
+
+  SchedulerSlot* slot = &m_wheel[level][(tick >> (level * SCHEDULER_WHEEL_BITS)) & SCHEDULER_WHEEL_MASK];
+  task->m_slot = slot;
+  task->m_prevInSlot = slot->last;
+  task->m_nextInSlot = NULL;
+  if(slot->last){
+    slot->last->m_nextInSlot = task;
+  }
+  else{
+    slot->first = task;
+  }
+  slot->last = task;
+}
+
+void Scheduler::unlinkTask(SchedulerTask* task)
+{
+  if(task->m_prevInSlot){
+    task->m_prevInSlot->m_nextInSlot = task->m_nextInSlot;
+  }
+  else{
+    task->m_slot->first = task->m_nextInSlot;
+  }
+
+  if(task->m_nextInSlot){
+    task->m_nextInSlot->m_prevInSlot = task->m_prevInSlot;
+  }
+  else{
+    task->m_slot->last = task->m_prevInSlot;
+  }
+
+  task->m_slot = NULL;
+  task->m_prevInSlot = NULL;
+  task->m_nextInSlot = NULL;
+}
+
+uint32_t Scheduler::cascade(uint32_t level)
+{
+  // Move every event of the current slot of this level to the lower levels
+  uint32_t index = (m_currentTick >> (level * SCHEDULER_WHEEL_BITS)) & SCHEDULER_WHEEL_MASK;
+  SchedulerTask* task = m_wheel[level][index].first;
+  m_wheel[level][index].first = m_wheel[level][index].last = NULL;
+
+  while(task){
+    SchedulerTask* next = task->m_nextInSlot;
+    linkTask(task);
+    task = next;
+  }
+
+  return index;
+}
+
+void Scheduler::advance(std::vector<SchedulerTask*>& expired)
+{
+  uint64_t now = getTick(boost::get_system_time());
+  if(m_events.empty()){
+    // Nothing to expire, skip the idle ticks
+    m_currentTick = std::max(m_currentTick, now);
+    return;
+  }
+
+  while(m_currentTick < now){
+    ++m_currentTick;
+
+    uint32_t index = m_currentTick & SCHEDULER_WHEEL_MASK;
+    if(index == 0){
+      for(uint32_t level = 1; level < SCHEDULER_WHEEL_LEVELS; ++level){
+        if(cascade(level) != 0){
+          break;
+        }
+      }
+    }
+
+    SchedulerTask* task = m_wheel[0][index].first;
+    m_wheel[0][index].first = m_wheel[0][index].last = NULL;
+
+    while(task){
+      SchedulerTask* next = task->m_nextInSlot;
+      task->m_slot = NULL;
+      task->m_prevInSlot = NULL;
+      task->m_nextInSlot = NULL;
+
+      m_events.erase(task->getEventId());
+      expired.push_back(task);
+      ++m_firedEvents;
+
+      task = next;
+    }
+  }
+}
+
 uint32_t Scheduler::addEvent(SchedulerTask* task)
 {
   bool do_signal = false;
+  uint32_t eventId = 0;
   m_eventLock.lock();
   if(Scheduler::m_threadState == Scheduler::STATE_RUNNING){
 
     // check if the event has a valid id
     if(task->getEventId() == 0){
-      // if not generate one
-      if(m_lastEventId >= 0xFFFFFFFF){
-        m_lastEventId = 0;
-      }
-      ++m_lastEventId;
+      // if not generate one, skipping ids that are still in use
+      do{
+        if(m_lastEventId >= 0xFFFFFFFF){
+          m_lastEventId = 0;
+        }
+        ++m_lastEventId;
+      } while(m_events.find(m_lastEventId) != m_events.end());
       task->setEventId(m_lastEventId);
     }
-    // insert the eventid in the list of active events
-    m_eventIds.insert(task->getEventId());
+    eventId = task->getEventId();
 
-    // add the event to the queue
-    m_eventList.push(task);
+    if(m_events.empty()){
+      // the scheduler thread may have been idle for a while
+      m_currentTick = std::max(m_currentTick, getTick(boost::get_system_time()));
+      do_signal = true;
+    }
 
-    // if the list was empty or this event is the top in the list
-    // we have to signal it
-    do_signal = (task == m_eventList.top());
+    // round up, an event never fires before its cycle
+    int64_t ms = (task->getCycle() - m_startTime).total_milliseconds();
+    task->m_tick = (ms <= 0 ? 0 : ((uint64_t)ms + SCHEDULER_MINTICKS - 1) / SCHEDULER_MINTICKS);
+    if(task->m_tick <= m_currentTick){
+      task->m_tick = m_currentTick + 1;
+    }
+
+    m_events[eventId] = task;
+    linkTask(task);
 
 #ifdef __DEBUG_SCHEDULER__
-    std::cout << "Scheduler: Added event " << task->getEventId() << std::endl;
+    std::cout << "Scheduler: Added event " << eventId << std::endl;
 #endif
   }
-#ifdef __DEBUG_SCHEDULER__
   else{
+#ifdef __DEBUG_SCHEDULER__
     std::cout << "Error: [Scheduler::addTask] Scheduler thread is terminated." << std::endl;
-  }
 #endif
+    delete task;
+  }
 
   m_eventLock.unlock();
 
@@ -163,7 +282,7 @@ uint32_t Scheduler::addEvent(SchedulerTask* task)
     m_eventSignal.notify_one();
   }
 
-  return task->getEventId();
+  return eventId;
 }
 
 
@@ -179,11 +298,16 @@ bool Scheduler::stopEvent(uint32_t eventid)
   m_eventLock.lock();
 
   // search the event id..
-  EventIdSet::iterator it = m_eventIds.find(eventid);
-  if(it != m_eventIds.end()) {
-    // if it is found erase from the list
-    m_eventIds.erase(it);
+  EventMap::iterator it = m_events.find(eventid);
+  if(it != m_events.end()){
+    // if it is found take it out of the wheel
+    SchedulerTask* task = it->second;
+    unlinkTask(task);
+    m_events.erase(it);
+    ++m_cancelledEvents;
     m_eventLock.unlock();
+
+    delete task;
     return true;
   }
   else{
@@ -193,6 +317,24 @@ bool Scheduler::stopEvent(uint32_t eventid)
   }
 }
 
+uint32_t Scheduler::getPendingEvents()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_eventLock);
+  return (uint32_t)m_events.size();
+}
+
+uint64_t Scheduler::getFiredEvents()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_eventLock);
+  return m_firedEvents;
+}
+
+uint64_t Scheduler::getCancelledEvents()
+{
+  boost::lock_guard<boost::mutex> lockClass(m_eventLock);
+  return m_cancelledEvents;
+}
+
 void Scheduler::stop()
 {
   #ifdef __DEBUG_SCHEDULER__
@@ -212,10 +354,12 @@ void Scheduler::shutdown()
   m_threadState = Scheduler::STATE_TERMINATED;
 
   //this list should already be empty
-  while(!m_eventList.empty()){
-    m_eventList.pop();
+  for(EventMap::iterator it = m_events.begin(); it != m_events.end(); ++it){
+    delete it->second;
   }
-  m_eventIds.clear();
+  m_events.clear();
+  memset(m_wheel, 0, sizeof(m_wheel));
   m_eventLock.unlock();
-}
 
+  m_eventSignal.notify_one();
+}
@@ -23,11 +23,29 @@
 
 #include "tasks.h"
 #include "otsystem.h"
-#include <queue>
-#include <set>
+#include <unordered_map>
+#include <vector>
 
 #define SCHEDULER_MINTICKS 20
 
+// The scheduler is a hierarchical timing wheel, every level has
+// SCHEDULER_WHEEL_SIZE slots and each slot of a level covers a whole
+// turn of the level below it. A tick is SCHEDULER_MINTICKS ms, so four
+// levels of 64 slots cover about 93 hours, events further away are
+// parked in the top level and re-placed when it cascades.
+#define SCHEDULER_WHEEL_BITS 6
+#define SCHEDULER_WHEEL_SIZE (1 << SCHEDULER_WHEEL_BITS)
+#define SCHEDULER_WHEEL_MASK (SCHEDULER_WHEEL_SIZE - 1)
+#define SCHEDULER_WHEEL_LEVELS 4
+
+class SchedulerTask;
+
+// Events of a slot run in the order they were scheduled
+struct SchedulerSlot {
+  SchedulerTask* first;
+  SchedulerTask* last;
+};
+
 class SchedulerTask : public Task
 {
 public:
@@ -38,23 +56,32 @@ public:
 
   boost::system_time getCycle() const {return m_expiration;}
 
-  bool operator<(const SchedulerTask& other) const
-  {
-    return getCycle() > other.getCycle();
-  }
-
 protected:
 
-  SchedulerTask(uint32_t delay, const boost::function<void (void)>& f) : Task(delay, f) {
+  template<typename FunctionType>
+  SchedulerTask(uint32_t delay, const FunctionType& f) : Task(delay, f) {
     m_eventid = 0;
+    m_tick = 0;
+    m_slot = NULL;
+    m_prevInSlot = NULL;
+    m_nextInSlot = NULL;
   }
 
   uint32_t m_eventid;
 
-  friend SchedulerTask* createSchedulerTask(uint32_t, const boost::function<void (void)>&);
+  // Timing wheel bookkeeping, only touched by the Scheduler under its lock
+  uint64_t m_tick;
+  SchedulerSlot* m_slot;
+  SchedulerTask* m_prevInSlot;
+  SchedulerTask* m_nextInSlot;
+
+  friend class Scheduler;
+  template<typename FunctionType>
+  friend SchedulerTask* createSchedulerTask(uint32_t, const FunctionType&);
 };
 
-inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<void (void)>& f)
+template<typename FunctionType>
+inline SchedulerTask* createSchedulerTask(uint32_t delay, const FunctionType& f)
 {
   assert(delay != 0);
   if(delay < SCHEDULER_MINTICKS){
@@ -63,15 +90,6 @@ inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<
   return new SchedulerTask(delay, f);
 }
 
-class lessSchedTask : public std::binary_function<SchedulerTask*&, SchedulerTask*&, bool>
-{
-public:
-  bool operator()(SchedulerTask*& t1, SchedulerTask*& t2)
-  {
-    return (*t1) < (*t2);
-  }
-};
-
 class Scheduler
 {
 public:
@@ -86,6 +104,11 @@ public:
   void shutdown();
   void shutdownAndWait();
 
+  // Statistics
+  uint32_t getPendingEvents();
+  uint64_t getFiredEvents();
+  uint64_t getCancelledEvents();
+
   enum SchedulerState{
     STATE_RUNNING,
     STATE_CLOSING,
@@ -95,14 +118,29 @@ public:
 protected:
   static void schedulerThread(void* p);
 
+  uint64_t getTick(const boost::system_time& time) const;
+  boost::system_time getTickTime(uint64_t tick) const;
+
+  void linkTask(SchedulerTask* task);
+  void unlinkTask(SchedulerTask* task);
+  uint32_t cascade(uint32_t level);
+  void advance(std::vector<SchedulerTask*>& expired);
+
   boost::thread m_thread;
   boost::mutex m_eventLock;
   boost::condition_variable m_eventSignal;
 
   uint32_t m_lastEventId;
-  std::priority_queue<SchedulerTask*, std::vector<SchedulerTask*>, lessSchedTask > m_eventList;
-  typedef std::set<uint32_t> EventIdSet;
-  EventIdSet m_eventIds;
+  typedef std::unordered_map<uint32_t, SchedulerTask*> EventMap;
+  EventMap m_events;
+
+  boost::system_time m_startTime;
+  // Last tick that has been processed
+  uint64_t m_currentTick;
+  SchedulerSlot m_wheel[SCHEDULER_WHEEL_LEVELS][SCHEDULER_WHEEL_SIZE];
+
+  uint64_t m_firedEvents;
+  uint64_t m_cancelledEvents;
   SchedulerState m_threadState;
 };
 
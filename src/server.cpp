@@ -39,7 +39,7 @@ bool ServicePort::m_logError = true;
 // Service
 
 ServiceManager::ServiceManager()
-  : m_io_service(), death_timer(m_io_service), running(false)
+  : m_io_service(), death_timer(m_io_service), running(false), m_nextWorker(0)
 {
 }
 
@@ -60,8 +60,51 @@ std::list<uint16_t> ServiceManager::get_ports() const
   return ports;
 }
 
+void ServiceManager::setNetworkThreads(uint32_t threads)
+{
+  assert(m_workers.empty());
+  if(threads <= 1){
+    // Single reactor, connections share the acceptor io_service
+    return;
+  }
+
+  for(uint32_t i = 0; i < threads; ++i){
+    IOService_ptr io_service(new boost::asio::io_service(1));
+    m_workersWork.push_back(IOServiceWork_ptr(new boost::asio::io_service::work(*io_service)));
+    m_workers.push_back(io_service);
+    m_workerThreads.create_thread(boost::bind(&ServiceManager::runWorker, io_service));
+  }
+}
+
+void ServiceManager::runWorker(IOService_ptr io_service)
+{
+  try{
+    io_service->run();
+  }
+  catch(boost::system::system_error& e){
+    LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+  }
+}
+
+boost::asio::io_service& ServiceManager::get_io_service()
+{
+  if(m_workers.empty()){
+    return m_io_service;
+  }
+
+  // Only called from the acceptor thread
+  boost::asio::io_service& io_service = *m_workers[m_nextWorker];
+  m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+  return io_service;
+}
+
 void ServiceManager::die()
 {
+  m_workersWork.clear();
+  for(std::vector<IOService_ptr>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+    (*it)->stop();
+  }
+
   m_io_service.stop();
 }
 
@@ -75,6 +118,8 @@ void ServiceManager::run()
   catch(boost::system::system_error& e){
     LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
   }
+
+  m_workerThreads.join_all();
 }
 
 void ServiceManager::stop()
@@ -106,8 +151,9 @@ void ServiceManager::stop()
 ///////////////////////////////////////////////////////////////////////////////
 // ServicePort
 
-ServicePort::ServicePort(boost::asio::io_service& io_service) :
+ServicePort::ServicePort(boost::asio::io_service& io_service, ServiceManager* service_manager) :
   m_io_service(io_service),
+  m_service_manager(service_manager),
   m_serverPort(0),
   m_pendingStart(false)
 {
@@ -138,10 +184,12 @@ std::string ServicePort::get_protocol_names() const
 void ServicePort::accept(Acceptor_ptr acceptor)
 {
   try{
-    boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(m_io_service);
+    // The socket (and thereby the connection) lives on one of the reactor io_services
+    boost::asio::io_service& io_service = m_service_manager->get_io_service();
+    boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(io_service);
 
     acceptor->async_accept(*socket,
-      boost::bind(&ServicePort::onAccept, this, acceptor, socket,
+      boost::bind(&ServicePort::onAccept, this, acceptor, socket, boost::ref(io_service),
       boost::asio::placeholders::error));
   }
   catch(boost::system::system_error& e){
@@ -152,7 +200,8 @@ void ServicePort::accept(Acceptor_ptr acceptor)
   }
 }
 
-void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error)
+void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket,
+  boost::asio::io_service& io_service, const boost::system::error_code& error)
 {
   if(!error){
     if(m_services.empty()){
@@ -171,7 +220,7 @@ void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket*
 
     if(remote_ip != 0 && g_bans.acceptConnection(remote_ip)){
 
-      Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, m_io_service, shared_from_this());
+      Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, io_service, shared_from_this());
 
       if(m_services.front()->is_single_socket()){
         // Only one handler, and it will send first
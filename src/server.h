@@ -26,10 +26,13 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/address.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
 #include "classes.h"
 
 class ServiceBase;
 class ServicePort;
+class ServiceManager;
 typedef boost::shared_ptr<ServiceBase> Service_ptr;
 typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> Acceptor_ptr;
 typedef boost::shared_ptr<ServicePort> ServicePort_ptr;
@@ -74,7 +77,7 @@ public:
 class ServicePort : boost::noncopyable, public boost::enable_shared_from_this<ServicePort>
 {
 public:
-  ServicePort(boost::asio::io_service& io_service);
+  ServicePort(boost::asio::io_service& io_service, ServiceManager* service_manager);
   ~ServicePort();
 
   static void openAcceptor(boost::weak_ptr<ServicePort> weak_service, IPAddress ip, uint16_t port);
@@ -87,12 +90,14 @@ public:
   Protocol* make_protocol(bool checksummed, NetworkMessage& msg) const;
 
   void onStopServer();
-  void onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error);
+  void onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket,
+    boost::asio::io_service& io_service, const boost::system::error_code& error);
 
 protected:
   void accept(Acceptor_ptr acceptor);
 
   boost::asio::io_service& m_io_service;
+  ServiceManager* m_service_manager;
   std::vector<Acceptor_ptr> m_tcp_acceptors;
   std::vector<Service_ptr> m_services;
 
@@ -121,14 +126,32 @@ public:
 
   bool is_running() const {return m_acceptors.empty() == false;}
   std::list<uint16_t> get_ports() const;
+
+  // Starts the network reactor pool, every worker thread runs its own
+  // io_service. With one thread (the default) everything stays on the
+  // acceptor io_service.
+  void setNetworkThreads(uint32_t threads);
+  uint32_t getNetworkThreads() const {return (uint32_t)m_workers.size();}
+
+  // io_service the next accepted connection is pinned to (round-robin)
+  boost::asio::io_service& get_io_service();
 protected:
+  typedef boost::shared_ptr<boost::asio::io_service> IOService_ptr;
+  typedef boost::shared_ptr<boost::asio::io_service::work> IOServiceWork_ptr;
+
   void die();
+  static void runWorker(IOService_ptr io_service);
 
   std::map<uint16_t, ServicePort_ptr> m_acceptors;
 
   boost::asio::io_service m_io_service;
   boost::asio::deadline_timer death_timer;
   bool running;
+
+  std::vector<IOService_ptr> m_workers;
+  std::vector<IOServiceWork_ptr> m_workersWork;
+  boost::thread_group m_workerThreads;
+  uint32_t m_nextWorker;
 };
 
 template <typename ProtocolType>
@@ -144,7 +167,7 @@ bool ServiceManager::add(uint16_t port, IPAddressList ips)
     m_acceptors.find(port);
 
   if(finder == m_acceptors.end()){
-    service_port.reset(new ServicePort(m_io_service));
+    service_port.reset(new ServicePort(m_io_service, this));
     service_port->open(ips, port);
     m_acceptors[port] = service_port;
   }
@@ -47,9 +47,10 @@ enum RequestedInfo_t{
 };
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t ProtocolStatus::protocolStatusCount = 0;
+boost::atomic<uint32_t> ProtocolStatus::protocolStatusCount(0);
 #endif
 std::map<uint32_t, int64_t> ProtocolStatus::ipConnectMap;
+boost::mutex ProtocolStatus::ipConnectLock;
 
 ProtocolStatus::ProtocolStatus(Connection_ptr connection)
   : Protocol(connection)
@@ -68,15 +69,19 @@ ProtocolStatus::~ProtocolStatus()
 
 void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 {
-  std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(getIP());
-  if(it != ipConnectMap.end()){
-    if(OTSYS_TIME() < it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)){
-      getConnection()->closeConnection();
-      return;
+  {
+    boost::mutex::scoped_lock lockClass(ipConnectLock);
+    std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(getIP());
+    if(it != ipConnectMap.end()){
+      if(OTSYS_TIME() < it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)){
+        lockClass.unlock();
+        getConnection()->closeConnection();
+        return;
+      }
     }
-  }
 
-  ipConnectMap[getIP()] = OTSYS_TIME();
+    ipConnectMap[getIP()] = OTSYS_TIME();
+  }
 
   switch(msg.GetByte()){
   //XML info protocol
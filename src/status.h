@@ -25,6 +25,7 @@
 #include <map>
 #include <stdint.h>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include "protocol.h"
 
 class ProtocolStatus : public Protocol
@@ -36,7 +37,7 @@ public:
   enum {use_checksum = false};
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-  static uint32_t protocolStatusCount;
+  static boost::atomic<uint32_t> protocolStatusCount;
 #endif
 
   ProtocolStatus(Connection_ptr connection);
@@ -48,6 +49,8 @@ public:
 
 protected:
   static std::map<uint32_t, int64_t> ipConnectMap;
+  // Status requests are read by every network thread
+  static boost::mutex ipConnectLock;
 
   #ifdef __DEBUG_NET_DETAIL__
   virtual void deleteProtocolTask();
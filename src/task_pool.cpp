@@ -0,0 +1,132 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "tasks.h"
+#include "scheduler.h"
+
+namespace {
+  struct TaskPoolBlock{
+    TaskPoolBlock* next;
+  };
+
+  // Large enough for any task type, SchedulerTask is the biggest one
+  const size_t TASK_POOL_BLOCK_SIZE = (sizeof(SchedulerTask) + 15) & ~size_t(15);
+  // Free blocks kept by every thread before half of them are shared
+  const uint32_t TASK_POOL_CACHE_SIZE = 512;
+
+  struct TaskPoolList{
+    TaskPoolList() : head(NULL), count(0) {}
+
+    void push(TaskPoolBlock* block){
+      block->next = head;
+      head = block;
+      ++count;
+    }
+
+    TaskPoolBlock* pop(){
+      TaskPoolBlock* block = head;
+      head = block->next;
+      --count;
+      return block;
+    }
+
+    // Moves up to n blocks to another list
+    void transfer(TaskPoolList& to, uint32_t n){
+      while(head && n-- > 0){
+        to.push(pop());
+      }
+    }
+
+    TaskPoolBlock* head;
+    uint32_t count;
+  };
+
+  struct TaskPoolShared{
+    boost::mutex lock;
+    TaskPoolList list;
+    boost::atomic<uint64_t> heapAllocations;
+  };
+
+  // Never destroyed, exiting threads may still return blocks during shutdown
+  TaskPoolShared& getTaskPoolShared()
+  {
+    static TaskPoolShared* shared = new TaskPoolShared();
+    return *shared;
+  }
+
+  // Gives the blocks of an exiting thread to the other threads
+  struct TaskPoolCache : TaskPoolList{
+    ~TaskPoolCache(){
+      TaskPoolShared& shared = getTaskPoolShared();
+      boost::lock_guard<boost::mutex> lockClass(shared.lock);
+      transfer(shared.list, count);
+    }
+  };
+
+  TaskPoolCache& getTaskPoolCache()
+  {
+    static boost::thread_specific_ptr<TaskPoolCache>* cache = new boost::thread_specific_ptr<TaskPoolCache>();
+    if(!cache->get()){
+      cache->reset(new TaskPoolCache());
+    }
+    return **cache;
+  }
+}
+
+void* TaskPool::allocate(size_t size)
+{
+  assert(size <= TASK_POOL_BLOCK_SIZE);
+
+  TaskPoolCache& cache = getTaskPoolCache();
+  if(!cache.head){
+    TaskPoolShared& shared = getTaskPoolShared();
+    boost::lock_guard<boost::mutex> lockClass(shared.lock);
+    shared.list.transfer(cache, TASK_POOL_CACHE_SIZE / 2);
+  }
+
+  if(cache.head){
+    return cache.pop();
+  }
+
+  ++getTaskPoolShared().heapAllocations;
+  return ::operator new(TASK_POOL_BLOCK_SIZE);
+}
+
+void TaskPool::deallocate(void* p)
+{
+  if(!p){
+    return;
+  }
+
+  TaskPoolCache& cache = getTaskPoolCache();
+  cache.push(static_cast<TaskPoolBlock*>(p));
+
+  if(cache.count >= TASK_POOL_CACHE_SIZE){
+    TaskPoolShared& shared = getTaskPoolShared();
+    boost::lock_guard<boost::mutex> lockClass(shared.lock);
+    cache.transfer(shared.list, TASK_POOL_CACHE_SIZE / 2);
+  }
+}
+
+uint64_t TaskPool::getHeapAllocations()
+{
+  return getTaskPoolShared().heapAllocations;
+}
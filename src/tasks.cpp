@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "tasks.h"
+#include "scheduler.h"
 #include "otsystem.h"
 #include "outputmessage.h"
 #include "game.h"
@@ -30,16 +31,72 @@ extern Game g_game;
 #include "exception.h"
 #endif
 
+TaskQueue::TaskQueue()
+  : m_head(&m_stub), m_tail(&m_stub), m_stub(boost::function<void (void)>())
+{
+}
+
+void TaskQueue::push(Task* task)
+{
+  task->m_next.store(NULL, boost::memory_order_relaxed);
+  Task* prev = m_head.exchange(task);
+  prev->m_next.store(task, boost::memory_order_release);
+}
+
+Task* TaskQueue::pop()
+{
+  Task* tail = m_tail;
+  Task* next = tail->m_next.load(boost::memory_order_acquire);
+
+  if(tail == &m_stub){
+    if(!next){
+      return NULL;
+    }
+
+    m_tail = next;
+    tail = next;
+    next = next->m_next.load(boost::memory_order_acquire);
+  }
+
+  if(next){
+    m_tail = next;
+    return tail;
+  }
+
+  if(tail != m_head.load()){
+    // A producer is between exchanging the head and linking its task
+    return NULL;
+  }
+
+  // Put the stub back so the last task can be unlinked
+  push(&m_stub);
+
+  next = tail->m_next.load(boost::memory_order_acquire);
+  if(next){
+    m_tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+bool TaskQueue::empty() const
+{
+  return m_tail == &m_stub && m_head.load() == &m_stub;
+}
+
 Dispatcher::Dispatcher()
+  : m_sleeping(false), m_threadState(STATE_TERMINATED)
 {
-  m_taskList.clear();
-  m_threadState = STATE_TERMINATED;
 }
 
 void Dispatcher::shutdownAndWait()
 {
   shutdown();
   m_thread.join();
+
+  // The dispatcher thread is gone, run what is left from here
+  flush();
 }
 
 void Dispatcher::start()
@@ -49,6 +106,40 @@ void Dispatcher::start()
   m_thread =  boost::thread(boost::bind(&Dispatcher::dispatcherThread, (void*)this));
 }
 
+Task* Dispatcher::popTask()
+{
+  Task* task = m_priorityTaskList.pop();
+  if(!task){
+    task = m_taskList.pop();
+  }
+  return task;
+}
+
+bool Dispatcher::hasTasks() const
+{
+  return !m_priorityTaskList.empty() || !m_taskList.empty();
+}
+
+void Dispatcher::executeTask(Task* task)
+{
+  if(!task->hasExpired()){
+    OutputMessagePool::getInstance()->startExecutionFrame();
+    (*task)();
+
+    OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+    if(outputPool)
+      outputPool->sendAll();
+
+    g_game.releaseSpectators();
+  }
+
+  delete task;
+
+  #ifdef __DEBUG_SCHEDULER__
+  std::cout << "Dispatcher: Executing task" << std::endl;
+  #endif
+}
+
 void Dispatcher::dispatcherThread(void* p)
 {
   Dispatcher* dispatcher = (Dispatcher*)p;
@@ -60,56 +151,40 @@ void Dispatcher::dispatcherThread(void* p)
   std::cout << "Starting Dispatcher" << std::endl;
   #endif
 
-  OutputMessagePool* outputPool;
-
   // NOTE: second argument defer_lock is to prevent from immediate locking
   boost::unique_lock<boost::mutex> taskLockUnique(dispatcher->m_taskLock, boost::defer_lock);
 
   while(dispatcher->m_threadState != STATE_TERMINATED){
-    Task* task = NULL;
-
-    // check if there are tasks waiting
-    taskLockUnique.lock(); //getDispatcher().m_taskLock.lock();
+    if(!dispatcher->hasTasks()){
+      // the queues are empty, sleep until a producer signals us
+      taskLockUnique.lock();
+      dispatcher->m_sleeping = true;
 
-    if(dispatcher->m_taskList.empty()){
-      //if the list is empty wait for signal
       #ifdef __DEBUG_SCHEDULER__
       std::cout << "Dispatcher: Waiting for task" << std::endl;
       #endif
-      dispatcher->m_taskSignal.wait(taskLockUnique);
-    }
-
-    #ifdef __DEBUG_SCHEDULER__
-    std::cout << "Dispatcher: Signalled" << std::endl;
-    #endif
-
-    if(!dispatcher->m_taskList.empty() && (dispatcher->m_threadState != STATE_TERMINATED)){
-      // take the first task
-      task = dispatcher->m_taskList.front();
-      dispatcher->m_taskList.pop_front();
-    }
-
-    taskLockUnique.unlock();
-
-    // finally execute the task...
-    if(task){
-      if(!task->hasExpired()){
-        OutputMessagePool::getInstance()->startExecutionFrame();
-        (*task)();
-
-        outputPool = OutputMessagePool::getInstance();
-        if(outputPool)
-          outputPool->sendAll();
-
-        g_game.clearSpectatorCache();
+      while(!dispatcher->hasTasks() && dispatcher->m_threadState != STATE_TERMINATED){
+        dispatcher->m_taskSignal.wait(taskLockUnique);
       }
 
-      delete task;
+      dispatcher->m_sleeping = false;
+      taskLockUnique.unlock();
 
       #ifdef __DEBUG_SCHEDULER__
-      std::cout << "Dispatcher: Executing task" << std::endl;
+      std::cout << "Dispatcher: Signalled" << std::endl;
       #endif
     }
+
+    // drain everything that is queued right now
+    Task* task = NULL;
+    while(dispatcher->m_threadState != STATE_TERMINATED && (task = dispatcher->popTask())){
+      dispatcher->executeTask(task);
+    }
+
+    if(!task && dispatcher->hasTasks()){
+      // a producer is still linking its task
+      boost::this_thread::yield();
+    }
   }
 #if defined __EXCEPTION_TRACER__
   dispatcherExceptionHandler.RemoveHandler();
@@ -118,32 +193,28 @@ void Dispatcher::dispatcherThread(void* p)
 
 void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
 {
-  bool do_signal = false;
-  m_taskLock.lock();
-  if(m_threadState == STATE_RUNNING){
-
-    do_signal = m_taskList.empty();
-    if(push_front){
-      m_taskList.push_front(task);
-    }
-    else{
-      m_taskList.push_back(task);
-    }
-
+  if(m_threadState != STATE_RUNNING){
     #ifdef __DEBUG_SCHEDULER__
-    std::cout << "Dispatcher: Added task" << std::endl;
+    std::cout << "Error: [Dispatcher::addTask] Dispatcher thread is terminated." << std::endl;
     #endif
+    delete task;
+    return;
+  }
+
+  if(push_front){
+    m_priorityTaskList.push(task);
   }
-#ifdef __DEBUG_SCHEDULER__
   else{
-    std::cout << "Error: [Dispatcher::addTask] Dispatcher thread is terminated." << std::endl;
+    m_taskList.push(task);
   }
-#endif
 
-  m_taskLock.unlock();
+  #ifdef __DEBUG_SCHEDULER__
+  std::cout << "Dispatcher: Added task" << std::endl;
+  #endif
 
-  // send a signal if the list was empty
-  if(do_signal){
+  // only wake the dispatcher if it is actually sleeping
+  if(m_sleeping){
+    boost::lock_guard<boost::mutex> lockClass(m_taskLock);
     m_taskSignal.notify_one();
   }
 }
@@ -151,15 +222,13 @@ void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
 void Dispatcher::flush()
 {
   Task* task = NULL;
-  while(!m_taskList.empty()){
-    task = m_taskList.front();
-    m_taskList.pop_front();
+  while((task = popTask())){
     (*task)();
     delete task;
     OutputMessagePool* outputPool = OutputMessagePool::getInstance();
     if(outputPool)
       outputPool->sendAll();
-    g_game.clearSpectatorCache();
+    g_game.releaseSpectators();
   }
   #ifdef __DEBUG_SCHEDULER__
   std::cout << "Flushing Dispatcher" << std::endl;
@@ -168,9 +237,7 @@ void Dispatcher::flush()
 
 void Dispatcher::stop()
 {
-  m_taskLock.lock();
   m_threadState = STATE_CLOSING;
-  m_taskLock.unlock();
   #ifdef __DEBUG_SCHEDULER__
   std::cout << "Stopping Dispatcher" << std::endl;
   #endif
@@ -178,10 +245,16 @@ void Dispatcher::stop()
 
 void Dispatcher::shutdown()
 {
-  m_taskLock.lock();
   m_threadState = STATE_TERMINATED;
-  flush();
-  m_taskLock.unlock();
+
+  if(boost::this_thread::get_id() == m_thread.get_id()){
+    // Called from a task, the queue is ours to drain
+    flush();
+  }
+  else{
+    boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+    m_taskSignal.notify_one();
+  }
   #ifdef __DEBUG_SCHEDULER__
   std::cout << "Shutdown Dispatcher" << std::endl;
   #endif
@@ -24,20 +24,94 @@
 
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+#include <boost/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <new>
 
 const int DISPATCHER_TASK_EXPIRATION = 2000;
 
+// Type-erased void() callable used by tasks. Function objects up to
+// inline_size bytes (e.g. boost::bind of a member function with a few
+// ids) are stored inside the object instead of on the heap.
+class TaskFunction : boost::noncopyable{
+public:
+  enum {inline_size = 112};
+
+  template<typename FunctionType>
+  explicit TaskFunction(const FunctionType& f)
+  {
+    store(f, boost::integral_constant<bool, sizeof(FunctionType) <= inline_size &&
+      boost::alignment_of<FunctionType>::value <= boost::alignment_of<Buffer>::value>());
+    m_invoke = &invoke<FunctionType>;
+  }
+
+  ~TaskFunction(){
+    m_destroy(m_object);
+  }
+
+  void operator()() const{
+    m_invoke(m_object);
+  }
+
+private:
+  template<typename FunctionType>
+  void store(const FunctionType& f, boost::true_type /*fits inline*/){
+    m_object = new (&m_buffer) FunctionType(f);
+    m_destroy = &destroyInline<FunctionType>;
+  }
+  template<typename FunctionType>
+  void store(const FunctionType& f, boost::false_type /*fits inline*/){
+    m_object = new FunctionType(f);
+    m_destroy = &destroyHeap<FunctionType>;
+  }
+
+  template<typename FunctionType>
+  static void invoke(void* f) {(*static_cast<FunctionType*>(f))();}
+  template<typename FunctionType>
+  static void destroyInline(void* f) {static_cast<FunctionType*>(f)->~FunctionType();}
+  template<typename FunctionType>
+  static void destroyHeap(void* f) {delete static_cast<FunctionType*>(f);}
+
+  typedef boost::aligned_storage<inline_size>::type Buffer;
+
+  Buffer m_buffer;
+  void* m_object;
+  void (*m_invoke)(void*);
+  void (*m_destroy)(void*);
+};
+
+// Recycles the memory of Task and SchedulerTask objects. Every thread
+// keeps a small cache of free blocks, a full cache hands a batch over to
+// a shared list so blocks freed by the dispatcher go back to producers.
+class TaskPool : boost::noncopyable{
+public:
+  static void* allocate(size_t size);
+  static void deallocate(void* p);
+
+  // Blocks that had to be taken from the heap since startup
+  static uint64_t getHeapAllocations();
+};
+
 class Task{
+  friend class TaskQueue;
 public:
   // DO NOT allocate this class on the stack
-  Task(uint32_t ms, const boost::function<void (void)>& f) : m_f(f)
+  template<typename FunctionType>
+  Task(uint32_t ms, const FunctionType& f) : m_f(f), m_next(NULL)
   {
     m_expiration = boost::get_system_time() + boost::posix_time::milliseconds(ms);
   }
-  Task(const boost::function<void (void)>& f)
-    : m_expiration(boost::date_time::not_a_date_time), m_f(f) {}
+  template<typename FunctionType>
+  Task(const FunctionType& f)
+    : m_expiration(boost::date_time::not_a_date_time), m_f(f), m_next(NULL) {}
 
-  ~Task() {}
+  virtual ~Task() {}
+
+  static void* operator new(size_t size) {return TaskPool::allocate(size);}
+  static void operator delete(void* p) {TaskPool::deallocate(p);}
 
   void operator()() const{
     m_f();
@@ -56,17 +130,42 @@ protected:
   // then it is the time the task should be added to the
   // dispatcher
   boost::system_time m_expiration;
-  boost::function<void (void)> m_f;
+  TaskFunction m_f;
+
+private:
+  // Intrusive link used by TaskQueue
+  boost::atomic<Task*> m_next;
 };
 
-inline Task* createTask(boost::function<void (void)> f){
+template<typename FunctionType>
+inline Task* createTask(const FunctionType& f){
   return new Task(f);
 }
 
-inline Task* createTask(uint32_t expiration, boost::function<void (void)> f){
+template<typename FunctionType>
+inline Task* createTask(uint32_t expiration, const FunctionType& f){
   return new Task(expiration, f);
 }
 
+// Intrusive, unbounded multi-producer/single-consumer queue of tasks
+// (Vyukov). push() is wait-free and may be called from any thread,
+// pop() must only be called from the consumer thread.
+class TaskQueue : boost::noncopyable{
+public:
+  TaskQueue();
+
+  void push(Task* task);
+  Task* pop();
+
+  // Consumer side only. A queue that is in the middle of a push is not empty.
+  bool empty() const;
+
+protected:
+  boost::atomic<Task*> m_head;
+  Task* m_tail;
+  Task m_stub;
+};
+
 enum DispatcherState{
   STATE_RUNNING,
   STATE_CLOSING,
@@ -95,14 +194,22 @@ protected:
 
   static void dispatcherThread(void* p);
 
+  Task* popTask();
+  bool hasTasks() const;
+  void executeTask(Task* task);
   void flush();
 
   boost::thread m_thread;
+  // Only used to put the dispatcher thread to sleep, producers take it
+  // only when they have to wake it up
   boost::mutex m_taskLock;
   boost::condition_variable m_taskSignal;
+  boost::atomic<bool> m_sleeping;
 
-  std::list<Task*> m_taskList;
-  DispatcherState m_threadState;
+  // Tasks added with push_front are executed before any normal task
+  TaskQueue m_priorityTaskList;
+  TaskQueue m_taskList;
+  boost::atomic<DispatcherState> m_threadState;
 };
 
 extern Dispatcher g_dispatcher;
@@ -353,10 +353,10 @@ void Tile::moveCreature(Creature* actor, Creature* creature, Cylinder* toCylinde
   //remove the creature
   __removeThing(actor, creature, 0);
 
-  // Switch the node ownership
-  if(qt_node != newTile->qt_node) {
-    qt_node->removeCreature(creature);
-    newTile->qt_node->addCreature(creature);
+  // Switch the node ownership, the leaf keeps its creatures grouped by floor
+  if(qt_node != newTile->qt_node || oldPos.z != newPos.z) {
+    qt_node->removeCreature(creature, oldPos.z);
+    newTile->qt_node->addCreature(creature, newPos.z);
   }
   
   //add the creature
@@ -685,9 +685,9 @@ void Tile::__addThing(Creature* actor, int32_t index, Thing* thing)
 {
   Creature* creature = thing->getCreature();
   if(creature){
-    g_game.clearSpectatorCache();
     creature->setParent(this);
     creatures_insert(creatures_begin(), creature);
+    g_game.updateSpectatorCache(creature, this, false);
   }
   else{
     Item* item = thing->getItem();
@@ -913,7 +913,7 @@ void Tile::__removeThing(Creature* actor, Thing* thing, uint32_t count)
   if(thing->getCreature()){
     CreatureIterator it = std::find(creatures_begin(), creatures_end(), thing);
     if(it != creatures_end()){
-      g_game.clearSpectatorCache();
+      g_game.updateSpectatorCache(*it, this, true);
       creatures_erase(it);
     }
     else{
@@ -1258,8 +1258,8 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 
   Creature* creature = thing->getCreature();
   if(creature){
-    g_game.clearSpectatorCache();
     creatures_insert(creatures_begin(), creature);
+    g_game.updateSpectatorCache(creature, this, false);
   }
   else{
     Item* item = thing->getItem();
@@ -1439,4 +1439,8 @@ void Tile::updateTileFlags(Item* item, bool removed)
       resetFlag(TILEPROP_POSITIONCHANGE);
     }
   }
+
+  if(Map* map = g_game.getMap()){
+    map->onTileChange(this);
+  }
 }
@@ -23,6 +23,7 @@
 
 #include <set>
 #include <boost/shared_ptr.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -37,8 +38,9 @@
 typedef std::vector<Creature*> CreatureVector;
 typedef CreatureVector::iterator CreatureIterator;
 typedef CreatureVector::const_iterator CreatureConstIterator;
-typedef std::list<Creature*> SpectatorVec;
-typedef std::map<Position, boost::shared_ptr<SpectatorVec> > SpectatorCache;
+// Most spectator queries find a handful of creatures, keep those off the heap
+typedef boost::container::small_vector<Creature*, 32> SpectatorVec;
+typedef boost::shared_ptr<SpectatorVec> SpectatorVecPtr;
 typedef std::vector<Item*> ItemVector;
 
 typedef boost::multi_index::multi_index_container<
@@ -0,0 +1,378 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "xtea.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define __XTEA_SSE2__
+  #include <emmintrin.h>
+#endif
+
+#if defined(__XTEA_SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define __XTEA_AVX2__
+  #include <immintrin.h>
+#endif
+
+namespace {
+  const uint32_t XTEA_DELTA = 0x61C88647;
+  const uint32_t XTEA_ROUNDS = 32;
+
+  // The key words used by each half round do not depend on the data,
+  // so they are computed once per call and shared by all lanes
+  struct XTEASchedule {
+    uint32_t k0[XTEA_ROUNDS];
+    uint32_t k1[XTEA_ROUNDS];
+  };
+
+  void makeEncryptSchedule(XTEASchedule& schedule, const uint32_t* key)
+  {
+    uint32_t sum = 0;
+    for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+      schedule.k0[i] = sum + key[sum & 3];
+      sum -= XTEA_DELTA;
+      schedule.k1[i] = sum + key[sum >> 11 & 3];
+    }
+  }
+
+  void makeDecryptSchedule(XTEASchedule& schedule, const uint32_t* key)
+  {
+    uint32_t sum = 0xC6EF3720;
+    for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+      schedule.k1[i] = sum + key[sum >> 11 & 3];
+      sum += XTEA_DELTA;
+      schedule.k0[i] = sum + key[sum & 3];
+    }
+  }
+
+  void encryptScalar(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    for(uint32_t b = 0; b < blocks; ++b, buffer += 2){
+      uint32_t v0 = buffer[0], v1 = buffer[1];
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ schedule.k0[i];
+        v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ schedule.k1[i];
+      }
+      buffer[0] = v0; buffer[1] = v1;
+    }
+  }
+
+  void decryptScalar(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    for(uint32_t b = 0; b < blocks; ++b, buffer += 2){
+      uint32_t v0 = buffer[0], v1 = buffer[1];
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ schedule.k1[i];
+        v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ schedule.k0[i];
+      }
+      buffer[0] = v0; buffer[1] = v1;
+    }
+  }
+
+#ifdef __XTEA_SSE2__
+  // 4 blocks per iteration, v0 and v1 words are split into separate registers
+  inline __m128i xteaMixSSE2(__m128i v, __m128i k)
+  {
+    __m128i x = _mm_xor_si128(_mm_slli_epi32(v, 4), _mm_srli_epi32(v, 5));
+    return _mm_xor_si128(_mm_add_epi32(x, v), k);
+  }
+
+  uint32_t encryptSSE2(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    uint32_t done = 0;
+    for(; done + 4 <= blocks; done += 4, buffer += 8){
+      __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+      __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(buffer + 4)), _MM_SHUFFLE(3, 1, 2, 0));
+      __m128i v0 = _mm_unpacklo_epi64(a, b);
+      __m128i v1 = _mm_unpackhi_epi64(a, b);
+
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v0 = _mm_add_epi32(v0, xteaMixSSE2(v1, _mm_set1_epi32(schedule.k0[i])));
+        v1 = _mm_add_epi32(v1, xteaMixSSE2(v0, _mm_set1_epi32(schedule.k1[i])));
+      }
+
+      _mm_storeu_si128((__m128i*)buffer, _mm_shuffle_epi32(_mm_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm_storeu_si128((__m128i*)(buffer + 4), _mm_shuffle_epi32(_mm_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return done;
+  }
+
+  uint32_t decryptSSE2(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    uint32_t done = 0;
+    for(; done + 4 <= blocks; done += 4, buffer += 8){
+      __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+      __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(buffer + 4)), _MM_SHUFFLE(3, 1, 2, 0));
+      __m128i v0 = _mm_unpacklo_epi64(a, b);
+      __m128i v1 = _mm_unpackhi_epi64(a, b);
+
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v1 = _mm_sub_epi32(v1, xteaMixSSE2(v0, _mm_set1_epi32(schedule.k1[i])));
+        v0 = _mm_sub_epi32(v0, xteaMixSSE2(v1, _mm_set1_epi32(schedule.k0[i])));
+      }
+
+      _mm_storeu_si128((__m128i*)buffer, _mm_shuffle_epi32(_mm_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm_storeu_si128((__m128i*)(buffer + 4), _mm_shuffle_epi32(_mm_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return done;
+  }
+#endif
+
+#ifdef __XTEA_AVX2__
+  // 8 blocks per iteration, only called after the CPU check below
+  __attribute__((target("avx2"))) inline __m256i xteaMixAVX2(__m256i v, __m256i k)
+  {
+    __m256i x = _mm256_xor_si256(_mm256_slli_epi32(v, 4), _mm256_srli_epi32(v, 5));
+    return _mm256_xor_si256(_mm256_add_epi32(x, v), k);
+  }
+
+  __attribute__((target("avx2"))) uint32_t encryptAVX2(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    uint32_t done = 0;
+    for(; done + 8 <= blocks; done += 8, buffer += 16){
+      // Same split as the SSE2 version, done inside each 128 bit lane
+      __m256i a = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+      __m256i b = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)(buffer + 8)), _MM_SHUFFLE(3, 1, 2, 0));
+      __m256i v0 = _mm256_unpacklo_epi64(a, b);
+      __m256i v1 = _mm256_unpackhi_epi64(a, b);
+
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v0 = _mm256_add_epi32(v0, xteaMixAVX2(v1, _mm256_set1_epi32(schedule.k0[i])));
+        v1 = _mm256_add_epi32(v1, xteaMixAVX2(v0, _mm256_set1_epi32(schedule.k1[i])));
+      }
+
+      _mm256_storeu_si256((__m256i*)buffer, _mm256_shuffle_epi32(_mm256_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm256_storeu_si256((__m256i*)(buffer + 8), _mm256_shuffle_epi32(_mm256_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return done;
+  }
+
+  __attribute__((target("avx2"))) uint32_t decryptAVX2(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    uint32_t done = 0;
+    for(; done + 8 <= blocks; done += 8, buffer += 16){
+      __m256i a = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+      __m256i b = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)(buffer + 8)), _MM_SHUFFLE(3, 1, 2, 0));
+      __m256i v0 = _mm256_unpacklo_epi64(a, b);
+      __m256i v1 = _mm256_unpackhi_epi64(a, b);
+
+      for(uint32_t i = 0; i < XTEA_ROUNDS; ++i){
+        v1 = _mm256_sub_epi32(v1, xteaMixAVX2(v0, _mm256_set1_epi32(schedule.k1[i])));
+        v0 = _mm256_sub_epi32(v0, xteaMixAVX2(v1, _mm256_set1_epi32(schedule.k0[i])));
+      }
+
+      _mm256_storeu_si256((__m256i*)buffer, _mm256_shuffle_epi32(_mm256_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm256_storeu_si256((__m256i*)(buffer + 8), _mm256_shuffle_epi32(_mm256_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return done;
+  }
+
+  bool hasAVX2()
+  {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+  }
+#endif
+}
+
+void xteaEncrypt(uint32_t* buffer, uint32_t blocks, const uint32_t* key)
+{
+  XTEASchedule schedule;
+  makeEncryptSchedule(schedule, key);
+
+  uint32_t done = 0;
+#ifdef __XTEA_AVX2__
+  if(hasAVX2()){
+    done = encryptAVX2(buffer, blocks, schedule);
+  }
+#endif
+#ifdef __XTEA_SSE2__
+  done += encryptSSE2(buffer + done * 2, blocks - done, schedule);
+#endif
+  encryptScalar(buffer + done * 2, blocks - done, schedule);
+}
+
+void xteaDecrypt(uint32_t* buffer, uint32_t blocks, const uint32_t* key)
+{
+  XTEASchedule schedule;
+  makeDecryptSchedule(schedule, key);
+
+  uint32_t done = 0;
+#ifdef __XTEA_AVX2__
+  if(hasAVX2()){
+    done = decryptAVX2(buffer, blocks, schedule);
+  }
+#endif
+#ifdef __XTEA_SSE2__
+  done += decryptSSE2(buffer + done * 2, blocks - done, schedule);
+#endif
+  decryptScalar(buffer + done * 2, blocks - done, schedule);
+}
+
+namespace {
+  // Published XTEA test vectors, as words in the order they are processed
+  struct XTEAVector {
+    uint32_t key[4];
+    uint32_t plain[2];
+    uint32_t cipher[2];
+  };
+
+  const XTEAVector xteaVectors[] = {
+    {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x00000000, 0x00000000}, {0xDEE9D4D8, 0xF7131ED9}},
+    {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x01020304, 0x05060708}, {0x065C1B89, 0x75C6A816}},
+    {{0x01234567, 0x12345678, 0x23456789, 0x3456789A}, {0x00000000, 0x00000000}, {0x1FF9A026, 0x1AC64264}},
+    {{0x01234567, 0x12345678, 0x23456789, 0x3456789A}, {0x01020304, 0x05060708}, {0x8C67155B, 0x2EF91EAD}},
+    {{0x00010203, 0x04050607, 0x08090A0B, 0x0C0D0E0F}, {0x41424344, 0x45464748}, {0x497DF3D0, 0x72612CB5}}
+  };
+
+  // Enough blocks for one pass of the widest version
+  const uint32_t XTEA_TEST_BLOCKS = 16;
+
+  typedef uint32_t (*XTEAFunction)(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule);
+
+  uint32_t encryptScalarAll(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    encryptScalar(buffer, blocks, schedule);
+    return blocks;
+  }
+
+  uint32_t decryptScalarAll(uint32_t* buffer, uint32_t blocks, const XTEASchedule& schedule)
+  {
+    decryptScalar(buffer, blocks, schedule);
+    return blocks;
+  }
+
+  bool checkImplementation(XTEAFunction encrypt, XTEAFunction decrypt)
+  {
+    uint32_t buffer[XTEA_TEST_BLOCKS * 2];
+    XTEASchedule encryptSchedule, decryptSchedule;
+
+    for(uint32_t v = 0; v < sizeof(xteaVectors) / sizeof(xteaVectors[0]); ++v){
+      const XTEAVector& vector = xteaVectors[v];
+      makeEncryptSchedule(encryptSchedule, vector.key);
+      makeDecryptSchedule(decryptSchedule, vector.key);
+
+      for(uint32_t b = 0; b < XTEA_TEST_BLOCKS; ++b){
+        buffer[b * 2] = vector.plain[0];
+        buffer[b * 2 + 1] = vector.plain[1];
+      }
+
+      if(encrypt(buffer, XTEA_TEST_BLOCKS, encryptSchedule) != XTEA_TEST_BLOCKS){
+        return false;
+      }
+
+      for(uint32_t b = 0; b < XTEA_TEST_BLOCKS; ++b){
+        if(buffer[b * 2] != vector.cipher[0] || buffer[b * 2 + 1] != vector.cipher[1]){
+          return false;
+        }
+      }
+
+      if(decrypt(buffer, XTEA_TEST_BLOCKS, decryptSchedule) != XTEA_TEST_BLOCKS){
+        return false;
+      }
+
+      for(uint32_t b = 0; b < XTEA_TEST_BLOCKS; ++b){
+        if(buffer[b * 2] != vector.plain[0] || buffer[b * 2 + 1] != vector.plain[1]){
+          return false;
+        }
+      }
+    }
+
+    // Every block different, a block written to the wrong lane shows up
+    uint32_t plain[XTEA_TEST_BLOCKS * 2];
+    uint32_t expected[XTEA_TEST_BLOCKS * 2];
+    uint32_t seed = 0x2545F491;
+    for(uint32_t i = 0; i < XTEA_TEST_BLOCKS * 2; ++i){
+      seed = seed * 1664525 + 1013904223;
+      plain[i] = seed;
+    }
+
+    const uint32_t* key = xteaVectors[3].key;
+    makeEncryptSchedule(encryptSchedule, key);
+    makeDecryptSchedule(decryptSchedule, key);
+
+    memcpy(expected, plain, sizeof(plain));
+    encryptScalar(expected, XTEA_TEST_BLOCKS, encryptSchedule);
+
+    memcpy(buffer, plain, sizeof(plain));
+    if(encrypt(buffer, XTEA_TEST_BLOCKS, encryptSchedule) != XTEA_TEST_BLOCKS ||
+      memcmp(buffer, expected, sizeof(expected)) != 0){
+      return false;
+    }
+
+    if(decrypt(buffer, XTEA_TEST_BLOCKS, decryptSchedule) != XTEA_TEST_BLOCKS ||
+      memcmp(buffer, plain, sizeof(plain)) != 0){
+      return false;
+    }
+
+    return true;
+  }
+}
+
+bool xteaSelfTest()
+{
+  if(!checkImplementation(&encryptScalarAll, &decryptScalarAll)){
+    return false;
+  }
+
+#ifdef __XTEA_SSE2__
+  if(!checkImplementation(&encryptSSE2, &decryptSSE2)){
+    return false;
+  }
+#endif
+
+#ifdef __XTEA_AVX2__
+  if(hasAVX2() && !checkImplementation(&encryptAVX2, &decryptAVX2)){
+    return false;
+  }
+#endif
+
+  // Mixed sizes through the public functions, which split a buffer over
+  // the versions and finish the tail one block at a time
+  const uint32_t* key = xteaVectors[4].key;
+  XTEASchedule schedule;
+  makeEncryptSchedule(schedule, key);
+
+  uint32_t plain[(XTEA_TEST_BLOCKS * 2 + 3) * 2];
+  uint32_t expected[sizeof(plain) / sizeof(plain[0])];
+  uint32_t buffer[sizeof(plain) / sizeof(plain[0])];
+  for(uint32_t i = 0; i < sizeof(plain) / sizeof(plain[0]); ++i){
+    plain[i] = i * 0x9E3779B9;
+  }
+
+  for(uint32_t blocks = 1; blocks <= sizeof(plain) / sizeof(plain[0]) / 2; ++blocks){
+    memcpy(expected, plain, blocks * 8);
+    encryptScalar(expected, blocks, schedule);
+
+    memcpy(buffer, plain, blocks * 8);
+    xteaEncrypt(buffer, blocks, key);
+    if(memcmp(buffer, expected, blocks * 8) != 0){
+      return false;
+    }
+
+    xteaDecrypt(buffer, blocks, key);
+    if(memcmp(buffer, plain, blocks * 8) != 0){
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+
+#ifndef __OTSERV_XTEA_H__
+#define __OTSERV_XTEA_H__
+
+#include <stdint.h>
+
+// XTEA over a buffer of 8 byte blocks (two uint32_t words each).
+// Several blocks are processed in parallel lanes when the CPU allows it,
+// the output is the same as the one block at a time version.
+void xteaEncrypt(uint32_t* buffer, uint32_t blocks, const uint32_t* key);
+void xteaDecrypt(uint32_t* buffer, uint32_t blocks, const uint32_t* key);
+
+// Known answer check of the one block version and of every parallel
+// version this CPU runs, false if any of them gives another output
+bool xteaSelfTest();
+
+#endif
@@ -0,0 +1,352 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Player saves written through the SQLite driver and read back
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <sqlite3.h>
+#include <fstream>
+#include <sstream>
+#include "player_save.h"
+#include "database_driver.h"
+#include "database_writer.h"
+#include "configmanager.h"
+
+// The database and the writer are all this test needs of the server
+static std::string databaseFile = "player_save_test.s3db";
+static std::string databaseType = "sqlite";
+
+ConfigManager g_config;
+DatabaseWriter g_databaseWriter;
+
+ConfigManager::ConfigManager() {}
+ConfigManager::~ConfigManager() {}
+
+const std::string& ConfigManager::getString(uint32_t _what) const
+{
+  return _what == SQL_TYPE ? databaseType : databaseFile;
+}
+
+int64_t ConfigManager::getNumber(uint32_t _what) const
+{
+  switch(_what){
+    case SQL_POOL_SIZE: return 4;
+    case PLAYER_SAVE_QUEUE_SIZE: return 16;
+    default: return 0;
+  }
+}
+
+static const uint32_t PLAYER_GUID = 1;
+static bool failed = false;
+
+#define CHECK(cond) \
+  if(!(cond)){ \
+    std::cout << "Failed at line " << __LINE__ << ": " << #cond << std::endl; \
+    failed = true; \
+  }
+
+// The parts of a player saves write only when they changed, kept the way
+// Player and Creature keep them
+struct TestPlayer{
+  uint32_t skills[7][2];
+  uint32_t savedSkills[7][2];
+  StorageMap storage;
+  StorageKeySet dirtyStorageKeys;
+  VIPListSet vipList;
+  bool vipListDirty;
+
+  void setStorage(const std::string& key, const std::string& value)
+  {
+    storage[key] = value;
+    dirtyStorageKeys.insert(key);
+  }
+
+  void eraseStorage(const std::string& key)
+  {
+    storage.erase(key);
+    dirtyStorageKeys.insert(key);
+  }
+
+  void addVIP(uint32_t guid) {vipList.insert(guid); vipListDirty = true;}
+  void removeVIP(uint32_t guid) {vipList.erase(guid); vipListDirty = true;}
+};
+
+// Same as IOPlayer::loadPlayer, everything loaded matches the database
+static bool loadPlayer(TestPlayer& player)
+{
+  DatabaseDriver* db = DatabaseDriver::instance();
+  DBQuery query;
+  DBResult_ptr result;
+
+  query << "SELECT `skill_id`, `value`, `count` FROM `player_skills` WHERE `player_id` = " << PLAYER_GUID;
+  for(result = db->storeQuery(query); result; result = result->advance()){
+    uint32_t skill = result->getDataInt("skill_id");
+    if(skill <= 6){
+      player.skills[skill][0] = result->getDataInt("value");
+      player.skills[skill][1] = result->getDataInt("count");
+    }
+  }
+
+  player.storage.clear();
+  query.reset();
+  query << "SELECT `id`, `value` FROM `player_storage` WHERE `player_id` = " << PLAYER_GUID;
+  for(result = db->storeQuery(query); result; result = result->advance()){
+    player.storage[result->getDataString("id")] = result->getDataString("value");
+  }
+
+  player.vipList.clear();
+  query.reset();
+  query << "SELECT `vip_id` FROM `player_viplist` WHERE `player_id` = " << PLAYER_GUID;
+  for(result = db->storeQuery(query); result; result = result->advance()){
+    player.vipList.insert(result->getDataInt("vip_id"));
+  }
+
+  player.dirtyStorageKeys.clear();
+  player.vipListDirty = false;
+  for(int32_t i = 0; i <= 6; i++){
+    player.savedSkills[i][0] = player.skills[i][0];
+    player.savedSkills[i][1] = player.skills[i][1];
+  }
+  return true;
+}
+
+static bool savedMatches(const TestPlayer& player)
+{
+  TestPlayer saved;
+  loadPlayer(saved);
+  for(int32_t i = 0; i <= 6; i++){
+    if(saved.skills[i][0] != player.skills[i][0] || saved.skills[i][1] != player.skills[i][1]){
+      return false;
+    }
+  }
+
+  return saved.storage == player.storage && saved.vipList == player.vipList;
+}
+
+// Same as IOPlayer::getSaveData, minus the player row
+static void getSaveData(TestPlayer& player, PlayerSaveData& data, bool shallow, bool fullSave)
+{
+  data.guid = PLAYER_GUID;
+  data.name = "Test Player";
+  data.shallow = shallow;
+  data.fullSave = fullSave;
+
+  data.level = 8;
+  data.vocation = 0;
+  data.health = data.healthMax = 185;
+  data.direction = 2;
+  data.experience = 4200;
+  data.lookBody = data.lookFeet = data.lookHead = data.lookLegs = 10;
+  data.lookType = 136;
+  data.lookAddons = 0;
+  data.magLevel = 0;
+  data.mana = data.manaMax = 35;
+  data.manaSpent = 0;
+  data.soul = 100;
+  data.town = 1;
+  data.loginPosition = Position(100, 100, 7);
+  data.capacity = 470;
+  data.sex = 0;
+  data.lossExperience = data.lossMana = data.lossSkills = data.lossContainers = 100;
+  data.lossItems = 10;
+  data.stamina = 151200000;
+  data.skullType = 0;
+  data.skullTime = 0;
+
+  for(int32_t i = 0; i <= 6; i++){
+    data.skills[i][0] = player.skills[i][0];
+    data.skills[i][1] = player.skills[i][1];
+  }
+
+  takePlayerChanges(data, player.savedSkills, player.storage, player.dirtyStorageKeys,
+    player.vipList, player.vipListDirty);
+}
+
+// Same as IOPlayer::savePlayer and IOPlayer::savePlayerAsync
+static bool savePlayer(TestPlayer& player, bool shallow = false)
+{
+  PlayerSaveData data;
+  getSaveData(player, data, shallow, g_databaseWriter.prepareSave(PLAYER_GUID, true));
+  return g_databaseWriter.savePlayerData(data);
+}
+
+static void savePlayerAsync(TestPlayer& player, bool shallow = false)
+{
+  PlayerSaveData data;
+  getSaveData(player, data, shallow, g_databaseWriter.prepareSave(PLAYER_GUID, false));
+  g_databaseWriter.addSave(data);
+}
+
+static uint64_t getRowsWritten()
+{
+  DBResult_ptr result = DatabaseDriver::instance()->storeQuery("SELECT total_changes() AS `changes`");
+  return result ? (uint64_t)result->getDataLong("changes") : 0;
+}
+
+static bool createDatabase(const char* schemaFile)
+{
+  std::ifstream schemaStream(schemaFile);
+  if(!schemaStream){
+    std::cout << "Could not read " << schemaFile << "." << std::endl;
+    return false;
+  }
+
+  std::stringstream schema;
+  schema << schemaStream.rdbuf()
+    << "INSERT INTO `accounts` (`id`, `name`, `password`) VALUES (1, '1', '1');";
+  for(uint32_t guid = 1; guid <= 64; ++guid){
+    schema << "INSERT INTO `players` (`id`, `name`, `account_id`, `group_id`, `world_id`, `town_id`, `conditions`)"
+      " VALUES (" << guid << ", 'Player " << guid << "', 1, 1, 0, 1, '');";
+  }
+
+  std::remove(databaseFile.c_str());
+  sqlite3* handle;
+  if(sqlite3_open(databaseFile.c_str(), &handle) != SQLITE_OK){
+    return false;
+  }
+
+  char* error = NULL;
+  bool created = (sqlite3_exec(handle, schema.str().c_str(), NULL, NULL, &error) == SQLITE_OK);
+  if(!created){
+    std::cout << "Could not create the database: " << error << std::endl;
+    sqlite3_free(error);
+  }
+
+  sqlite3_close(handle);
+  return created;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2){
+    std::cout << "Usage: " << argv[0] << " <schema.sqlite>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(!createDatabase(argv[1])){
+    return EXIT_FAILURE;
+  }
+
+  DatabaseDriver* db = DatabaseDriver::instance();
+  if(!db){
+    return EXIT_FAILURE;
+  }
+
+  TestPlayer player;
+  loadPlayer(player);
+
+  //changes since the player was loaded
+  player.skills[0][0] = 20;
+  player.setStorage("a", "1");
+  player.setStorage("b", "2");
+  player.setStorage("c", "3");
+  player.addVIP(2);
+  player.addVIP(3);
+  CHECK(savePlayer(player));
+  CHECK(savedMatches(player));
+
+  //a failed write loses its changes, the next save has to write everything
+  player.skills[1][1] = 50;
+  player.setStorage("b", "20");
+  player.eraseStorage("c");
+  player.setStorage("d", "4");
+  player.removeVIP(2);
+  player.addVIP(4);
+  CHECK(db->executeQuery("CREATE TRIGGER `fail_storage` BEFORE INSERT ON `player_storage`"
+    " BEGIN SELECT RAISE(ABORT, 'write failed'); END"));
+  CHECK(!savePlayer(player));
+  CHECK(db->executeQuery("DROP TRIGGER `fail_storage`"));
+  CHECK(!savedMatches(player));
+  CHECK(savePlayer(player));
+  CHECK(savedMatches(player));
+
+  //a shallow save writes the skills, storage and VIP list wait for the next one
+  player.skills[2][0] = 30;
+  player.setStorage("e", "5");
+  player.addVIP(5);
+  CHECK(savePlayer(player, true));
+  TestPlayer saved;
+  loadPlayer(saved);
+  CHECK(saved.skills[2][0] == 30);
+  CHECK(saved.storage.find("e") == saved.storage.end());
+  CHECK(saved.vipList.find(5) == saved.vipList.end());
+  CHECK(savePlayer(player));
+  CHECK(savedMatches(player));
+
+  //a synchronous save drops the older snapshot still queued and writes
+  //everything, including what only the dropped snapshot carried
+  g_databaseWriter.start();
+  g_databaseWriter.getWriteLock().lock();
+  player.setStorage("f", "queued");
+  player.setStorage("g", "6");
+  player.removeVIP(3);
+  savePlayerAsync(player);
+  player.setStorage("f", "current");
+  CHECK(savePlayer(player));
+  g_databaseWriter.getWriteLock().unlock();
+  g_databaseWriter.shutdownAndWait();
+  CHECK(g_databaseWriter.getDroppedSaves() == 1);
+  CHECK(g_databaseWriter.getFailedSaves() == 0);
+  CHECK(savedMatches(player));
+
+  //rows written by a full save and by one that only writes a change
+  for(uint32_t i = 0; i < 500; ++i){
+    std::ostringstream key;
+    key << "key" << i;
+    player.setStorage(key.str(), "0");
+  }
+  for(uint32_t guid = 6; guid <= 64; ++guid){
+    player.addVIP(guid);
+  }
+  CHECK(savePlayer(player));
+  CHECK(savedMatches(player));
+
+  const uint32_t saves = 200;
+  uint64_t rows[2], time[2];
+  for(int32_t fullSave = 0; fullSave <= 1; ++fullSave){
+    uint64_t firstRow = getRowsWritten();
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+    for(uint32_t i = 0; i < saves; ++i){
+      player.skills[0][1] = i;
+      std::ostringstream value;
+      value << i;
+      player.setStorage("key0", value.str());
+      if(fullSave){
+        g_databaseWriter.markFullSave(PLAYER_GUID);
+      }
+      CHECK(savePlayer(player));
+    }
+    time[fullSave] = (boost::posix_time::microsec_clock::local_time() - start).total_microseconds();
+    rows[fullSave] = getRowsWritten() - firstRow;
+  }
+  CHECK(savedMatches(player));
+  CHECK(rows[0] < rows[1]);
+
+  std::cout << "Player saves, " << player.storage.size() << " storage keys and "
+    << player.vipList.size() << " VIPs, one key and one skill changed:" << std::endl;
+  std::cout << "  full save:    " << rows[1] / saves << " rows, " << time[1] / saves << " us" << std::endl;
+  std::cout << "  changes only: " << rows[0] / saves << " rows, " << time[0] / saves << " us" << std::endl;
+
+  std::remove(databaseFile.c_str());
+  if(failed){
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Player saves read back as they were written." << std::endl;
+  return EXIT_SUCCESS;
+}
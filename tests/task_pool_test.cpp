@@ -0,0 +1,229 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Heap allocations of tasks once the task pool is warm
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <cstdlib>
+#include <new>
+#include "tasks.h"
+#include "scheduler.h"
+#include "position.h"
+
+// Every heap allocation of the process, whatever thread makes it
+static boost::atomic<uint64_t> heapAllocations(0);
+
+void* operator new(size_t size)
+{
+  ++heapAllocations;
+  void* p = std::malloc(size ? size : 1);
+  if(!p){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {return operator new(size);}
+void operator delete(void* p) throw() {std::free(p);}
+void operator delete[](void* p) throw() {std::free(p);}
+void operator delete(void* p, size_t) throw() {std::free(p);}
+void operator delete[](void* p, size_t) throw() {std::free(p);}
+
+// Game calls of the shapes the protocol queues
+struct TestGame{
+  TestGame() : calls(0) {}
+
+  void playerMove(uint32_t playerId, int32_t direction) {++calls;}
+  void playerUseItemEx(uint32_t playerId, const Position& fromPos, uint8_t fromStackPos,
+    uint16_t fromSpriteId, const Position& toPos, uint8_t toStackPos, uint16_t toSpriteId, bool isHotkey) {++calls;}
+  void playerSay(uint32_t playerId, uint16_t channelId, int32_t type,
+    const std::string& receiver, const std::string& text) {++calls;}
+
+  boost::atomic<uint32_t> calls;
+};
+
+// Wider than TaskFunction::inline_size, like the violation window binds
+struct LargeCall{
+  LargeCall(TestGame* game) : game(game) {}
+  void operator()() const {game->playerMove(1, 0);}
+
+  TestGame* game;
+  char data[TaskFunction::inline_size];
+};
+
+// Tasks are made on this thread and run and deleted on another, like
+// the protocol threads and the dispatcher
+class TaskHandoff{
+public:
+  enum {BATCH_SIZE = 2000};
+
+  TaskHandoff() : m_count(0), m_ready(false), m_stop(false)
+  {
+    m_thread = boost::thread(boost::bind(&TaskHandoff::consumerThread, this));
+  }
+
+  ~TaskHandoff()
+  {
+    {
+      boost::lock_guard<boost::mutex> lockClass(m_lock);
+      m_stop = true;
+    }
+    m_signal.notify_all();
+    m_thread.join();
+  }
+
+  void add(Task* task) {m_tasks[m_count++] = task;}
+
+  // Hands the batch over and waits until all of it ran
+  void run()
+  {
+    boost::unique_lock<boost::mutex> lockUnique(m_lock);
+    m_ready = true;
+    m_signal.notify_all();
+    while(m_ready){
+      m_signal.wait(lockUnique);
+    }
+  }
+
+protected:
+  void consumerThread()
+  {
+    boost::unique_lock<boost::mutex> lockUnique(m_lock);
+    while(true){
+      while(!m_ready && !m_stop){
+        m_signal.wait(lockUnique);
+      }
+
+      if(!m_ready){
+        break;
+      }
+
+      for(uint32_t i = 0; i < m_count; ++i){
+        (*m_tasks[i])();
+        delete m_tasks[i];
+      }
+
+      m_count = 0;
+      m_ready = false;
+      m_signal.notify_all();
+    }
+  }
+
+  boost::thread m_thread;
+  boost::mutex m_lock;
+  boost::condition_variable m_signal;
+  Task* m_tasks[BATCH_SIZE];
+  uint32_t m_count;
+  bool m_ready;
+  bool m_stop;
+};
+
+enum TaskKind{
+  TASK_IDS,
+  TASK_POSITIONS,
+  TASK_SCHEDULED,
+  TASK_STRING,
+  TASK_LARGE
+};
+
+static const char* kindNames[] = {
+  "ids only",
+  "positions, inline limit",
+  "scheduler task, ids only",
+  "long std::string argument",
+  "larger than inline_size"
+};
+
+// Heap allocations per task for batches of one kind of task
+static double measure(TaskHandoff& handoff, TestGame& game, TaskKind kind, uint32_t batches,
+  uint64_t& poolAllocations)
+{
+  Position pos(100, 100, 7);
+  std::string receiver;
+  std::string text = "a message too long for the small string buffer of std::string";
+
+  uint64_t firstAllocation = heapAllocations;
+  uint64_t firstPoolAllocation = TaskPool::getHeapAllocations();
+  for(uint32_t batch = 0; batch < batches; ++batch){
+    for(uint32_t i = 0; i < TaskHandoff::BATCH_SIZE; ++i){
+      switch(kind){
+        case TASK_IDS:
+          handoff.add(createTask(boost::bind(&TestGame::playerMove, &game, i, 1)));
+          break;
+        case TASK_POSITIONS:
+          handoff.add(createTask(boost::bind(&TestGame::playerUseItemEx, &game, i,
+            pos, 1, 2400, pos, 2, 2401, false)));
+          break;
+        case TASK_SCHEDULED:
+          handoff.add(createSchedulerTask(1000, boost::bind(&TestGame::playerMove, &game, i, 1)));
+          break;
+        case TASK_STRING:
+          handoff.add(createTask(boost::bind(&TestGame::playerSay, &game, i, 0, 1, receiver, text)));
+          break;
+        case TASK_LARGE:
+          handoff.add(createTask(LargeCall(&game)));
+          break;
+      }
+    }
+
+    handoff.run();
+  }
+
+  poolAllocations = TaskPool::getHeapAllocations() - firstPoolAllocation;
+  return double(heapAllocations - firstAllocation) / (batches * TaskHandoff::BATCH_SIZE);
+}
+
+int main()
+{
+  TestGame game;
+  bool failed = false;
+  {
+    TaskHandoff handoff;
+    uint64_t poolAllocations;
+
+    //fill the pool and the caches of both threads
+    for(int32_t kind = TASK_IDS; kind <= TASK_LARGE; ++kind){
+      measure(handoff, game, (TaskKind)kind, 4, poolAllocations);
+    }
+
+    for(int32_t kind = TASK_IDS; kind <= TASK_LARGE; ++kind){
+      double perTask = measure(handoff, game, (TaskKind)kind, 20, poolAllocations);
+      std::cout << "  " << kindNames[kind] << ": " << perTask << " heap allocations per task, "
+        << poolAllocations << " new pool blocks" << std::endl;
+
+      if(poolAllocations != 0){
+        failed = true;
+      }
+
+      //binds of ids and positions have to fit in the task, anything else
+      //shows the allocations are counted at all
+      bool expectAllocations = (kind == TASK_STRING || kind == TASK_LARGE);
+      if((perTask != 0) != expectAllocations){
+        failed = true;
+      }
+    }
+  }
+
+  if(failed){
+    std::cout << "Tasks: steady state heap allocations are not as expected." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Tasks: no heap allocations once the pool is warm." << std::endl;
+  return EXIT_SUCCESS;
+}